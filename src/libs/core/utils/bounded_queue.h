@@ -0,0 +1,189 @@
+/***************************************************************************
+ *  bounded_queue.h - Bounded lock-free queue
+ *
+ *  Created: Mon Oct 19 00:41:57 2026
+ *  Copyright  2026  agent
+ *
+ ****************************************************************************/
+
+/*  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version. A runtime exception applies to
+ *  this software (see LICENSE.GPL_WRE file mentioned below for details).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  Read the full text in the LICENSE.GPL_WRE file in the doc directory.
+ */
+
+#ifndef __CORE_UTILS_BOUNDED_QUEUE_H_
+#define __CORE_UTILS_BOUNDED_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fawkes {
+
+/** @class BoundedQueue <core/utils/bounded_queue.h>
+ * Bounded lock-free queue.
+ * Multiple threads may push and pop concurrently without taking a lock.
+ * The capacity is fixed on construction and rounded up to the next
+ * power of two. Each slot carries a sequence number which tells producers
+ * and consumers whether the slot is free or filled for the current lap,
+ * hence a push never blocks, it fails if the queue is full.
+ *
+ * @ingroup FCL
+ * @author agent
+ */
+template <typename Type>
+class BoundedQueue
+{
+ public:
+  /** Constructor.
+   * @param capacity minimum number of elements the queue can hold
+   */
+  BoundedQueue(size_t capacity);
+
+  /** Destructor. */
+  ~BoundedQueue();
+
+  /** Push element to queue.
+   * @param x element to add
+   * @return true if the element was added, false if the queue is full
+   */
+  bool     try_push(const Type &x);
+
+  /** Pop element from queue.
+   * @param x upon return contains the removed element
+   * @return true if an element was removed, false if the queue is empty
+   */
+  bool     try_pop(Type &x);
+
+  /** Get capacity.
+   * @return maximum number of elements in the queue
+   */
+  size_t   capacity() const
+  { return __mask + 1; }
+
+  /** Get approximate size.
+   * The value may be outdated by the time it is returned.
+   * @return number of elements in the queue
+   */
+  size_t   size_approx() const;
+
+ private:
+  BoundedQueue(const BoundedQueue<Type> &);
+  BoundedQueue<Type> & operator=(const BoundedQueue<Type> &);
+
+  /// @cond INTERNALS
+  struct Cell {
+    std::atomic<size_t> seq;
+    Type                data;
+  };
+  /// @endcond
+
+  std::vector<Cell>   __cells;
+  size_t              __mask;
+  // separate cache lines for producers and consumers
+  char                __pad0[64];
+  std::atomic<size_t> __enqueue_pos;
+  char                __pad1[64];
+  std::atomic<size_t> __dequeue_pos;
+  char                __pad2[64];
+};
+
+
+template <typename Type>
+BoundedQueue<Type>::BoundedQueue(size_t capacity)
+{
+  size_t size = 2;
+  while (size < capacity)  size <<= 1;
+  __mask = size - 1;
+
+  __cells = std::vector<Cell>(size);
+  for (size_t i = 0; i < size; ++i) {
+    __cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+  __enqueue_pos.store(0, std::memory_order_relaxed);
+  __dequeue_pos.store(0, std::memory_order_relaxed);
+}
+
+
+template <typename Type>
+BoundedQueue<Type>::~BoundedQueue()
+{
+}
+
+
+template <typename Type>
+bool
+BoundedQueue<Type>::try_push(const Type &x)
+{
+  Cell *cell;
+  size_t pos = __enqueue_pos.load(std::memory_order_relaxed);
+  for (;;) {
+    cell = &__cells[pos & __mask];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (__enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+	break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = __enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  cell->data = x;
+  cell->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+
+template <typename Type>
+bool
+BoundedQueue<Type>::try_pop(Type &x)
+{
+  Cell *cell;
+  size_t pos = __dequeue_pos.load(std::memory_order_relaxed);
+  for (;;) {
+    cell = &__cells[pos & __mask];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (__dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+	break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = __dequeue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  x = cell->data;
+  cell->data = Type();
+  cell->seq.store(pos + __mask + 1, std::memory_order_release);
+  return true;
+}
+
+
+template <typename Type>
+size_t
+BoundedQueue<Type>::size_approx() const
+{
+  size_t enq = __enqueue_pos.load(std::memory_order_relaxed);
+  size_t deq = __dequeue_pos.load(std::memory_order_relaxed);
+  return (enq > deq) ? (enq - deq) : 0;
+}
+
+
+} // end namespace fawkes
+
+#endif
@@ -64,6 +64,13 @@ NetworkLogger::send_message(Logger::LogLevel level, struct timeval *t,
 			    const char *component, bool is_exception,
 			    const char *format, va_list va)
 {
+  if (! pb_server_->subscribed_any(llsf_log_msgs::LogMessage::COMP_ID,
+				   llsf_log_msgs::LogMessage::MSG_TYPE))
+  {
+    // nobody listens, avoid formatting the message
+    return;
+  }
+
   struct timeval now;
   if ( t == NULL ) {
     gettimeofday(&now, NULL);
@@ -97,6 +104,13 @@ NetworkLogger::send_message(Logger::LogLevel level, struct timeval *t,
 			    const char *component, bool is_exception,
 			    const char *message)
 {
+  if (! pb_server_->subscribed_any(llsf_log_msgs::LogMessage::COMP_ID,
+				   llsf_log_msgs::LogMessage::MSG_TYPE))
+  {
+    // nobody listens, avoid formatting the message
+    return;
+  }
+
   struct timeval now;
   if ( t == NULL ) {
     gettimeofday(&now, NULL);
@@ -0,0 +1,535 @@
+
+/***************************************************************************
+ *  traffic_journal.cpp - Local append-only protobuf traffic journal
+ *
+ *  Created: Mon Oct 19 00:50:41 2026
+ *  Copyright  2026  agent
+ *
+ ****************************************************************************/
+
+/*  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version. A runtime exception applies to
+ *  this software (see LICENSE.GPL_WRE file mentioned below for details).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  Read the full text in the LICENSE.GPL_WRE file in the doc directory.
+ */
+
+#include <logging/traffic_journal.h>
+#include <logging/logger.h>
+
+#include <core/exception.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace llsfrb {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+/* Journal layout
+ *
+ * A journal consists of segment files, each starting with a 16 byte
+ * header: the magic "RCLLJRNL", a 32 bit format version and the 32 bit
+ * random seed of the refbox (0 if unknown). The header is followed by
+ * records, all integers are little endian:
+ *   uint32 length of the remainder of the record
+ *   int64  timestamp seconds, int32 timestamp microseconds
+ *   uint8  direction, uint8 via
+ *   uint16 component ID, uint16 message type
+ *   uint16 endpoint length, uint16 type name length, uint32 data length
+ *   uint16 peer ID
+ *   endpoint, type name, serialized message
+ * Records with via "event" are events of the refbox itself rather than
+ * messages, e.g., a tick. The type name is the event name and the data
+ * holds its parameters.
+ * Records are only ever appended. A segment ending in a partial record
+ * was cut short while writing, everything before it is valid.
+ */
+
+/// @cond INTERNALS
+static const char     JOURNAL_MAGIC[8]    = { 'R', 'C', 'L', 'L', 'J', 'R', 'N', 'L' };
+static const uint32_t JOURNAL_VERSION     = 1;
+static const size_t   JOURNAL_HEADER_SIZE = 16;
+static const size_t   JOURNAL_FIXED_SIZE  = 28;
+static const size_t   JOURNAL_FLUSH_SIZE  = 64 * 1024;
+static const unsigned int JOURNAL_REPORT_INTERVAL_SEC = 10;
+
+static inline void
+put_le(std::string &buf, uint64_t value, unsigned int bytes)
+{
+  for (unsigned int i = 0; i < bytes; ++i) {
+    buf.push_back((char)((value >> (8 * i)) & 0xff));
+  }
+}
+
+static inline uint64_t
+get_le(const unsigned char *buf, unsigned int bytes)
+{
+  uint64_t value = 0;
+  for (unsigned int i = 0; i < bytes; ++i) {
+    value |= (uint64_t)buf[i] << (8 * i);
+  }
+  return value;
+}
+/// @endcond
+
+
+/** Get name of a journal direction.
+ * @param direction direction to get name for
+ * @return "inbound" or "outbound"
+ */
+const char *
+journal_direction_name(JournalDirection direction)
+{
+  return (direction == JOURNAL_OUTBOUND) ? "outbound" : "inbound";
+}
+
+
+/** Get name of a journal channel.
+ * @param via channel to get name for
+ * @return "server", "client", or "peer"
+ */
+const char *
+journal_via_name(JournalVia via)
+{
+  switch (via) {
+  case JOURNAL_VIA_CLIENT: return "client";
+  case JOURNAL_VIA_PEER:   return "peer";
+  case JOURNAL_VIA_EVENT:  return "event";
+  default:                 return "server";
+  }
+}
+
+
+/** @class TrafficJournalWriter <logging/traffic_journal.h>
+ * Append protobuf traffic to a local journal.
+ * Messages are serialized into a length-prefixed record and appended
+ * to an in-memory buffer. A background thread writes the buffer to the
+ * current segment file once it has grown large enough, and syncs the
+ * file to disk periodically. Segments are named after the time the
+ * writer was created and numbered consecutively, a new segment is started
+ * once the current one exceeds the segment size.
+ * If the disk cannot keep up and the buffer exceeds its maximum size,
+ * messages are dropped and accounted for, see dropped(). Messages which
+ * cannot be written are accounted for as failed(). The first error is
+ * logged right away, lost messages are reported at most every ten seconds
+ * and once more when the writer is destroyed.
+ * @author agent
+ */
+
+/** Constructor.
+ * @param logger logger to report write errors and lost messages to
+ * @param directory directory to write segments to, created if it does not exist
+ * @param random_seed random seed of the refbox, stored in the segment headers
+ * to be able to replay the game later, 0 if unknown
+ * @param segment_size approximate maximum size of a segment in bytes
+ * @param sync_interval_ms interval in milliseconds to sync data to disk
+ * @param max_buffer_size maximum number of bytes waiting to be written
+ */
+TrafficJournalWriter::TrafficJournalWriter(Logger *logger, const std::string &directory,
+					   uint32_t random_seed,
+					   size_t segment_size, unsigned int sync_interval_ms,
+					   size_t max_buffer_size)
+  : logger_(logger), directory_(directory), random_seed_(random_seed), segment_size_(segment_size),
+    sync_interval_ms_(sync_interval_ms), max_buffer_size_(max_buffer_size),
+    fd_(-1), segment_index_(0), segment_bytes_(0), error_logged_(false), reported_lost_(0),
+    running_(true), flush_requested_(false),
+    buffer_records_(0), appended_(0), synced_(0), dropped_(0), failed_(0)
+{
+  if (mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST) {
+    throw fawkes::Exception("Cannot create journal directory %s: %s",
+			    directory_.c_str(), strerror(errno));
+  }
+
+  time_t now = time(NULL);
+  struct tm now_tm;
+  localtime_r(&now, &now_tm);
+  char tmp[32];
+  strftime(tmp, sizeof(tmp), "%Y%m%d-%H%M%S", &now_tm);
+  basename_ = std::string("traffic-") + tmp;
+
+  // fail early if the directory is not writable
+  open_segment();
+
+  next_report_ = std::chrono::steady_clock::now();
+
+  writer_thread_ = std::thread(&TrafficJournalWriter::writer_loop, this);
+}
+
+
+/** Destructor.
+ * Writes and syncs all pending messages.
+ */
+TrafficJournalWriter::~TrafficJournalWriter()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  writer_cond_.notify_all();
+  writer_thread_.join();
+  close_segment();
+  report_losses(true);
+}
+
+
+/** Append a message to the journal.
+ * @param time time the message was sent or received
+ * @param direction direction of the message
+ * @param via communication channel
+ * @param endpoint remote endpoint, format depends on via
+ * @param peer_id ID of the peer the message was received on or sent with,
+ * 0 if not sent or received via a peer
+ * @param component_id component ID of the message
+ * @param msg_type message type of the message
+ * @param m message to append
+ */
+void
+TrafficJournalWriter::append(const struct timeval &time,
+			     JournalDirection direction, JournalVia via,
+			     const std::string &endpoint, uint16_t peer_id,
+			     uint16_t component_id, uint16_t msg_type,
+			     const google::protobuf::Message &m)
+{
+  std::string data;
+  m.SerializeToString(&data);
+  append_record(time, direction, via, endpoint, peer_id, component_id, msg_type,
+		m.GetDescriptor()->full_name(), data);
+}
+
+
+/** Append an event to the journal.
+ * Events are no messages, but mark points in the execution of the
+ * refbox, e.g., a tick, so that they can be reproduced when replaying.
+ * @param time time of the event
+ * @param event name of the event
+ * @param data parameters of the event
+ */
+void
+TrafficJournalWriter::append_event(const struct timeval &time, const std::string &event,
+				   const std::string &data)
+{
+  append_record(time, JOURNAL_OUTBOUND, JOURNAL_VIA_EVENT, "", 0, 0, 0, event, data);
+}
+
+
+void
+TrafficJournalWriter::append_record(const struct timeval &time,
+				    JournalDirection direction, JournalVia via,
+				    const std::string &endpoint, uint16_t peer_id,
+				    uint16_t component_id, uint16_t msg_type,
+				    const std::string &type_name, const std::string &data)
+{
+  size_t endpoint_size  = std::min(endpoint.size(), (size_t)0xffff);
+  size_t type_name_size = std::min(type_name.size(), (size_t)0xffff);
+  size_t length = JOURNAL_FIXED_SIZE + endpoint_size + type_name_size + data.size();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (buffer_.size() + 4 + length > max_buffer_size_) {
+    ++dropped_;
+    return;
+  }
+
+  put_le(buffer_, length, 4);
+  put_le(buffer_, (uint64_t)(int64_t)time.tv_sec, 8);
+  put_le(buffer_, (uint32_t)(int32_t)time.tv_usec, 4);
+  put_le(buffer_, direction, 1);
+  put_le(buffer_, via, 1);
+  put_le(buffer_, component_id, 2);
+  put_le(buffer_, msg_type, 2);
+  put_le(buffer_, endpoint_size, 2);
+  put_le(buffer_, type_name_size, 2);
+  put_le(buffer_, data.size(), 4);
+  put_le(buffer_, peer_id, 2);
+  buffer_.append(endpoint, 0, endpoint_size);
+  buffer_.append(type_name, 0, type_name_size);
+  buffer_.append(data);
+  buffer_records_ += 1;
+  appended_ += 1;
+
+  if (buffer_.size() >= JOURNAL_FLUSH_SIZE)  writer_cond_.notify_one();
+}
+
+
+/** Write and sync all messages appended so far.
+ * Returns once the messages have been written to disk.
+ */
+void
+TrafficJournalWriter::flush()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  unsigned long int target = appended_;
+  flush_requested_ = true;
+  writer_cond_.notify_all();
+  synced_cond_.wait(lock, [this, target]{ return synced_ >= target || ! running_; });
+}
+
+
+void
+TrafficJournalWriter::writer_loop()
+{
+  std::chrono::steady_clock::time_point next_sync =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(sync_interval_ms_);
+
+  bool stop = false;
+  while (! stop) {
+    std::string out;
+    unsigned long int records, target;
+    bool do_sync;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      writer_cond_.wait_until(lock, next_sync,
+			      [this]{ return ! running_ || flush_requested_ ||
+				      buffer_.size() >= JOURNAL_FLUSH_SIZE; });
+      out.swap(buffer_);
+      records = buffer_records_;
+      buffer_records_ = 0;
+      target = appended_;
+      stop = ! running_;
+      do_sync = stop || flush_requested_ ||
+	std::chrono::steady_clock::now() >= next_sync;
+      flush_requested_ = false;
+    }
+
+    if (! out.empty())  write_out(out, records);
+
+    if (do_sync) {
+      if (fd_ >= 0)  fdatasync(fd_);
+      next_sync =
+	std::chrono::steady_clock::now() + std::chrono::milliseconds(sync_interval_ms_);
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      synced_ = target;
+      synced_cond_.notify_all();
+    }
+
+    if (std::chrono::steady_clock::now() >= next_report_)  report_losses(false);
+  }
+}
+
+
+void
+TrafficJournalWriter::write_out(const std::string &buffer, unsigned long int records)
+{
+  if (fd_ >= 0 && segment_bytes_ > JOURNAL_HEADER_SIZE &&
+      segment_bytes_ + buffer.size() > segment_size_)
+  {
+    close_segment();
+  }
+  if (fd_ < 0) {
+    try {
+      open_segment();
+    } catch (fawkes::Exception &e) {
+      if (! error_logged_) {
+	logger_->log_error("Journal", "Journal messages are lost: %s", e.what_no_backtrace());
+	error_logged_ = true;
+      }
+      failed_ += records;
+      return;
+    }
+    if (error_logged_) {
+      logger_->log_info("Journal", "Journal continues in segment %s", segment_path_.c_str());
+      error_logged_ = false;
+    }
+  }
+
+  const char *p = buffer.data();
+  size_t remaining = buffer.size();
+  while (remaining > 0) {
+    ssize_t written = ::write(fd_, p, remaining);
+    if (written < 0) {
+      if (errno == EINTR)  continue;
+      if (! error_logged_) {
+	logger_->log_error("Journal", "Cannot write journal segment %s, messages are lost: %s",
+			   segment_path_.c_str(), strerror(errno));
+	error_logged_ = true;
+      }
+      failed_ += records;
+      // start a new segment, the current one ends in a partial record
+      close_segment();
+      return;
+    }
+    p += written;
+    remaining -= written;
+  }
+  segment_bytes_ += buffer.size();
+}
+
+
+void
+TrafficJournalWriter::report_losses(bool final)
+{
+  unsigned long int dropped = dropped_, failed = failed_;
+  unsigned long int lost = dropped + failed;
+  if (lost > reported_lost_ || (final && lost > 0)) {
+    logger_->log_warn("Journal", "Journal lost %lu messages %s (%lu dropped, %lu failed)",
+		      lost, final ? "in total" : "so far", dropped, failed);
+    reported_lost_ = lost;
+  }
+  next_report_ =
+    std::chrono::steady_clock::now() + std::chrono::seconds(JOURNAL_REPORT_INTERVAL_SEC);
+}
+
+
+void
+TrafficJournalWriter::open_segment()
+{
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "-%05u.journal", segment_index_++);
+  segment_path_ = directory_ + "/" + basename_ + suffix;
+
+  fd_ = open(segment_path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+  if (fd_ < 0) {
+    throw fawkes::Exception("Cannot create journal segment %s: %s",
+			    segment_path_.c_str(), strerror(errno));
+  }
+
+  std::string header(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+  put_le(header, JOURNAL_VERSION, 4);
+  put_le(header, random_seed_, 4);
+  if (::write(fd_, header.data(), header.size()) != (ssize_t)header.size()) {
+    int err = errno;
+    ::close(fd_);
+    fd_ = -1;
+    throw fawkes::Exception("Cannot write journal header to %s: %s",
+			    segment_path_.c_str(), strerror(err));
+  }
+  segment_bytes_ = header.size();
+}
+
+
+void
+TrafficJournalWriter::close_segment()
+{
+  if (fd_ >= 0) {
+    fdatasync(fd_);
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+
+/** @class TrafficJournalReader <logging/traffic_journal.h>
+ * Read records from a traffic journal.
+ * The segments are read in the given order, which for the segments of
+ * a single writer is the alphabetical order of the file names.
+ * @author agent
+ */
+
+/** Constructor.
+ * @param segments paths of the segment files to read
+ */
+TrafficJournalReader::TrafficJournalReader(const std::vector<std::string> &segments)
+  : segments_(segments), segment_index_(0), file_(NULL), truncated_(0),
+    random_seed_(0)
+{
+}
+
+
+/** Destructor. */
+TrafficJournalReader::~TrafficJournalReader()
+{
+  if (file_)  fclose(file_);
+}
+
+
+bool
+TrafficJournalReader::open_next_segment()
+{
+  if (file_) {
+    fclose(file_);
+    file_ = NULL;
+  }
+  if (segment_index_ >= segments_.size())  return false;
+
+  const std::string &path = segments_[segment_index_++];
+  file_ = fopen(path.c_str(), "rb");
+  if (! file_) {
+    throw fawkes::Exception("Cannot open journal segment %s: %s",
+			    path.c_str(), strerror(errno));
+  }
+
+  unsigned char header[JOURNAL_HEADER_SIZE];
+  if (fread(header, 1, sizeof(header), file_) != sizeof(header) ||
+      memcmp(header, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0)
+  {
+    throw fawkes::Exception("%s is not a traffic journal", path.c_str());
+  }
+  uint32_t version = get_le(header + sizeof(JOURNAL_MAGIC), 4);
+  if (version != JOURNAL_VERSION) {
+    throw fawkes::Exception("%s has unsupported journal version %u",
+			    path.c_str(), version);
+  }
+  uint32_t random_seed = get_le(header + sizeof(JOURNAL_MAGIC) + 4, 4);
+  if (random_seed != 0)  random_seed_ = random_seed;
+  return true;
+}
+
+
+/** Read next record.
+ * @param record upon return contains the next record
+ * @return true if a record was read, false if all segments have been read
+ * @exception Exception thrown if a segment cannot be opened or is not a
+ * traffic journal
+ */
+bool
+TrafficJournalReader::next(JournalRecord &record)
+{
+  while (true) {
+    if (! file_ && ! open_next_segment())  return false;
+
+    unsigned char length_buf[4];
+    size_t n = fread(length_buf, 1, sizeof(length_buf), file_);
+    if (n == 0) {
+      if (! open_next_segment())  return false;
+      continue;
+    }
+
+    uint32_t length = 0;
+    if (n == sizeof(length_buf))  length = get_le(length_buf, 4);
+
+    if (length >= JOURNAL_FIXED_SIZE) {
+      record_buf_.resize(length);
+      if (fread(&record_buf_[0], 1, length, file_) == length) {
+	const unsigned char *p = (const unsigned char *)record_buf_.data();
+	size_t endpoint_size  = get_le(p + 18, 2);
+	size_t type_name_size = get_le(p + 20, 2);
+	size_t data_size      = get_le(p + 22, 4);
+	if (JOURNAL_FIXED_SIZE + endpoint_size + type_name_size + data_size == length) {
+	  record.time.tv_sec   = (int64_t)get_le(p, 8);
+	  record.time.tv_usec  = (int32_t)get_le(p + 8, 4);
+	  record.direction     = (JournalDirection)p[12];
+	  record.via           = (JournalVia)p[13];
+	  record.component_id  = get_le(p + 14, 2);
+	  record.msg_type      = get_le(p + 16, 2);
+	  record.peer_id       = get_le(p + 26, 2);
+	  const char *s = record_buf_.data() + JOURNAL_FIXED_SIZE;
+	  record.endpoint.assign(s, endpoint_size);
+	  record.type_name.assign(s + endpoint_size, type_name_size);
+	  record.data.assign(s + endpoint_size + type_name_size, data_size);
+	  return true;
+	}
+      }
+    }
+
+    // incomplete or inconsistent record, the rest of the segment is unusable
+    ++truncated_;
+    if (! open_next_segment())  return false;
+  }
+}
+
+} // end namespace llsfrb
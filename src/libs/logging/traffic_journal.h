@@ -0,0 +1,183 @@
+
+/***************************************************************************
+ *  traffic_journal.h - Local append-only protobuf traffic journal
+ *
+ *  Created: Mon Oct 19 00:50:41 2026
+ *  Copyright  2026  agent
+ *
+ ****************************************************************************/
+
+/*  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version. A runtime exception applies to
+ *  this software (see LICENSE.GPL_WRE file mentioned below for details).
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  Read the full text in the LICENSE.GPL_WRE file in the doc directory.
+ */
+
+#ifndef __UTILS_LOGGING_TRAFFIC_JOURNAL_H_
+#define __UTILS_LOGGING_TRAFFIC_JOURNAL_H_
+
+#include <google/protobuf/message.h>
+
+#include <sys/time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace llsfrb {
+
+class Logger;
+
+/** Direction of a journaled message. */
+typedef enum {
+  JOURNAL_INBOUND  = 0,	///< message was received
+  JOURNAL_OUTBOUND = 1	///< message was sent
+} JournalDirection;
+
+/** Communication channel of a journaled message. */
+typedef enum {
+  JOURNAL_VIA_SERVER = 0,	///< stream server, endpoint is the client ID
+  JOURNAL_VIA_CLIENT = 1,	///< stream client, endpoint is host:port
+  JOURNAL_VIA_PEER   = 2,	///< broadcast peer, endpoint is host:port if known
+  JOURNAL_VIA_EVENT  = 3	///< no message but an event of the refbox, type name
+				///< is the event name, data its parameters
+} JournalVia;
+
+/** A single message stored in a traffic journal. */
+typedef struct {
+  struct timeval   time;		///< time the message was sent or received
+  JournalDirection direction;		///< direction of the message
+  JournalVia       via;			///< communication channel
+  std::string      endpoint;		///< remote endpoint, format depends on via
+  uint16_t         peer_id;		///< peer received on or sent with, 0 if not via peer
+  uint16_t         component_id;	///< component ID, 0 if unknown
+  uint16_t         msg_type;		///< message type, 0 if unknown
+  std::string      type_name;		///< full protobuf type name
+  std::string      data;		///< serialized message
+} JournalRecord;
+
+const char * journal_direction_name(JournalDirection direction);
+const char * journal_via_name(JournalVia via);
+
+
+class TrafficJournalWriter
+{
+ public:
+  TrafficJournalWriter(Logger *logger, const std::string &directory,
+		       uint32_t random_seed = 0,
+		       size_t segment_size = 64 * 1024 * 1024,
+		       unsigned int sync_interval_ms = 1000,
+		       size_t max_buffer_size = 32 * 1024 * 1024);
+  ~TrafficJournalWriter();
+
+  void append(const struct timeval &time, JournalDirection direction, JournalVia via,
+	      const std::string &endpoint, uint16_t peer_id,
+	      uint16_t component_id, uint16_t msg_type,
+	      const google::protobuf::Message &m);
+  void append_event(const struct timeval &time, const std::string &event,
+		    const std::string &data = "");
+
+  void flush();
+
+  /** Get number of messages dropped because the write buffer was full.
+   * @return number of dropped messages */
+  unsigned long int dropped() const
+  { return dropped_; }
+
+  /** Get number of messages lost due to write errors.
+   * @return number of messages which could not be written */
+  unsigned long int failed() const
+  { return failed_; }
+
+ private:
+  void writer_loop();
+  void write_out(const std::string &buffer, unsigned long int records);
+  void open_segment();
+  void close_segment();
+  void report_losses(bool final);
+  void append_record(const struct timeval &time, JournalDirection direction, JournalVia via,
+		     const std::string &endpoint, uint16_t peer_id,
+		     uint16_t component_id, uint16_t msg_type,
+		     const std::string &type_name, const std::string &data);
+
+ private:
+  Logger       *logger_;
+  std::string   directory_;
+  std::string   basename_;
+  uint32_t      random_seed_;
+  size_t        segment_size_;
+  unsigned int  sync_interval_ms_;
+  size_t        max_buffer_size_;
+
+  int           fd_;
+  std::string   segment_path_;
+  unsigned int  segment_index_;
+  size_t        segment_bytes_;
+  bool          error_logged_;
+
+  unsigned long int                      reported_lost_;
+  std::chrono::steady_clock::time_point  next_report_;
+
+  std::mutex               mutex_;
+  std::condition_variable  writer_cond_;
+  std::condition_variable  synced_cond_;
+  std::thread              writer_thread_;
+  bool                     running_;
+  bool                     flush_requested_;
+  std::string              buffer_;
+  unsigned long int        buffer_records_;
+  unsigned long int        appended_;
+  unsigned long int        synced_;
+
+  std::atomic<unsigned long int> dropped_;
+  std::atomic<unsigned long int> failed_;
+};
+
+
+class TrafficJournalReader
+{
+ public:
+  TrafficJournalReader(const std::vector<std::string> &segments);
+  ~TrafficJournalReader();
+
+  bool next(JournalRecord &record);
+
+  /** Get number of segments which ended in an incomplete record.
+   * This happens if the writer was terminated while writing.
+   * @return number of truncated segments */
+  unsigned int truncated() const
+  { return truncated_; }
+
+  /** Get random seed of the refbox which wrote the journal.
+   * @return random seed read from the segment headers so far, 0 if unknown */
+  uint32_t random_seed() const
+  { return random_seed_; }
+
+ private:
+  bool open_next_segment();
+
+ private:
+  std::vector<std::string> segments_;
+  size_t                   segment_index_;
+  FILE                    *file_;
+  unsigned int             truncated_;
+  uint32_t                 random_seed_;
+  std::string              record_buf_;
+};
+
+} // end namespace llsfrb
+
+#endif
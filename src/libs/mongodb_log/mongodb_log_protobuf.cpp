@@ -23,27 +23,43 @@
 #include <mongodb_log/mongodb_log_protobuf.h>
 
 #include <core/exception.h>
-#include <core/threading/mutex.h>
-#include <core/threading/mutex_locker.h>
 
 #include <mongo/client/dbclient.h>
 #include <google/protobuf/descriptor.h>
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <sys/time.h>
+
 using namespace mongo;
 using namespace google::protobuf;
 
-/** @class MongoDBLogProtobuf <mongodb_log/mongodb_log_logger.h>
- * Thread that provides a logger writing to MongoDB.
- * This thread provides a logger, which writes log information to a
- * MongoDB collection.
+/** @class MongoDBLogProtobuf <mongodb_log/mongodb_log_protobuf.h>
+ * Log protobuf messages to MongoDB.
+ * Messages are converted to BSON documents in the calling thread and
+ * handed to a bounded lock-free queue. A background thread takes
+ * documents off the queue and writes them with bulk inserts of up to
+ * a configurable batch size, hence callers never wait for the database.
+ * If the queue is full the document is dropped and accounted for, see
+ * dropped(). Call flush() to wait until everything written so far has
+ * been sent to the database, e.g. at the end of a game.
  * @author Tim Niemueller
  */
 
-/** Constructor. */
-MongoDBLogProtobuf::MongoDBLogProtobuf(std::string host_port, std::string collection)
+/** Constructor.
+ * @param host_port host and port of the MongoDB server, e.g. localhost:27017
+ * @param collection database and collection name to write to
+ * @param queue_size maximum number of documents waiting to be written
+ * @param batch_size maximum number of documents per bulk insert
+ */
+MongoDBLogProtobuf::MongoDBLogProtobuf(std::string host_port, std::string collection,
+				       size_t queue_size, size_t batch_size)
+  : queue_(queue_size), batch_size_(batch_size > 0 ? batch_size : 1),
+    running_(true), flush_requested_(false),
+    enqueued_(0), processed_(0), dropped_(0), failed_(0)
 {
-  mutex_ = new fawkes::Mutex();
-
   collection_ = collection;
 
   DBClientConnection *conn =
@@ -51,111 +67,263 @@ MongoDBLogProtobuf::MongoDBLogProtobuf(std::string host_port, std::string collec
   mongodb_ = conn;
   std::string errmsg;
   if (! conn->connect(host_port, errmsg)) {
+    delete conn;
     throw fawkes::Exception("Could not connect to MongoDB at %s: %s",
 			    host_port.c_str(), errmsg.c_str());
   }
+
+  writer_thread_ = std::thread(&MongoDBLogProtobuf::writer_loop, this);
 }
 
 
-/** Destructor. */
+/** Destructor.
+ * Writes all documents still queued before returning.
+ */
 MongoDBLogProtobuf::~MongoDBLogProtobuf()
 {
-  delete mutex_;
+  {
+    std::unique_lock<std::mutex> lock(writer_mutex_);
+    running_ = false;
+  }
+  writer_cond_.notify_all();
+  writer_thread_.join();
+  delete mongodb_;
 }
 
+
+/** Wait for queued documents to be written.
+ * Returns once all documents enqueued before the call have been passed
+ * to the database (successfully or not, see failed()).
+ */
 void
-MongoDBLogProtobuf::add_field(const FieldDescriptor *field,
-			      const ::google::protobuf::Message &m, BSONObjBuilder *b)
+MongoDBLogProtobuf::flush()
 {
-  const Reflection *refl = m.GetReflection();
+  unsigned long int target = enqueued_;
+  std::unique_lock<std::mutex> lock(writer_mutex_);
+  flush_requested_ = true;
+  writer_cond_.notify_all();
+  flushed_cond_.wait(lock, [this, target]{ return processed_ >= target; });
+  flush_requested_ = false;
+}
 
-  int count = 0;
-  if (field->is_repeated()) {
-    count = refl->FieldSize(m, field);
-  } else if (refl->HasField(m, field)) {
-    count = 1;
-  }
 
-  for (int j = 0; j < count; ++j) {
-    switch (field->type()) {
-#define HANDLE_PRIMITIVE_TYPE(TYPE, CPPTYPE, CPPTYPE_METHOD)		\
-      case FieldDescriptor::TYPE_##TYPE: {				\
-        const CPPTYPE value = field->is_repeated()			\
-	  ? refl->GetRepeated##CPPTYPE_METHOD(m, field, j)		\
-	  : refl->Get##CPPTYPE_METHOD(m, field);			\
-	  b->append(field->name(), value);				\
-	  break;							\
-      }
+void
+MongoDBLogProtobuf::enqueue(mongo::BSONObj &doc)
+{
+  if (queue_.try_push(doc)) {
+    ++enqueued_;
+    if (queue_.size_approx() >= batch_size_)  writer_cond_.notify_one();
+  } else {
+    ++dropped_;
+  }
+}
 
-      HANDLE_PRIMITIVE_TYPE( INT32, int,           Int32);
-      HANDLE_PRIMITIVE_TYPE( INT64, long long int, Int64);
-      HANDLE_PRIMITIVE_TYPE(SINT32, int,           Int32);
-      HANDLE_PRIMITIVE_TYPE(SINT64, long long int, Int64);
-      HANDLE_PRIMITIVE_TYPE(UINT32, unsigned int,  UInt32);
-      HANDLE_PRIMITIVE_TYPE(UINT64, long long int, UInt64);
-
-      HANDLE_PRIMITIVE_TYPE( FIXED32, unsigned int,  UInt32);
-      HANDLE_PRIMITIVE_TYPE( FIXED64, long long int, UInt64);
-      HANDLE_PRIMITIVE_TYPE(SFIXED32, int,           Int32);
-      HANDLE_PRIMITIVE_TYPE(SFIXED64, long long int, Int64);
-
-      HANDLE_PRIMITIVE_TYPE(FLOAT , float , Float );
-      HANDLE_PRIMITIVE_TYPE(DOUBLE, double, Double);
-
-      HANDLE_PRIMITIVE_TYPE(BOOL, bool, Bool);
-#undef HANDLE_PRIMITIVE_TYPE
-
-      case FieldDescriptor::TYPE_MESSAGE: {
-	const google::protobuf::Message &sub_m = field->is_repeated()
-	  ? refl->GetRepeatedMessage(m, field, j)
-	  : refl->GetMessage(m, field);   
-
-        BSONObjBuilder sub(b->subobjStart(field->name()));
-	add_message(sub_m, &sub);
-	sub.done();
-        break;
-      }
 
-      case FieldDescriptor::TYPE_GROUP:
-        break;
+void
+MongoDBLogProtobuf::writer_loop()
+{
+  std::vector<BSONObj> batch;
+  batch.reserve(batch_size_);
 
-      case FieldDescriptor::TYPE_ENUM: {
-        const EnumValueDescriptor* value = field->is_repeated()
-	  ? refl->GetRepeatedEnum(m, field, j)
-	  : refl->GetEnum(m, field);
-	b->append(field->name(), value->name());
-	break;
-      }
+  while (true) {
+    BSONObj doc;
+    while (batch.size() < batch_size_ && queue_.try_pop(doc)) {
+      batch.push_back(doc);
+    }
 
-      // Handle strings separately so that we can get string references
-      // instead of copying.
-      case FieldDescriptor::TYPE_STRING: {
-        string scratch;
-	const string& value = field->is_repeated()
-	  ? refl->GetRepeatedStringReference(m, field, j, &scratch)
-	  : refl->GetStringReference(m, field, &scratch);
-	//VerifyUTF8String(value.data(), value.length(), SERIALIZE);
-	b->append(field->name(), value);
-	break;
+    if (! batch.empty()) {
+      try {
+	mongodb_->insert(collection_, batch);
+      } catch (mongo::DBException &e) {
+	failed_ += batch.size();
       }
-  
-      case FieldDescriptor::TYPE_BYTES: {
-        string scratch;
-	const string& value = field->is_repeated()
-	  ? refl->GetRepeatedStringReference(m, field, j, &scratch)
-	  : refl->GetStringReference(m, field, &scratch);
-	b->appendBinData(field->name(), value.size(), BinDataGeneral, value.c_str());
-	break;
+      {
+	std::unique_lock<std::mutex> lock(writer_mutex_);
+	processed_ += batch.size();
       }
+      flushed_cond_.notify_all();
+      batch.clear();
+      continue;
     }
+
+    std::unique_lock<std::mutex> lock(writer_mutex_);
+    if (! running_)  break;
+    // time out regularly, producers only wake us once a batch is full
+    writer_cond_.wait_for(lock, std::chrono::milliseconds(50),
+			  [this]{ return ! running_ || flush_requested_ ||
+				  queue_.size_approx() >= batch_size_; });
   }
 }
 
+/// @cond INTERNALS
+namespace {
+
+struct ConversionPlan;
+struct FieldPlan;
+
+typedef void (*FieldAppender)(const FieldPlan &fp, const Message &m,
+			      const Reflection *refl, int index, BSONObjBuilder *b);
+
+/* How to convert a single field, resolved once per descriptor. */
+struct FieldPlan {
+  const FieldDescriptor *field;
+  std::string            name;
+  bool                   repeated;
+  FieldAppender          append;
+  const ConversionPlan  *sub_plan;
+};
+
+/* Fields to convert for a message type, ordered by field number. */
+struct ConversionPlan {
+  std::string            type_name;
+  std::vector<FieldPlan> fields;
+};
+
+void append_message(const ConversionPlan &plan, const Message &m, BSONObjBuilder *b);
+
+#define PRIMITIVE_APPENDER(TYPE, CPPTYPE, CPPTYPE_METHOD)		\
+  void append_##TYPE(const FieldPlan &fp, const Message &m,		\
+		     const Reflection *refl, int index, BSONObjBuilder *b) \
+  {									\
+    const CPPTYPE value = fp.repeated					\
+      ? refl->GetRepeated##CPPTYPE_METHOD(m, fp.field, index)		\
+      : refl->Get##CPPTYPE_METHOD(m, fp.field);				\
+    b->append(fp.name, value);						\
+  }
+
+PRIMITIVE_APPENDER(int32,  int,           Int32)
+PRIMITIVE_APPENDER(int64,  long long int, Int64)
+PRIMITIVE_APPENDER(uint32, unsigned int,  UInt32)
+PRIMITIVE_APPENDER(uint64, long long int, UInt64)
+PRIMITIVE_APPENDER(float,  float,         Float)
+PRIMITIVE_APPENDER(double, double,        Double)
+PRIMITIVE_APPENDER(bool,   bool,          Bool)
+#undef PRIMITIVE_APPENDER
+
+void
+append_enum(const FieldPlan &fp, const Message &m,
+	    const Reflection *refl, int index, BSONObjBuilder *b)
+{
+  const EnumValueDescriptor* value = fp.repeated
+    ? refl->GetRepeatedEnum(m, fp.field, index)
+    : refl->GetEnum(m, fp.field);
+  b->append(fp.name, value->name());
+}
+
+void
+append_string(const FieldPlan &fp, const Message &m,
+	      const Reflection *refl, int index, BSONObjBuilder *b)
+{
+  std::string scratch;
+  const std::string& value = fp.repeated
+    ? refl->GetRepeatedStringReference(m, fp.field, index, &scratch)
+    : refl->GetStringReference(m, fp.field, &scratch);
+  b->append(fp.name, value);
+}
 
 void
-MongoDBLogProtobuf::add_message(const google::protobuf::Message &m, BSONObjBuilder *b)
+append_bytes(const FieldPlan &fp, const Message &m,
+	     const Reflection *refl, int index, BSONObjBuilder *b)
 {
-  b->append("_type", m.GetTypeName());
+  std::string scratch;
+  const std::string& value = fp.repeated
+    ? refl->GetRepeatedStringReference(m, fp.field, index, &scratch)
+    : refl->GetStringReference(m, fp.field, &scratch);
+  b->appendBinData(fp.name, value.size(), BinDataGeneral, value.c_str());
+}
+
+void
+append_submessage(const FieldPlan &fp, const Message &m,
+		  const Reflection *refl, int index, BSONObjBuilder *b)
+{
+  const Message &sub_m = fp.repeated
+    ? refl->GetRepeatedMessage(m, fp.field, index)
+    : refl->GetMessage(m, fp.field);
+
+  BSONObjBuilder sub(b->subobjStart(fp.name));
+  append_message(*fp.sub_plan, sub_m, &sub);
+  sub.done();
+}
+
+FieldAppender
+appender_for(const FieldDescriptor *field)
+{
+  switch (field->type()) {
+  case FieldDescriptor::TYPE_INT32:
+  case FieldDescriptor::TYPE_SINT32:
+  case FieldDescriptor::TYPE_SFIXED32: return append_int32;
+  case FieldDescriptor::TYPE_INT64:
+  case FieldDescriptor::TYPE_SINT64:
+  case FieldDescriptor::TYPE_SFIXED64: return append_int64;
+  case FieldDescriptor::TYPE_UINT32:
+  case FieldDescriptor::TYPE_FIXED32:  return append_uint32;
+  case FieldDescriptor::TYPE_UINT64:
+  case FieldDescriptor::TYPE_FIXED64:  return append_uint64;
+  case FieldDescriptor::TYPE_FLOAT:    return append_float;
+  case FieldDescriptor::TYPE_DOUBLE:   return append_double;
+  case FieldDescriptor::TYPE_BOOL:     return append_bool;
+  case FieldDescriptor::TYPE_ENUM:     return append_enum;
+  case FieldDescriptor::TYPE_STRING:   return append_string;
+  case FieldDescriptor::TYPE_BYTES:    return append_bytes;
+  case FieldDescriptor::TYPE_MESSAGE:  return append_submessage;
+  default:                             return NULL; // groups are not supported
+  }
+}
+
+std::mutex  g_plans_mutex;
+std::unordered_map<const Descriptor *, std::unique_ptr<ConversionPlan>> g_plans;
+
+/* Must be called with g_plans_mutex held. The plan is registered before
+ * its fields are resolved so that recursive message types terminate. */
+const ConversionPlan *
+plan_for_locked(const Descriptor *desc)
+{
+  auto p = g_plans.find(desc);
+  if (p != g_plans.end())  return p->second.get();
+
+  ConversionPlan *plan = new ConversionPlan();
+  g_plans[desc].reset(plan);
+  plan->type_name = desc->full_name();
+
+  std::vector<const FieldDescriptor *> fields;
+  for (int i = 0; i < desc->field_count(); ++i) {
+    fields.push_back(desc->field(i));
+  }
+  // same order as Reflection::ListFields
+  std::sort(fields.begin(), fields.end(),
+	    [](const FieldDescriptor *a, const FieldDescriptor *b)
+	    { return a->number() < b->number(); });
+
+  for (const FieldDescriptor *field : fields) {
+    FieldAppender append = appender_for(field);
+    if (! append)  continue;
+
+    FieldPlan fp;
+    fp.field    = field;
+    fp.name     = field->name();
+    fp.repeated = field->is_repeated();
+    fp.append   = append;
+    fp.sub_plan = NULL;
+    if (field->type() == FieldDescriptor::TYPE_MESSAGE) {
+      fp.sub_plan = plan_for_locked(field->message_type());
+    }
+    plan->fields.push_back(fp);
+  }
+
+  return plan;
+}
+
+const ConversionPlan *
+plan_for(const Descriptor *desc)
+{
+  std::lock_guard<std::mutex> lock(g_plans_mutex);
+  return plan_for_locked(desc);
+}
+
+void
+append_message(const ConversionPlan &plan, const Message &m, BSONObjBuilder *b)
+{
+  b->append("_type", plan.type_name);
 
   std::string data;
   m.SerializeToString(&data);
@@ -163,18 +331,42 @@ MongoDBLogProtobuf::add_message(const google::protobuf::Message &m, BSONObjBuild
 
   const Reflection *refl = m.GetReflection();
 
-  std::vector<const FieldDescriptor *> fields;
-  refl->ListFields(m, &fields);
-
-  for (size_t i = 0; i < fields.size(); ++i) {
-    add_field(fields[i], m, b);
+  for (const FieldPlan &fp : plan.fields) {
+    if (fp.repeated) {
+      const int count = refl->FieldSize(m, fp.field);
+      for (int j = 0; j < count; ++j) {
+	fp.append(fp, m, refl, j, b);
+      }
+    } else if (refl->HasField(m, fp.field)) {
+      fp.append(fp, m, refl, 0, b);
+    }
   }
 }
 
+} // end anonymous namespace
+/// @endcond
+
+
+/** Convert a message to BSON.
+ * Adds the type name, the serialized message and all set fields to
+ * the given builder, nested messages become sub-documents. The field
+ * layout is determined once per message type and cached.
+ * @param m message to convert
+ * @param b builder to add fields to
+ */
+void
+MongoDBLogProtobuf::to_bson(const google::protobuf::Message &m, mongo::BSONObjBuilder *b)
+{
+  append_message(*plan_for(m.GetDescriptor()), m, b);
+}
+
+
+/** Log a message.
+ * @param m message to log
+ */
 void
 MongoDBLogProtobuf::write(google::protobuf::Message &m)
 {
-  fawkes::MutexLocker lock(mutex_);
   struct timeval now;
   gettimeofday(&now, NULL);
   Date_t nowd = now.tv_sec * 1000 + now.tv_usec / 1000;
@@ -182,18 +374,20 @@ MongoDBLogProtobuf::write(google::protobuf::Message &m)
   BSONObjBuilder b;
   b.appendDate("_time", nowd);
 
-  add_message(m, &b);
+  to_bson(m, &b);
 
-  try {
-    mongodb_->insert(collection_, b.obj());
-  } catch (mongo::DBException &e) {} // ignored
+  BSONObj doc(b.obj());
+  enqueue(doc);
 }
 
 
+/** Log a message with meta data.
+ * @param m message to log
+ * @param meta_data additional data stored in the _meta field
+ */
 void
 MongoDBLogProtobuf::write(google::protobuf::Message &m, mongo::BSONObj &meta_data)
 {
-  fawkes::MutexLocker lock(mutex_);
   struct timeval now;
   gettimeofday(&now, NULL);
   Date_t nowd = now.tv_sec * 1000 + now.tv_usec / 1000;
@@ -201,11 +395,10 @@ MongoDBLogProtobuf::write(google::protobuf::Message &m, mongo::BSONObj &meta_dat
   BSONObjBuilder b;
   b.appendDate("_time", nowd);
 
-  add_message(m, &b);
+  to_bson(m, &b);
 
   b.append("_meta", meta_data);
 
-  try {
-    mongodb_->insert(collection_, b.obj());
-  } catch (mongo::DBException &e) {} // ignored
+  BSONObj doc(b.obj());
+  enqueue(doc);
 }
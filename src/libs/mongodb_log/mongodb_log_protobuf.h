@@ -22,14 +22,16 @@
 #ifndef __LIBS_MONGODB_LOG_MONGODB_LOG_PROTOBUF_H_
 #define __LIBS_MONGODB_LOG_MONGODB_LOG_PROTOBUF_H_
 
+#include <core/utils/bounded_queue.h>
+
 #include <google/protobuf/message.h>
 #include <string>
 #include <mongo/bson/bson.h>
 
-
-namespace fawkes {
-  class Mutex;
-}
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace mongo {
   class DBClientBase;
@@ -38,21 +40,49 @@ namespace mongo {
 class MongoDBLogProtobuf
 {
  public:
-  MongoDBLogProtobuf(std::string host_port, std::string collection);
+  MongoDBLogProtobuf(std::string host_port, std::string collection,
+		     size_t queue_size = 8192, size_t batch_size = 256);
   virtual ~MongoDBLogProtobuf();
 
   void write(google::protobuf::Message &m);
   void write(google::protobuf::Message &m, mongo::BSONObj &meta_data);
 
+  void flush();
+
+  static void to_bson(const google::protobuf::Message &m, mongo::BSONObjBuilder *b);
+
+  /** Get number of documents dropped because the queue was full.
+   * @return number of dropped documents */
+  unsigned long int dropped() const
+  { return dropped_; }
+
+  /** Get number of documents which could not be inserted.
+   * @return number of documents lost due to database errors */
+  unsigned long int failed() const
+  { return failed_; }
+
  private:
-  void add_field(const ::google::protobuf::FieldDescriptor *field,
-		 const ::google::protobuf::Message &m, mongo::BSONObjBuilder *b);
-  void add_message(const google::protobuf::Message &m, mongo::BSONObjBuilder *b);
+  void enqueue(mongo::BSONObj &doc);
+  void writer_loop();
 
  private:
   std::string          collection_;
-  fawkes::Mutex       *mutex_;
   mongo::DBClientBase *mongodb_;
+
+  fawkes::BoundedQueue<mongo::BSONObj> queue_;
+  size_t                               batch_size_;
+
+  std::thread                 writer_thread_;
+  std::mutex                  writer_mutex_;
+  std::condition_variable     writer_cond_;
+  std::condition_variable     flushed_cond_;
+  bool                        running_;
+  bool                        flush_requested_;
+
+  std::atomic<unsigned long int> enqueued_;
+  std::atomic<unsigned long int> processed_;
+  std::atomic<unsigned long int> dropped_;
+  std::atomic<unsigned long int> failed_;
 };
 
 #endif
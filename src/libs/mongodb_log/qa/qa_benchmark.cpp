@@ -0,0 +1,299 @@
+/***************************************************************************
+ *  qa_benchmark.cpp - protobuf to BSON conversion benchmark
+ *
+ *  Created: Mon Oct 19 00:45:02 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  Read the full text in the LICENSE.GPL file in the doc directory.
+ */
+
+#include <mongodb_log/mongodb_log_protobuf.h>
+
+#include <msgs/MachineInfo.pb.h>
+#include <msgs/RobotInfo.pb.h>
+
+#include <mongo/client/dbclient.h>
+#include <google/protobuf/descriptor.h>
+#include <boost/lexical_cast.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace google::protobuf;
+using namespace mongo;
+
+/// @cond QA
+
+/* Compares the cached conversion of MongoDBLogProtobuf against a plain
+ * reflection walk (the previous implementation) on messages shaped like
+ * game traffic. Results are printed as one JSON object per line, e.g.
+ *   qa_mongodb_log_benchmark -n 100000 > results.json
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static double
+usec_since(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+/* Fill all fields of a message with sample data. Top-level repeated
+ * fields get top_count entries (e.g. robots or machines of a game),
+ * nested repeated fields a few. */
+static void
+fill_message(Message *m, int top_count, unsigned int depth = 0)
+{
+  const Descriptor *desc = m->GetDescriptor();
+  const Reflection *refl = m->GetReflection();
+  for (int i = 0; i < desc->field_count(); ++i) {
+    const FieldDescriptor *f = desc->field(i);
+    int count = f->is_repeated() ? (depth == 0 ? top_count : 2) : 1;
+    for (int j = 0; j < count; ++j) {
+      switch (f->cpp_type()) {
+      case FieldDescriptor::CPPTYPE_INT32:
+	if (f->is_repeated()) refl->AddInt32(m, f, -j);   else refl->SetInt32(m, f, -42);
+	break;
+      case FieldDescriptor::CPPTYPE_INT64:
+	if (f->is_repeated()) refl->AddInt64(m, f, -j);   else refl->SetInt64(m, f, -1234567);
+	break;
+      case FieldDescriptor::CPPTYPE_UINT32:
+	if (f->is_repeated()) refl->AddUInt32(m, f, j);   else refl->SetUInt32(m, f, 42);
+	break;
+      case FieldDescriptor::CPPTYPE_UINT64:
+	if (f->is_repeated()) refl->AddUInt64(m, f, j);   else refl->SetUInt64(m, f, 1234567);
+	break;
+      case FieldDescriptor::CPPTYPE_DOUBLE:
+	if (f->is_repeated()) refl->AddDouble(m, f, j);   else refl->SetDouble(m, f, 3.1415);
+	break;
+      case FieldDescriptor::CPPTYPE_FLOAT:
+	if (f->is_repeated()) refl->AddFloat(m, f, j);    else refl->SetFloat(m, f, 2.71f);
+	break;
+      case FieldDescriptor::CPPTYPE_BOOL:
+	if (f->is_repeated()) refl->AddBool(m, f, j % 2); else refl->SetBool(m, f, true);
+	break;
+      case FieldDescriptor::CPPTYPE_ENUM:
+	{
+	  const EnumValueDescriptor *v =
+	    f->enum_type()->value(j % f->enum_type()->value_count());
+	  if (f->is_repeated()) refl->AddEnum(m, f, v);     else refl->SetEnum(m, f, v);
+	}
+	break;
+      case FieldDescriptor::CPPTYPE_STRING:
+	if (f->is_repeated()) refl->AddString(m, f, "Benchmark");
+	else                  refl->SetString(m, f, "Benchmark");
+	break;
+      case FieldDescriptor::CPPTYPE_MESSAGE:
+	if (depth < 4) {
+	  fill_message(f->is_repeated() ? refl->AddMessage(m, f) : refl->MutableMessage(m, f),
+		       top_count, depth + 1);
+	}
+	break;
+      }
+    }
+  }
+}
+
+
+/* Reference conversion walking the reflection interface for every field. */
+static void reflection_add_message(const Message &m, BSONObjBuilder *b);
+
+static void
+reflection_add_field(const FieldDescriptor *field, const Message &m, BSONObjBuilder *b)
+{
+  const Reflection *refl = m.GetReflection();
+
+  int count = 0;
+  if (field->is_repeated()) {
+    count = refl->FieldSize(m, field);
+  } else if (refl->HasField(m, field)) {
+    count = 1;
+  }
+
+  for (int j = 0; j < count; ++j) {
+    switch (field->type()) {
+#define HANDLE_PRIMITIVE_TYPE(TYPE, CPPTYPE, CPPTYPE_METHOD)		\
+      case FieldDescriptor::TYPE_##TYPE: {				\
+        const CPPTYPE value = field->is_repeated()			\
+	  ? refl->GetRepeated##CPPTYPE_METHOD(m, field, j)		\
+	  : refl->Get##CPPTYPE_METHOD(m, field);			\
+	  b->append(field->name(), value);				\
+	  break;							\
+      }
+
+      HANDLE_PRIMITIVE_TYPE( INT32, int,           Int32);
+      HANDLE_PRIMITIVE_TYPE( INT64, long long int, Int64);
+      HANDLE_PRIMITIVE_TYPE(SINT32, int,           Int32);
+      HANDLE_PRIMITIVE_TYPE(SINT64, long long int, Int64);
+      HANDLE_PRIMITIVE_TYPE(UINT32, unsigned int,  UInt32);
+      HANDLE_PRIMITIVE_TYPE(UINT64, long long int, UInt64);
+
+      HANDLE_PRIMITIVE_TYPE( FIXED32, unsigned int,  UInt32);
+      HANDLE_PRIMITIVE_TYPE( FIXED64, long long int, UInt64);
+      HANDLE_PRIMITIVE_TYPE(SFIXED32, int,           Int32);
+      HANDLE_PRIMITIVE_TYPE(SFIXED64, long long int, Int64);
+
+      HANDLE_PRIMITIVE_TYPE(FLOAT , float , Float );
+      HANDLE_PRIMITIVE_TYPE(DOUBLE, double, Double);
+
+      HANDLE_PRIMITIVE_TYPE(BOOL, bool, Bool);
+#undef HANDLE_PRIMITIVE_TYPE
+
+      case FieldDescriptor::TYPE_MESSAGE: {
+	const Message &sub_m = field->is_repeated()
+	  ? refl->GetRepeatedMessage(m, field, j)
+	  : refl->GetMessage(m, field);
+        BSONObjBuilder sub(b->subobjStart(field->name()));
+	reflection_add_message(sub_m, &sub);
+	sub.done();
+        break;
+      }
+
+      case FieldDescriptor::TYPE_GROUP:
+        break;
+
+      case FieldDescriptor::TYPE_ENUM: {
+        const EnumValueDescriptor* value = field->is_repeated()
+	  ? refl->GetRepeatedEnum(m, field, j)
+	  : refl->GetEnum(m, field);
+	b->append(field->name(), value->name());
+	break;
+      }
+
+      case FieldDescriptor::TYPE_STRING: {
+        std::string scratch;
+	const std::string& value = field->is_repeated()
+	  ? refl->GetRepeatedStringReference(m, field, j, &scratch)
+	  : refl->GetStringReference(m, field, &scratch);
+	b->append(field->name(), value);
+	break;
+      }
+
+      case FieldDescriptor::TYPE_BYTES: {
+        std::string scratch;
+	const std::string& value = field->is_repeated()
+	  ? refl->GetRepeatedStringReference(m, field, j, &scratch)
+	  : refl->GetStringReference(m, field, &scratch);
+	b->appendBinData(field->name(), value.size(), BinDataGeneral, value.c_str());
+	break;
+      }
+    }
+  }
+}
+
+static void
+reflection_add_message(const Message &m, BSONObjBuilder *b)
+{
+  b->append("_type", m.GetTypeName());
+
+  std::string data;
+  m.SerializeToString(&data);
+  b->appendBinData("_protobuf", data.size(), BinDataGeneral, data.c_str());
+
+  const Reflection *refl = m.GetReflection();
+  std::vector<const FieldDescriptor *> fields;
+  refl->ListFields(m, &fields);
+  for (size_t i = 0; i < fields.size(); ++i) {
+    reflection_add_field(fields[i], m, b);
+  }
+}
+
+
+/* Returns false if the plan output differs from the reference walk. */
+static bool
+bench_convert(const Message &m, unsigned int iterations)
+{
+  // warm up, this also builds the conversion plan
+  BSONObjBuilder ref_b, plan_b;
+  reflection_add_message(m, &ref_b);
+  MongoDBLogProtobuf::to_bson(m, &plan_b);
+  BSONObj ref_obj(ref_b.obj()), plan_obj(plan_b.obj());
+  bool identical = ref_obj.binaryEqual(plan_obj);
+
+  Clock::time_point start = Clock::now();
+  for (unsigned int i = 0; i < iterations; ++i) {
+    BSONObjBuilder b;
+    reflection_add_message(m, &b);
+    BSONObj o(b.obj());
+  }
+  double reflection_usec = usec_since(start);
+
+  start = Clock::now();
+  for (unsigned int i = 0; i < iterations; ++i) {
+    BSONObjBuilder b;
+    MongoDBLogProtobuf::to_bson(m, &b);
+    BSONObj o(b.obj());
+  }
+  double plan_usec = usec_since(start);
+
+  printf("{\"benchmark\": \"convert\", \"type\": \"%s\", \"bson_size\": %d, "
+	 "\"iterations\": %u, \"identical\": %s, "
+	 "\"reflection_ns\": %.1f, \"reflection_msgs_per_sec\": %.0f, "
+	 "\"plan_ns\": %.1f, \"plan_msgs_per_sec\": %.0f}\n",
+	 m.GetTypeName().c_str(), plan_obj.objsize(), iterations,
+	 identical ? "true" : "false",
+	 1000. * reflection_usec / iterations, 1000000. * iterations / reflection_usec,
+	 1000. * plan_usec / iterations, 1000000. * iterations / plan_usec);
+
+  if (! identical) {
+    fprintf(stderr, "%s: plan output differs from reflection walk\n"
+	    "  reference: %s\n  plan:      %s\n", m.GetTypeName().c_str(),
+	    ref_obj.jsonString().c_str(), plan_obj.jsonString().c_str());
+  }
+  return identical;
+}
+
+
+static void
+usage(const char *progname)
+{
+  printf("Usage: %s [-n N]\n"
+	 " -n N   number of conversions per message type (default 100000)\n",
+	 progname);
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned int iterations = 100000;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = boost::lexical_cast<unsigned int>(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  // a game has up to six robots and 14 machines (7 per team)
+  bool identical = true;
+
+  llsf_msgs::RobotInfo ri;
+  fill_message(&ri, 6);
+  identical &= bench_convert(ri, iterations);
+
+  llsf_msgs::MachineInfo mi;
+  fill_message(&mi, 14);
+  identical &= bench_convert(mi, iterations);
+
+  // Delete all global objects allocated by libprotobuf
+  google::protobuf::ShutdownProtobufLibrary();
+  return identical ? 0 : 2;
+}
+
+/// @endcond
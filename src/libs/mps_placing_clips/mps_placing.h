@@ -27,6 +27,8 @@
 #define NUM_MPS   7
 
 #define TIMEOUT_MS 3000
+// bound of the deterministic search, the time limit depends on the machine
+#define NODE_LIMIT 2000000
 
 class MPSPlacingPlacing
 {
@@ -52,7 +54,9 @@ class MPSPlacing: public Gecode::IntMinimizeSpace
 {
     public:
 
-    MPSPlacing(int _width, int _height)
+    // a deterministic search yields the same field for the same seed, it
+    // runs single-threaded and is bounded by nodes instead of time
+    MPSPlacing(int _width, int _height, unsigned int seed, bool deterministic = false)
     {
         height_ = _height;
         width_ = _width;
@@ -61,7 +65,7 @@ class MPSPlacing: public Gecode::IntMinimizeSpace
         mps_angle_ = Gecode::IntVarArray(*this, (height_+2) * (width_+2) , EMPTY_ROT, ANGLE_315);
         //zone_blocked_ = Gecode::IntVarArray(*this, (height_+2) * (width_+2) , 0, 1);
 
-        rg_ = Gecode::Rnd(time(NULL));
+        rg_ = Gecode::Rnd(seed);
 
         std::vector<int> types;
 
@@ -497,11 +501,20 @@ class MPSPlacing: public Gecode::IntMinimizeSpace
         Gecode::branch(*this, mps_type_, Gecode::INT_VAR_RND(rg_),  Gecode::INT_VAL_RND(rg_));
         Gecode::branch(*this, mps_angle_, Gecode::INT_VAR_RND(rg_),  Gecode::INT_VAL_RND(rg_));
 
-        options_.threads = 4;
-
-        stop_= new Gecode::Search::TimeStop(TIMEOUT_MS);
-
-        options_.stop = stop_;
+        if (deterministic)
+        {
+            options_.threads = 1;
+            stop_ = NULL;
+            node_stop_ = new Gecode::Search::NodeStop(NODE_LIMIT);
+            options_.stop = node_stop_;
+        }
+        else
+        {
+            options_.threads = 4;
+            stop_= new Gecode::Search::TimeStop(TIMEOUT_MS);
+            node_stop_ = NULL;
+            options_.stop = stop_;
+        }
 
         search_ = new Gecode::DFS<MPSPlacing>(this, options_) ;
 
@@ -544,7 +557,10 @@ class MPSPlacing: public Gecode::IntMinimizeSpace
             delete solution;
         }
 
-        stop_->reset();
+        if (stop_)
+        {
+            stop_->reset();
+        }
 
         solution = search_->next();
 
@@ -596,6 +612,7 @@ class MPSPlacing: public Gecode::IntMinimizeSpace
     Gecode::Rnd rg_;
     Gecode::Search::Options options_;
     Gecode::Search::TimeStop * stop_;
+    Gecode::Search::NodeStop * node_stop_;
 
 };
 
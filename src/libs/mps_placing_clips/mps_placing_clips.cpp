@@ -41,6 +41,8 @@
 
 #include <core/threading/mutex_locker.h>
 
+#include <sstream>
+
 namespace mps_placing_clips {
 #if 0 /* just to make Emacs auto-indent happy */
 }
@@ -62,6 +64,13 @@ MPSPlacingGenerator::MPSPlacingGenerator(CLIPS::Environment *env,
   setup_clips();
   is_generation_running_ = false;
   is_field_generated_ = false;
+  random_seed_set_ = false;
+  random_seed_ = 0;
+  num_generations_ = 0;
+  blocking_ = false;
+  replay_ = false;
+  field_reported_ = false;
+  field_taken_ = false;
   generator_ = nullptr;
   generator_thread_ = nullptr;
 }
@@ -123,16 +132,118 @@ MPSPlacingGenerator::generate_start()
   }
   is_generation_running_ = true;
   is_field_generated_ = false;
+  field_reported_ = false;
+  field_taken_ = false;
+
+  // the field is set with set_replayed_field() when its time has come
+  if (replay_)  return;
+
+  // repeated generations, e.g. if a field is rejected, must still differ
+  unsigned int seed =
+    random_seed_set_ ? random_seed_ + num_generations_++ : (unsigned int)time(NULL);
+  generator_ = std::shared_ptr<MPSPlacing>(new MPSPlacing(7, 8, seed, random_seed_set_));
+  if (blocking_) {
+    generator_thread();
+  } else {
+    generator_thread_ = std::shared_ptr<std::thread>(
+          new std::thread( &MPSPlacingGenerator::generator_thread, this )
+          );
+  }
+}
+
+/** Set random seed for the field generation.
+ * By default, the generator is seeded with the current time. With a fixed
+ * seed the sequence of generated fields is reproducible. To this end,
+ * the search then runs single-threaded and is bounded by the number of
+ * explored nodes instead of time.
+ * @param seed random seed
+ */
+void
+MPSPlacingGenerator::set_random_seed(unsigned int seed)
+{
+  random_seed_set_ = true;
+  random_seed_ = seed;
+}
 
-  generator_ = std::shared_ptr<MPSPlacing>(new MPSPlacing(7, 8));
-  generator_thread_ = std::shared_ptr<std::thread>(
-        new std::thread( &MPSPlacingGenerator::generator_thread, this )
-        );
+/** Enable or disable blocking generation.
+ * When blocking, the field is generated within the call to start the
+ * generation instead of a separate thread. The field is then available
+ * right away, independent of how long the generation takes, e.g., when
+ * replaying a recording that does not contain the generated fields.
+ * @param blocking true to generate fields in the calling thread
+ */
+void
+MPSPlacingGenerator::set_blocking(bool blocking)
+{
+  blocking_ = blocking;
+}
+
+/** Enable or disable replay mode.
+ * In replay mode, no fields are generated. Once a generation has been
+ * started, it is running until the recorded field is passed to
+ * set_replayed_field().
+ * @param replay true to enable replay mode, false to disable
+ */
+void
+MPSPlacingGenerator::set_replay(bool replay)
+{
+  replay_ = replay;
+}
+
+/** Set recorded field in replay mode.
+ * This finishes the running generation with the given field.
+ * @param field field as returned by take_reported_field() when recording
+ */
+void
+MPSPlacingGenerator::set_replayed_field(const std::string &field)
+{
+  replayed_field_.clear();
+  std::istringstream fs(field);
+  std::string type, zone;
+  int rotation;
+  while (fs >> type >> zone >> rotation) {
+    replayed_field_.push_back(CLIPS::Value(type.c_str(), CLIPS::TYPE_SYMBOL));
+    replayed_field_.push_back(CLIPS::Value(zone.c_str(), CLIPS::TYPE_SYMBOL));
+    replayed_field_.push_back(CLIPS::Value(rotation));
+  }
+  is_field_generated_ = true;
+  is_generation_running_ = false;
+}
+
+/** Get field which has been reported as generated.
+ * The field is available once CLIPS has been told that the generation
+ * has finished. Recording it with the time at which this happened allows
+ * to reproduce the game without generating the field again.
+ * @param field upon return contains the field, machine type, zone, and
+ * rotation for each machine separated by spaces
+ * @return true if a field has been reported since the last call,
+ * false otherwise
+ */
+bool
+MPSPlacingGenerator::take_reported_field(std::string &field)
+{
+  if (! field_reported_ || field_taken_)  return false;
+  field_taken_ = true;
+
+  std::ostringstream fs;
+  CLIPS::Values machines = get_generated_field();
+  for (size_t i = 0; i + 2 < machines.size(); i += 3) {
+    if (i > 0)  fs << " ";
+    fs << machines[i].as_string() << " " << machines[i+1].as_string()
+       << " " << machines[i+2].as_integer();
+  }
+  field = fs.str();
+  return true;
 }
 
 void
 MPSPlacingGenerator::generate_abort()
 {
+  if (! generator_thread_) {
+    is_generation_running_ = false;
+    is_field_generated_ = false;
+    return;
+  }
   if ( 0 == pthread_cancel( generator_thread_->native_handle() ) ) {
     generator_thread_->join();
     generator_thread_.reset();
@@ -152,6 +263,7 @@ MPSPlacingGenerator::generate_running()
 CLIPS::Value
 MPSPlacingGenerator::field_layout_generated()
 {
+  if (is_field_generated_)  field_reported_ = true;
   return CLIPS::Value(is_field_generated_ ? "TRUE" : "FALSE", CLIPS::TYPE_SYMBOL);
 }
 
@@ -161,6 +273,7 @@ MPSPlacingGenerator::get_generated_field()
   if ( ! is_field_generated_ ) {
     return CLIPS::Values(1, CLIPS::Value("INVALID-GENERATION", CLIPS::TYPE_SYMBOL));
   }
+  if (replay_)  return replayed_field_;
 
   std::vector<MPSPlacingPlacing> poses;
   if ( ! generator_->get_solution(poses) ) {  // this should never happen since it is checked in this class
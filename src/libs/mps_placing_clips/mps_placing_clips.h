@@ -41,6 +41,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <string>
 #include <thread>
 #include <clipsmm.h>
 
@@ -65,6 +66,12 @@ class MPSPlacingGenerator
   CLIPS::Value field_layout_generated();
   CLIPS::Values get_generated_field();
 
+  void set_random_seed(unsigned int seed);
+  void set_blocking(bool blocking);
+  void set_replay(bool replay);
+  void set_replayed_field(const std::string &field);
+  bool take_reported_field(std::string &field);
+
  private:
   void          setup_clips();
   CLIPS::Environment   *clips_;
@@ -76,6 +83,14 @@ class MPSPlacingGenerator
   std::shared_ptr<MPSPlacing> generator_;
   bool is_generation_running_;
   bool is_field_generated_;
+  bool random_seed_set_;
+  unsigned int random_seed_;
+  unsigned int num_generations_;
+  bool blocking_;
+  bool replay_;
+  bool field_reported_;
+  bool field_taken_;
+  CLIPS::Values replayed_field_;
 
   fawkes::Mutex map_mutex_;
 
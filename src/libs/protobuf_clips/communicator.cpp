@@ -35,6 +35,9 @@
  */
 
 #include <protobuf_clips/communicator.h>
+#include <protobuf_clips/message_facts.h>
+#include <protobuf_clips/handle_pool.h>
+#include <protobuf_clips/publisher.h>
 
 #include <core/threading/mutex_locker.h>
 #include <protobuf_comm/client.h>
@@ -42,6 +45,11 @@
 #include <protobuf_comm/peer.h>
 
 #include <google/protobuf/descriptor.h>
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <cstdio>
 
 using namespace google::protobuf;
 using namespace protobuf_comm;
@@ -66,9 +74,15 @@ namespace protobuf_clips {
  */
 ClipsProtobufCommunicator::ClipsProtobufCommunicator(CLIPS::Environment *env,
 						     fawkes::Mutex &env_mutex)
-  : clips_(env), clips_mutex_(env_mutex), server_(NULL)
+  : clips_(env), clips_mutex_(env_mutex), server_(NULL),
+    sends_done_cond_(&map_mutex_), sends_in_flight_(0), num_send_failures_(0),
+    send_workers_quit_(false), batch_assert_(false), replay_(false),
+    max_queued_msgs_(0), num_queue_drops_(0)
 {
   message_register_ = new MessageRegister();
+  message_facts_    = new ClipsMessageFacts(env);
+  handles_          = new MessageHandlePool();
+  publisher_        = new PeriodicPublisher();
   setup_clips();
 }
 
@@ -80,9 +94,15 @@ ClipsProtobufCommunicator::ClipsProtobufCommunicator(CLIPS::Environment *env,
 ClipsProtobufCommunicator::ClipsProtobufCommunicator(CLIPS::Environment *env,
 						     fawkes::Mutex &env_mutex,
 						     std::vector<std::string> &proto_path)
-  : clips_(env), clips_mutex_(env_mutex), server_(NULL)
+  : clips_(env), clips_mutex_(env_mutex), server_(NULL),
+    sends_done_cond_(&map_mutex_), sends_in_flight_(0), num_send_failures_(0),
+    send_workers_quit_(false), batch_assert_(false), replay_(false),
+    max_queued_msgs_(0), num_queue_drops_(0)
 {
   message_register_ = new MessageRegister(proto_path);
+  message_facts_    = new ClipsMessageFacts(env);
+  handles_          = new MessageHandlePool();
+  publisher_        = new PeriodicPublisher();
   setup_clips();
 }
 
@@ -90,6 +110,8 @@ ClipsProtobufCommunicator::ClipsProtobufCommunicator(CLIPS::Environment *env,
 /** Destructor. */
 ClipsProtobufCommunicator::~ClipsProtobufCommunicator()
 {
+  stop_send_workers();
+
   {
     fawkes::MutexLocker lock(&clips_mutex_);
 
@@ -104,7 +126,10 @@ ClipsProtobufCommunicator::~ClipsProtobufCommunicator()
   }
   clients_.clear();
 
+  delete message_facts_;
   delete message_register_;
+  delete publisher_;
+  delete handles_;
   delete server_;
 }
 
@@ -120,17 +145,41 @@ ClipsProtobufCommunicator::setup_clips()
 {
   fawkes::MutexLocker lock(&clips_mutex_);
 
+  // indexed by ClientType
+  client_type_syms_.push_back(CLIPS::Value("SERVER", CLIPS::TYPE_SYMBOL));
+  client_type_syms_.push_back(CLIPS::Value("CLIENT", CLIPS::TYPE_SYMBOL));
+  client_type_syms_.push_back(CLIPS::Value("PEER", CLIPS::TYPE_SYMBOL));
+  rcvd_via_syms_.push_back(CLIPS::Value("STREAM", CLIPS::TYPE_SYMBOL));
+  rcvd_via_syms_.push_back(CLIPS::Value("STREAM", CLIPS::TYPE_SYMBOL));
+  rcvd_via_syms_.push_back(CLIPS::Value("BROADCAST", CLIPS::TYPE_SYMBOL));
+
   ADD_FUNCTION("pb-register-type", (sigc::slot<bool, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_register_type))));
   ADD_FUNCTION("pb-field-names", (sigc::slot<CLIPS::Values, void *>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_field_names))));
   ADD_FUNCTION("pb-field-type", (sigc::slot<CLIPS::Value, void *, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_field_type))));
   ADD_FUNCTION("pb-has-field", (sigc::slot<bool, void *, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_has_field))));
   ADD_FUNCTION("pb-field-label", (sigc::slot<CLIPS::Value, void *, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_field_label))));
   ADD_FUNCTION("pb-field-value", (sigc::slot<CLIPS::Value, void *, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_field_value))));
+  ADD_FUNCTION("pb-field-mutable", (sigc::slot<CLIPS::Value, void *, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_field_mutable))));
+  ADD_FUNCTION("pb-build-deftemplate", (sigc::slot<bool, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_build_deftemplate))));
+  ADD_FUNCTION("pb-build-deftemplates", (sigc::slot<long int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_build_deftemplates))));
+  ADD_FUNCTION("pb-assert-fact", (sigc::slot<bool, void *>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_assert_fact))));
+  ADD_FUNCTION("pb-define-mapping", (sigc::slot<bool, std::string, std::string, std::string, CLIPS::Values>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_define_mapping))));
+  ADD_FUNCTION("pb-mapping-order", (sigc::slot<bool, std::string, CLIPS::Values>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_mapping_order))));
+  ADD_FUNCTION("pb-create-from-facts", (sigc::slot<CLIPS::Values, std::string, CLIPS::Values>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_create_from_facts))));
+  ADD_FUNCTION("pb-add-list-from-facts", (sigc::slot<long int, void *, std::string, std::string, CLIPS::Values>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_add_list_from_facts))));
   ADD_FUNCTION("pb-field-list", (sigc::slot<CLIPS::Values, void *, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_field_list))));
   ADD_FUNCTION("pb-field-is-list", (sigc::slot<bool, void *, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_field_is_list))));
   ADD_FUNCTION("pb-create", (sigc::slot<CLIPS::Value, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_create))));
   ADD_FUNCTION("pb-destroy", (sigc::slot<void, void *>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_destroy))));
   ADD_FUNCTION("pb-ref", (sigc::slot<CLIPS::Value, void *>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_ref))));
+  ADD_FUNCTION("pb-publisher-add", (sigc::slot<bool, std::string, std::string, double, double, int, CLIPS::Values>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_publisher_add))));
+  ADD_FUNCTION("pb-publisher-remove", (sigc::slot<void, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_publisher_remove))));
+  ADD_FUNCTION("pb-publisher-trigger", (sigc::slot<void, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_publisher_trigger))));
+  ADD_FUNCTION("pb-publisher-restart-burst", (sigc::slot<void, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_publisher_restart_burst))));
+  ADD_FUNCTION("pb-handle-stats", (sigc::slot<CLIPS::Values>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_handle_stats))));
+  ADD_FUNCTION("pb-send-failures", (sigc::slot<long int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_send_failures))));
+  ADD_FUNCTION("pb-queue-drops", (sigc::slot<long int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_queue_drops))));
+  ADD_FUNCTION("pb-digest", (sigc::slot<CLIPS::Value, void *>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_digest))));
   ADD_FUNCTION("pb-set-field", (sigc::slot<void, void *, std::string, CLIPS::Value>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_set_field))));
   ADD_FUNCTION("pb-add-list", (sigc::slot<void, void *, std::string, CLIPS::Value>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_add_list))));
   ADD_FUNCTION("pb-send", (sigc::slot<void, long int, void *>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_send))));
@@ -146,9 +195,15 @@ ClipsProtobufCommunicator::setup_clips()
 		 (sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_peer_create_local_crypto))));
   ADD_FUNCTION("pb-peer-destroy", (sigc::slot<void, long int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_peer_destroy))));
   ADD_FUNCTION("pb-peer-setup-crypto", (sigc::slot<void, long int, std::string, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_peer_setup_crypto))));
+  ADD_FUNCTION("pb-peer-setup-compression", (sigc::slot<bool, long int, std::string, int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_peer_setup_compression))));
+  ADD_FUNCTION("pb-peer-setup-multicast", (sigc::slot<bool, long int, std::string, int, std::string>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_peer_setup_multicast))));
+  ADD_FUNCTION("pb-peer-setup-rate-limit", (sigc::slot<void, long int, double, int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_peer_setup_rate_limit))));
+  ADD_FUNCTION("pb-peer-setup-type-rate-limit", (sigc::slot<bool, long int, std::string, double, int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_peer_setup_type_rate_limit))));
+  ADD_FUNCTION("pb-peer-rate-limit-drops", (sigc::slot<CLIPS::Values, long int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_peer_rate_limit_drops))));
   ADD_FUNCTION("pb-broadcast", (sigc::slot<void, long int, void *>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_broadcast))));
   ADD_FUNCTION("pb-connect", (sigc::slot<long int, std::string, int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_client_connect))));
   ADD_FUNCTION("pb-disconnect", (sigc::slot<void, long int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_disconnect))));
+  ADD_FUNCTION("pb-client-setup-reconnect", (sigc::slot<void, long int, int, int, int>(sigc::mem_fun(*this, &ClipsProtobufCommunicator::clips_pb_client_setup_reconnect))));
 }
 
 /** Enable protobuf stream server.
@@ -177,8 +232,16 @@ ClipsProtobufCommunicator::enable_server(int port)
 void
 ClipsProtobufCommunicator::disable_server()
 {
-  delete server_;
-  server_ = NULL;
+  ProtobufStreamServer *server;
+  {
+    fawkes::MutexLocker lock(&map_mutex_);
+    server = server_;
+    server_ = NULL;
+    // sends which already looked up the server might still use it
+    wait_sends_in_flight();
+  }
+  // the server joins its thread, whose handlers lock map_mutex_
+  delete server;
 }
 
 
@@ -266,10 +329,17 @@ ClipsProtobufCommunicator::clips_pb_peer_create_local(std::string address, int s
 void
 ClipsProtobufCommunicator::clips_pb_peer_destroy(long int peer_id)
 {
-  if (peers_.find(peer_id) != peers_.end()) {
-    delete peers_[peer_id];
-    peers_.erase(peer_id);
+  ProtobufBroadcastPeer *peer = NULL;
+  {
+    fawkes::MutexLocker lock(&map_mutex_);
+    if (peers_.find(peer_id) != peers_.end()) {
+      peer = peers_[peer_id];
+      peers_.erase(peer_id);
+      wait_sends_in_flight();
+    }
   }
+  // the peer joins its thread, whose handlers lock map_mutex_
+  delete peer;
 }
 
 
@@ -288,6 +358,127 @@ ClipsProtobufCommunicator::clips_pb_peer_setup_crypto(long int peer_id,
 }
 
 
+/** Setup compression for peer.
+ * @param peer_id ID of the peer to setup compression for
+ * @param codec codec name, "none" to disable, see BufferCompressor
+ * @param threshold minimum size in bytes of messages to compress
+ * @return true if compression has been set up, false if the peer does not
+ * exist or the codec is not supported
+ */
+bool
+ClipsProtobufCommunicator::clips_pb_peer_setup_compression(long int peer_id,
+							   std::string codec, int threshold)
+{
+  if (peers_.find(peer_id) == peers_.end())  return false;
+
+  try {
+    peers_[peer_id]->setup_compression(codec, threshold);
+  } catch (std::runtime_error &e) {
+    return false;
+  }
+  return true;
+}
+
+
+/** Setup multicast for peer.
+ * The peer must have been created with a multicast group address.
+ * @param peer_id ID of the peer to setup multicast for
+ * @param interface_address address of local interface to use, empty for default
+ * @param ttl time-to-live of sent messages
+ * @param loopback TRUE (or true) to receive own messages, FALSE otherwise
+ * @return true if multicast has been set up, false if the peer does not
+ * exist or the multicast group cannot be joined
+ */
+bool
+ClipsProtobufCommunicator::clips_pb_peer_setup_multicast(long int peer_id,
+							 std::string interface_address,
+							 int ttl, std::string loopback)
+{
+  if (peers_.find(peer_id) == peers_.end())  return false;
+
+  try {
+    peers_[peer_id]->setup_multicast(interface_address, ttl,
+				     (loopback == "TRUE" || loopback == "true"));
+  } catch (std::runtime_error &e) {
+    return false;
+  }
+  return true;
+}
+
+
+/** Limit rate of incoming messages per remote endpoint.
+ * @param peer_id ID of the peer to setup rate limiting for
+ * @param rate average number of messages per second, 0 to disable
+ * @param burst maximum number of messages accepted at once
+ */
+void
+ClipsProtobufCommunicator::clips_pb_peer_setup_rate_limit(long int peer_id,
+							  double rate, int burst)
+{
+  if (peers_.find(peer_id) != peers_.end()) {
+    peers_[peer_id]->set_rate_limit(rate, std::max(1, burst));
+  }
+}
+
+
+/** Limit rate of incoming messages of a type per remote endpoint.
+ * @param peer_id ID of the peer to setup rate limiting for
+ * @param full_name full name of a registered message type
+ * @param rate average number of messages per second, 0 to disable
+ * @param burst maximum number of messages accepted at once
+ * @return true if the rate limit has been set, false if the peer does not
+ * exist or the type is not registered
+ */
+bool
+ClipsProtobufCommunicator::clips_pb_peer_setup_type_rate_limit(long int peer_id,
+							       std::string full_name,
+							       double rate, int burst)
+{
+  if (peers_.find(peer_id) == peers_.end())  return false;
+
+  std::shared_ptr<google::protobuf::Message> m;
+  try {
+    m = message_register_->new_message_for(full_name);
+  } catch (std::runtime_error &e) {
+    return false;
+  }
+
+  // registered types are known to have a valid CompType enum
+  const google::protobuf::EnumDescriptor *enumdesc =
+    m->GetDescriptor()->FindEnumTypeByName("CompType");
+  const google::protobuf::EnumValueDescriptor *compdesc =
+    enumdesc->FindValueByName("COMP_ID");
+  const google::protobuf::EnumValueDescriptor *msgtdesc =
+    enumdesc->FindValueByName("MSG_TYPE");
+
+  peers_[peer_id]->set_rate_limit(compdesc->number(), msgtdesc->number(),
+				  rate, std::max(1, burst));
+  return true;
+}
+
+
+/** Get number of messages dropped due to rate limits.
+ * @param peer_id ID of the peer to query
+ * @return multifield of (host port count) triples, one per remote endpoint
+ */
+CLIPS::Values
+ClipsProtobufCommunicator::clips_pb_peer_rate_limit_drops(long int peer_id)
+{
+  CLIPS::Values rv;
+  if (peers_.find(peer_id) != peers_.end()) {
+    std::map<boost::asio::ip::udp::endpoint, unsigned long> drops =
+      peers_[peer_id]->rate_limit_drops();
+    std::map<boost::asio::ip::udp::endpoint, unsigned long>::iterator d;
+    for (d = drops.begin(); d != drops.end(); ++d) {
+      rv.push_back(CLIPS::Value(d->first.address().to_string()));
+      rv.push_back(CLIPS::Value((long int)d->first.port()));
+      rv.push_back(CLIPS::Value((long int)d->second));
+    }
+  }
+  return rv;
+}
+
+
 /** Register a new message type.
  * @param full_name full name of type to register
  * @return true if the type was successfully registered, false otherwise
@@ -305,6 +496,151 @@ ClipsProtobufCommunicator::clips_pb_register_type(std::string full_name)
 }
 
 
+/** Build deftemplate for message type.
+ * @param full_name full name of message type
+ * @return true if the template exists, false on error
+ * @see ClipsMessageFacts for the template structure
+ */
+bool
+ClipsProtobufCommunicator::clips_pb_build_deftemplate(std::string full_name)
+{
+  try {
+    std::shared_ptr<google::protobuf::Message> m =
+      message_register_->new_message_for(full_name);
+    return message_facts_->build_deftemplate(m->GetDescriptor());
+  } catch (std::runtime_error &e) {
+    //logger_->log_error("RefBox", "Building template for %s failed: %s",
+    //		   full_name.c_str(), e.what());
+    return false;
+  }
+}
+
+
+/** Build deftemplates for all registered message types.
+ * @return number of templates available
+ */
+long int
+ClipsProtobufCommunicator::clips_pb_build_deftemplates()
+{
+  long int num_built = 0;
+  std::list<std::string> types = message_register_->message_types();
+  for (std::string &t : types) {
+    if (clips_pb_build_deftemplate(t))  ++num_built;
+  }
+  return num_built;
+}
+
+
+/** Assert a message as a fact.
+ * Asserts a single fact of the pb-<full type name> template containing
+ * all fields of the message, building the template if necessary.
+ * @param msgptr message handle, it is not destroyed
+ * @return true if the fact was asserted, false otherwise
+ */
+bool
+ClipsProtobufCommunicator::clips_pb_assert_fact(void *msgptr)
+{
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return false;
+
+  return (bool)message_facts_->assert_message(**m);
+}
+
+
+/** Define a mapping from facts to messages.
+ * @param name name of the mapping
+ * @param full_name full name of message type to create
+ * @param template_name name of the fact template to read
+ * @param mapping alternating field paths and slot specifications
+ * @return true if the mapping was defined, false on error
+ * @see ClipsMessageFacts::define_mapping() for the mapping syntax
+ */
+bool
+ClipsProtobufCommunicator::clips_pb_define_mapping(std::string name, std::string full_name,
+						   std::string template_name,
+						   CLIPS::Values mapping)
+{
+  try {
+    std::shared_ptr<google::protobuf::Message> m =
+      message_register_->new_message_for(full_name);
+    message_facts_->define_mapping(name, m, template_name, mapping);
+    return true;
+  } catch (std::runtime_error &e) {
+    //logger_->log_error("RefBox", "Defining mapping %s failed: %s",
+    //		   name.c_str(), e.what());
+    return false;
+  }
+}
+
+
+/** Set order in which facts are mapped to messages.
+ * @param name name of the mapping
+ * @param slots names of slots to sort facts by, most significant first
+ * @return true if the order has been set, false if the mapping does not exist
+ */
+bool
+ClipsProtobufCommunicator::clips_pb_mapping_order(std::string name, CLIPS::Values slots)
+{
+  try {
+    message_facts_->set_mapping_order(name, slots);
+    return true;
+  } catch (std::runtime_error &e) {
+    //logger_->log_error("RefBox", "Setting order of mapping %s failed: %s",
+    //		   name.c_str(), e.what());
+    return false;
+  }
+}
+
+
+/** Create messages from facts.
+ * @param name name of the mapping to use
+ * @param filter triples of slot name, eq or neq, and value
+ * @return list of new message handles, one per matching fact
+ */
+CLIPS::Values
+ClipsProtobufCommunicator::clips_pb_create_from_facts(std::string name, CLIPS::Values filter)
+{
+  std::list<std::shared_ptr<google::protobuf::Message>> msgs;
+  try {
+    msgs = message_facts_->create_from_facts(name, filter);
+  } catch (std::runtime_error &e) {
+    //logger_->log_error("RefBox", "Creating messages from %s failed: %s",
+    //		   name.c_str(), e.what());
+  }
+
+  CLIPS::Values rv;
+  rv.reserve(msgs.size());
+  for (std::shared_ptr<google::protobuf::Message> &m : msgs) {
+    rv.push_back(CLIPS::Value(handles_->acquire(m)));
+  }
+  return rv;
+}
+
+
+/** Add messages created from facts to a repeated field.
+ * @param msgptr message handle to add to, it is not destroyed
+ * @param field_name name of the repeated message field
+ * @param name name of the mapping to use
+ * @param filter triples of slot name, eq or neq, and value
+ * @return number of messages added, -1 on error
+ */
+long int
+ClipsProtobufCommunicator::clips_pb_add_list_from_facts(void *msgptr, std::string field_name,
+							std::string name, CLIPS::Values filter)
+{
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return -1;
+  wait_until_sent(*m);
+
+  try {
+    return message_facts_->add_list_from_facts(**m, field_name, name, filter);
+  } catch (std::runtime_error &e) {
+    //logger_->log_error("RefBox", "Adding messages from %s failed: %s",
+    //		   name.c_str(), e.what());
+    return -1;
+  }
+}
+
 
 CLIPS::Value
 ClipsProtobufCommunicator::clips_pb_create(std::string full_name)
@@ -312,11 +648,11 @@ ClipsProtobufCommunicator::clips_pb_create(std::string full_name)
   try {
     std::shared_ptr<google::protobuf::Message> m =
       message_register_->new_message_for(full_name);
-    return CLIPS::Value(new std::shared_ptr<google::protobuf::Message>(m));
+    return CLIPS::Value(handles_->acquire(m));
   } catch (std::runtime_error &e) {
     //logger_->log_warn("RefBox", "Cannot create message of type %s: %s",
     //	      full_name.c_str(), e.what());
-    return CLIPS::Value(new std::shared_ptr<google::protobuf::Message>());
+    return CLIPS::Value(handles_->acquire(std::shared_ptr<google::protobuf::Message>()));
   }
 }
 
@@ -324,31 +660,112 @@ ClipsProtobufCommunicator::clips_pb_create(std::string full_name)
 CLIPS::Value
 ClipsProtobufCommunicator::clips_pb_ref(void *msgptr)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!*m) return new std::shared_ptr<google::protobuf::Message>();
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return handles_->acquire(std::shared_ptr<google::protobuf::Message>());
 
-  return CLIPS::Value(new std::shared_ptr<google::protobuf::Message>(*m));
+  return CLIPS::Value(handles_->acquire(*m));
+}
+
+
+/** Get digest of message content.
+ * The digest is a hash over the serialized message. It can be used to
+ * cheaply determine whether a message has changed, e.g. for delta updates.
+ * @param msgptr message to compute the digest for
+ * @return digest as hex string
+ */
+CLIPS::Value
+ClipsProtobufCommunicator::clips_pb_digest(void *msgptr)
+{
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return CLIPS::Value("INVALID-MESSAGE", CLIPS::TYPE_SYMBOL);
+
+  std::string serialized;
+  (*m)->SerializePartialToString(&serialized);
+
+  char digest[2 * sizeof(size_t) + 1];
+  snprintf(digest, sizeof(digest), "%0*zx", (int)(2 * sizeof(size_t)),
+	   std::hash<std::string>()(serialized));
+  return CLIPS::Value(digest);
 }
 
 
 void
 ClipsProtobufCommunicator::clips_pb_destroy(void *msgptr)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!*m) return;
+  handles_->release(msgptr);
+}
+
+
+/** Get message handle statistics.
+ * Handles which are not destroyed by rules accumulate and show up as a
+ * steadily increasing number of live handles.
+ * @return list of the number of live handles, the peak number of live
+ * handles, and the number of uses of destroyed or invalid handles
+ */
+CLIPS::Values
+ClipsProtobufCommunicator::clips_pb_handle_stats()
+{
+  CLIPS::Values rv(3, CLIPS::Value(CLIPS::TYPE_INTEGER));
+  rv[0] = (long int)handles_->num_live();
+  rv[1] = (long int)handles_->peak_live();
+  rv[2] = (long int)handles_->num_stale();
+  return rv;
+}
+
+
+/** Get number of failed sends.
+ * @return number of messages which could not be sent to a server client,
+ * client, or peer since the communicator was created
+ */
+long int
+ClipsProtobufCommunicator::clips_pb_send_failures()
+{
+  return num_send_failures();
+}
+
+
+/** Get number of failed sends.
+ * Messages are sent asynchronously by the send workers, failures are
+ * therefore only counted and not reported to the caller of pb-send or
+ * pb-broadcast.
+ * @return number of messages which could not be sent
+ */
+unsigned int
+ClipsProtobufCommunicator::num_send_failures()
+{
+  fawkes::MutexLocker lock(&map_mutex_);
+  return num_send_failures_;
+}
+
+
+/** Get number of received messages dropped because the queue was full.
+ * @return number of dropped messages
+ * @see set_batch_assert()
+ */
+long int
+ClipsProtobufCommunicator::clips_pb_queue_drops()
+{
+  return num_queue_drops();
+}
 
-  delete m;
+
+/** Get number of received messages dropped because the queue was full.
+ * @return number of dropped messages
+ * @see set_batch_assert()
+ */
+unsigned long int
+ClipsProtobufCommunicator::num_queue_drops()
+{
+  fawkes::MutexLocker lock(&queue_mutex_);
+  return num_queue_drops_;
 }
 
 
 CLIPS::Values
 ClipsProtobufCommunicator::clips_pb_field_names(void *msgptr)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!*m) return CLIPS::Values();
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return CLIPS::Values();
 
   const Descriptor *desc = (*m)->GetDescriptor();
   const int field_count  = desc->field_count();
@@ -359,15 +776,34 @@ ClipsProtobufCommunicator::clips_pb_field_names(void *msgptr)
   return field_names;
 }
 
+/** Find field descriptor by name.
+ * Rules access the same few fields of a message type over and over,
+ * therefore lookups are cached per descriptor (including misses).
+ * Only called from CLIPS functions, i.e., with the environment locked.
+ * @param desc descriptor of message type
+ * @param field_name name of the field
+ * @return field descriptor or NULL if the type has no such field
+ */
+const FieldDescriptor *
+ClipsProtobufCommunicator::find_field(const Descriptor *desc, const std::string &field_name)
+{
+  FieldCache &fields = field_cache_[desc];
+  FieldCache::const_iterator f = fields.find(field_name);
+  if (f == fields.end()) {
+    f = fields.insert(std::make_pair(field_name, desc->FindFieldByName(field_name))).first;
+  }
+  return f->second;
+}
+
+
 CLIPS::Value
 ClipsProtobufCommunicator::clips_pb_field_type(void *msgptr, std::string field_name)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!*m) return CLIPS::Value("INVALID-MESSAGE", CLIPS::TYPE_SYMBOL);
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return CLIPS::Value("INVALID-MESSAGE", CLIPS::TYPE_SYMBOL);
 
   const Descriptor *desc       = (*m)->GetDescriptor();
-  const FieldDescriptor *field = desc->FindFieldByName(field_name);
+  const FieldDescriptor *field = find_field(desc, field_name);
   if (! field) {
     return CLIPS::Value("DOES-NOT-EXIST", CLIPS::TYPE_SYMBOL);
   }
@@ -396,12 +832,11 @@ ClipsProtobufCommunicator::clips_pb_field_type(void *msgptr, std::string field_n
 bool
 ClipsProtobufCommunicator::clips_pb_has_field(void *msgptr, std::string field_name)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!*m) return false;
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return false;
 
   const Descriptor *desc       = (*m)->GetDescriptor();
-  const FieldDescriptor *field = desc->FindFieldByName(field_name);
+  const FieldDescriptor *field = find_field(desc, field_name);
   if (! field)  return false;
 
   const Reflection *refl       = (*m)->GetReflection();
@@ -417,12 +852,11 @@ ClipsProtobufCommunicator::clips_pb_has_field(void *msgptr, std::string field_na
 CLIPS::Value
 ClipsProtobufCommunicator::clips_pb_field_label(void *msgptr, std::string field_name)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!*m) return CLIPS::Value("INVALID-MESSAGE", CLIPS::TYPE_SYMBOL);
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return CLIPS::Value("INVALID-MESSAGE", CLIPS::TYPE_SYMBOL);
 
   const Descriptor *desc       = (*m)->GetDescriptor();
-  const FieldDescriptor *field = desc->FindFieldByName(field_name);
+  const FieldDescriptor *field = find_field(desc, field_name);
   if (! field) {
     return CLIPS::Value("DOES-NOT-EXIST", CLIPS::TYPE_SYMBOL);
   }
@@ -434,15 +868,22 @@ ClipsProtobufCommunicator::clips_pb_field_label(void *msgptr, std::string field_
   }
 }
 
+/** Get field value.
+ * Message fields which are set are returned as a handle aliasing the
+ * sub-message within the parent message (no copy is made), modifying
+ * it modifies the parent. Unset message fields yield a new empty message.
+ * @param msgptr message handle
+ * @param field_name name of the field
+ * @return field value, or symbol on error
+ */
 CLIPS::Value
 ClipsProtobufCommunicator::clips_pb_field_value(void *msgptr, std::string field_name)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!*m) return CLIPS::Value("INVALID-MESSAGE", CLIPS::TYPE_SYMBOL);
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return CLIPS::Value("INVALID-MESSAGE", CLIPS::TYPE_SYMBOL);
 
   const Descriptor *desc       = (*m)->GetDescriptor();
-  const FieldDescriptor *field = desc->FindFieldByName(field_name);
+  const FieldDescriptor *field = find_field(desc, field_name);
   if (! field) {
     //logger_->log_warn("RefBox", "Field %s of %s does not exist",
     //   field_name.c_str(), (*m)->GetTypeName().c_str());
@@ -468,10 +909,14 @@ ClipsProtobufCommunicator::clips_pb_field_value(void *msgptr, std::string field_
   case FieldDescriptor::TYPE_STRING:   return CLIPS::Value(refl->GetString(**m, field));
   case FieldDescriptor::TYPE_MESSAGE:
     {
-      const google::protobuf::Message &mfield = refl->GetMessage(**m, field);
-      google::protobuf::Message *mcopy = mfield.New();
-      mcopy->CopyFrom(mfield);
-      void *ptr = new std::shared_ptr<google::protobuf::Message>(mcopy);
+      void *ptr;
+      if (refl->HasField(**m, field)) {
+	// alias the sub-message, the handle shares ownership of the parent
+	ptr = handles_->acquire(std::shared_ptr<google::protobuf::Message>(*m, refl->MutableMessage(m->get(), field)));
+      } else {
+	// do not set the field just by reading it, use pb-field-mutable for that
+	ptr = handles_->acquire(std::shared_ptr<google::protobuf::Message>(refl->GetMessage(**m, field).New()));
+      }
       return CLIPS::Value(ptr);
     }
   case FieldDescriptor::TYPE_BYTES:    return CLIPS::Value((char *)"bytes");
@@ -488,15 +933,50 @@ ClipsProtobufCommunicator::clips_pb_field_value(void *msgptr, std::string field_
 }
 
 
+/** Get mutable sub-message.
+ * The field is set if it was not before. The returned handle aliases
+ * the sub-message within the parent message and shares ownership of
+ * the parent. It can be modified in place, no pb-set-field is needed
+ * to write it back. Destroy the handle with pb-destroy or pass it to
+ * pb-set-field of the same field, which then copies nothing.
+ * @param msgptr message handle
+ * @param field_name name of a message field
+ * @return sub-message handle, or symbol on error
+ */
+CLIPS::Value
+ClipsProtobufCommunicator::clips_pb_field_mutable(void *msgptr, std::string field_name)
+{
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return CLIPS::Value("INVALID-MESSAGE", CLIPS::TYPE_SYMBOL);
+  wait_until_sent(*m);
+
+  const Descriptor *desc       = (*m)->GetDescriptor();
+  const FieldDescriptor *field = find_field(desc, field_name);
+  if (! field) {
+    return CLIPS::Value("DOES-NOT-EXIST", CLIPS::TYPE_SYMBOL);
+  }
+  if (field->type() != FieldDescriptor::TYPE_MESSAGE ||
+      field->label() == FieldDescriptor::LABEL_REPEATED)
+  {
+    return CLIPS::Value("NOT-A-MESSAGE", CLIPS::TYPE_SYMBOL);
+  }
+
+  const Reflection *refl = (*m)->GetReflection();
+  void *ptr =
+    handles_->acquire(std::shared_ptr<google::protobuf::Message>(*m, refl->MutableMessage(m->get(), field)));
+  return CLIPS::Value(ptr);
+}
+
+
 void
 ClipsProtobufCommunicator::clips_pb_set_field(void *msgptr, std::string field_name, CLIPS::Value value)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!*m) return;
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return;
+  wait_until_sent(*m);
 
   const Descriptor *desc       = (*m)->GetDescriptor();
-  const FieldDescriptor *field = desc->FindFieldByName(field_name);
+  const FieldDescriptor *field = find_field(desc, field_name);
   if (! field) {
     //logger_->log_warn("RefBox", "Could not find field %s", field_name.c_str());
     return;
@@ -524,11 +1004,14 @@ ClipsProtobufCommunicator::clips_pb_set_field(void *msgptr, std::string field_na
     case FieldDescriptor::TYPE_STRING:   refl->SetString(m->get(), field, value); break;
     case FieldDescriptor::TYPE_MESSAGE:
       {
-	std::shared_ptr<google::protobuf::Message> *mfrom =
-	  static_cast<std::shared_ptr<google::protobuf::Message> *>(value.as_address());
-	Message *mut_msg = refl->MutableMessage(m->get(), field);
-	mut_msg->CopyFrom(**mfrom);
-	delete mfrom;
+	void *fromptr = value.as_address();
+	std::shared_ptr<google::protobuf::Message> *mfrom = handles_->get(fromptr);
+	if (mfrom && *mfrom) {
+	  Message *mut_msg = refl->MutableMessage(m->get(), field);
+	  // nothing to copy if modified through pb-field-mutable
+	  if (mut_msg != mfrom->get())  mut_msg->CopyFrom(**mfrom);
+	}
+	handles_->release(fromptr);
       }
       break;
     case FieldDescriptor::TYPE_BYTES:    break;
@@ -560,12 +1043,12 @@ ClipsProtobufCommunicator::clips_pb_set_field(void *msgptr, std::string field_na
 void
 ClipsProtobufCommunicator::clips_pb_add_list(void *msgptr, std::string field_name, CLIPS::Value value)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!(m || *m)) return;
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return;
+  wait_until_sent(*m);
 
   const Descriptor *desc       = (*m)->GetDescriptor();
-  const FieldDescriptor *field = desc->FindFieldByName(field_name);
+  const FieldDescriptor *field = find_field(desc, field_name);
   if (! field) {
     //logger_->log_warn("RefBox", "Could not find field %s", field_name.c_str());
     return;
@@ -593,11 +1076,13 @@ ClipsProtobufCommunicator::clips_pb_add_list(void *msgptr, std::string field_nam
     case FieldDescriptor::TYPE_STRING:   refl->AddString(m->get(), field, value); break;
     case FieldDescriptor::TYPE_MESSAGE:
       {
-	std::shared_ptr<google::protobuf::Message> *mfrom =
-	  static_cast<std::shared_ptr<google::protobuf::Message> *>(value.as_address());
-	Message *new_msg = refl->AddMessage(m->get(), field);
-	new_msg->CopyFrom(**mfrom);
-	delete mfrom;
+	void *fromptr = value.as_address();
+	std::shared_ptr<google::protobuf::Message> *mfrom = handles_->get(fromptr);
+	if (mfrom && *mfrom) {
+	  Message *new_msg = refl->AddMessage(m->get(), field);
+	  new_msg->CopyFrom(**mfrom);
+	}
+	handles_->release(fromptr);
       }
       break;
     case FieldDescriptor::TYPE_BYTES:    break;
@@ -653,65 +1138,370 @@ ClipsProtobufCommunicator::clips_pb_client_connect(std::string host, int port)
 void
 ClipsProtobufCommunicator::clips_pb_send(long int client_id, void *msgptr)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!(m || *m)) {
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) {
     //logger_->log_warn("RefBox", "Cannot send to %li: invalid message", client_id);
     return;
   }
 
-  try {
-    fawkes::MutexLocker lock(&map_mutex_);
+  send_message(client_id, false, *m);
+}
 
-    if (server_ && server_clients_.find(client_id) != server_clients_.end()) {
-      //printf("***** SENDING via SERVER\n");
-      server_->send(server_clients_[client_id], *m);
-      sig_server_sent_(server_clients_[client_id], *m);
-    } else if (clients_.find(client_id) != clients_.end()) {
-      //printf("***** SENDING via CLIENT\n");
-      clients_[client_id]->send(*m);
-      std::pair<std::string, unsigned short> &client_endpoint = client_endpoints_[client_id];
-      sig_client_sent_(client_endpoint.first, client_endpoint.second, *m);
-    } else if (peers_.find(client_id) != peers_.end()) {
-      //printf("***** SENDING via CLIENT\n");
-      peers_[client_id]->send(*m);
-      sig_peer_sent_(client_id, *m);
-    } else {
+
+void
+ClipsProtobufCommunicator::clips_pb_broadcast(long int peer_id, void *msgptr)
+{
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) {
+    //logger_->log_warn("RefBox", "Cannot send broadcast: invalid message");
+    return;
+  }
+
+  send_message(peer_id, true, *m);
+}
+
+
+/** Set number of send workers.
+ * By default, pb-send and pb-broadcast serialize, encrypt, and hand over
+ * the message within the calling rule, and the sent signals are emitted
+ * before the function returns. With send workers, the message is only
+ * queued and all of this happens in a worker thread. Messages for the same
+ * client or peer are always handled by the same worker and thus are sent
+ * in order. Modifying a message from CLIPS while it is still queued blocks
+ * until it has been sent, i.e., a message is immutable while queued.
+ * Handlers of the sent signals are called from the worker threads.
+ * @param num_workers number of worker threads, 0 to send synchronously
+ */
+void
+ClipsProtobufCommunicator::set_send_workers(unsigned int num_workers)
+{
+  stop_send_workers();
+
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  send_workers_quit_ = false;
+  send_queues_.resize(num_workers);
+  for (unsigned int i = 0; i < num_workers; ++i) {
+    send_workers_.push_back(std::thread(&ClipsProtobufCommunicator::send_worker, this, i));
+  }
+}
+
+
+/* Stop send workers, messages still queued are sent before. */
+void
+ClipsProtobufCommunicator::stop_send_workers()
+{
+  {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    send_workers_quit_ = true;
+  }
+  send_cond_.notify_all();
+  for (std::thread &t : send_workers_) {
+    t.join();
+  }
+  send_workers_.clear();
+  send_queues_.clear();
+}
+
+
+void
+ClipsProtobufCommunicator::send_worker(unsigned int worker)
+{
+  std::unique_lock<std::mutex> lock(send_mutex_);
+  std::deque<SendJob> &queue = send_queues_[worker];
+  while (true) {
+    while (queue.empty() && ! send_workers_quit_)  send_cond_.wait(lock);
+    if (queue.empty())  return;
+
+    SendJob job = queue.front();
+    queue.pop_front();
+
+    lock.unlock();
+    send_now(job);
+    lock.lock();
+
+    if (--pending_msgs_[job.msg] == 0) {
+      pending_msgs_.erase(job.msg);
+      sent_cond_.notify_all();
+    }
+  }
+}
+
+
+void
+ClipsProtobufCommunicator::send_message(long int id, bool peer_only,
+					std::shared_ptr<google::protobuf::Message> &msg)
+{
+  SendJob job;
+  job.id        = id;
+  job.peer_only = peer_only;
+  job.msg       = msg;
+
+  {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (! send_queues_.empty()) {
+      send_queues_[(unsigned long)id % send_queues_.size()].push_back(job);
+      pending_msgs_[msg] += 1;
+      send_cond_.notify_all();
+      return;
+    }
+  }
+
+  send_now(job);
+}
+
+
+/* Block until message (or the message it is part of) has been sent
+ * by the send workers, called before modifying a message. */
+void
+ClipsProtobufCommunicator::wait_until_sent(const std::shared_ptr<google::protobuf::Message> &msg)
+{
+  std::unique_lock<std::mutex> lock(send_mutex_);
+  while (pending_msgs_.find(msg) != pending_msgs_.end())  sent_cond_.wait(lock);
+}
+
+
+/* Wait for sends currently being executed to complete, must be called
+ * with map_mutex_ locked after removing the client or peer from the maps.
+ * Delete it only after unlocking map_mutex_, its handlers lock it. */
+void
+ClipsProtobufCommunicator::wait_sends_in_flight()
+{
+  while (sends_in_flight_ > 0)  sends_done_cond_.wait();
+}
+
+
+void
+ClipsProtobufCommunicator::send_now(const SendJob &job)
+{
+  typedef enum { SEND_NONE, SEND_SERVER, SEND_CLIENT, SEND_PEER } SendVia;
+  SendVia via = SEND_NONE;
+  ProtobufStreamServer *server = NULL;
+  ProtobufStreamServer::ClientID srv_client = 0;
+  protobuf_comm::ProtobufStreamClient *client = NULL;
+  protobuf_comm::ProtobufBroadcastPeer *peer = NULL;
+  std::pair<std::string, unsigned short> client_endpoint;
+
+  {
+    fawkes::MutexLocker lock(&map_mutex_);
+    if (job.peer_only) {
+      if (peers_.find(job.id) != peers_.end()) {
+	via  = SEND_PEER;
+	peer = peers_[job.id];
+      }
+    } else if (server_ && server_clients_.find(job.id) != server_clients_.end()) {
+      via = SEND_SERVER;
+      server = server_;
+      srv_client = server_clients_[job.id];
+    } else if (clients_.find(job.id) != clients_.end()) {
+      via = SEND_CLIENT;
+      client = clients_[job.id];
+      client_endpoint = client_endpoints_[job.id];
+    } else if (peers_.find(job.id) != peers_.end()) {
+      via  = SEND_PEER;
+      peer = peers_[job.id];
+    }
+    if (via == SEND_NONE) {
       //printf("Client ID %li is unknown, cannot send message of type %s\n",
-      //     client_id, (*m)->GetTypeName().c_str());
+      //     job.id, job.msg->GetTypeName().c_str());
+      return;
+    }
+    ++sends_in_flight_;
+  }
+
+  bool sent = false;
+  try {
+    // in replay mode only signal as sent, do not interfere with the network
+    if (! replay_ || via == SEND_SERVER) {
+      switch (via) {
+      case SEND_SERVER: server->send(srv_client, job.msg);  break;
+      case SEND_CLIENT: client->send(job.msg);              break;
+      default:          peer->send(job.msg);                break;
+      }
     }
+    sent = true;
   } catch (google::protobuf::FatalException &e) {
     //logger_->log_warn("RefBox", "Failed to send message of type %s: %s",
-    //     (*m)->GetTypeName().c_str(), e.what());
+    //     job.msg->GetTypeName().c_str(), e.what());
   } catch (std::runtime_error &e) {
     //logger_->log_warn("RefBox", "Failed to send message of type %s: %s",
-    //     (*m)->GetTypeName().c_str(), e.what());
+    //     job.msg->GetTypeName().c_str(), e.what());
+  }
+
+  {
+    fawkes::MutexLocker lock(&map_mutex_);
+    if (! sent)  ++num_send_failures_;
+    if (--sends_in_flight_ == 0)  sends_done_cond_.wake_all();
+  }
+
+  // broadcasts were always signaled, even if sending failed
+  if (sent || job.peer_only) {
+    switch (via) {
+    case SEND_SERVER: sig_server_sent_(srv_client, job.msg); break;
+    case SEND_CLIENT:
+      sig_client_sent_(client_endpoint.first, client_endpoint.second, job.msg);
+      break;
+    default:          sig_peer_sent_(job.id, job.msg);         break;
+    }
   }
 }
 
 
-void
-ClipsProtobufCommunicator::clips_pb_broadcast(long int peer_id, void *msgptr)
+/** Add periodically published stream.
+ * When the stream is due, the builder function is called with the
+ * sequence number of the stream as last argument. If it returns a message,
+ * the message is sent to all destinations and destroyed afterwards. If it
+ * returns anything else, e.g. FALSE because there is nothing to publish
+ * in the current game phase, nothing is sent and the stream is due again
+ * after one period, without advancing sequence number or burst.
+ * @param name name of the stream
+ * @param builder name of builder function, optionally followed by
+ * arguments passed before the sequence number, e.g. "net-create-X CYAN"
+ * @param period period in seconds
+ * @param burst_period period in seconds for the first messages of a burst
+ * @param burst_count number of messages in a burst, 0 for no burst
+ * @param destinations peer IDs to broadcast to, and the symbol CLIENTS to
+ * send to all clients connected to the server
+ * @return true if the stream was added, false on error
+ */
+bool
+ClipsProtobufCommunicator::clips_pb_publisher_add(std::string name, std::string builder,
+						  double period, double burst_period,
+						  int burst_count, CLIPS::Values destinations)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!(m || *m)) {
-    //logger_->log_warn("RefBox", "Cannot send broadcast: invalid message");
-    return;
+  PublishedStream ps;
+  std::string::size_type space = builder.find(' ');
+  ps.function = builder.substr(0, space);
+  if (space != std::string::npos)  ps.args = builder.substr(space + 1) + " ";
+  ps.clients = false;
+  for (const CLIPS::Value &d : destinations) {
+    if (d.type() == CLIPS::TYPE_INTEGER) {
+      ps.peers.push_back(d.as_integer());
+    } else if (d.type() == CLIPS::TYPE_SYMBOL && d.as_string() == "CLIENTS") {
+      ps.clients = true;
+    } else {
+      //logger_->log_warn("RefBox", "Invalid destination for stream %s", name.c_str());
+      return false;
+    }
   }
 
-  fawkes::MutexLocker lock(&map_mutex_);
-  if (peers_.find(peer_id) == peers_.end())  return;
-
-  ////logger_->log_info("RefBox", "Broadcasting %s", (*m)->GetTypeName().c_str());
   try {
-    peers_[peer_id]->send(*m);
-  } catch (google::protobuf::FatalException &e) {
-    //logger_->log_warn("RefBox", "Failed to broadcast message of type %s: %s",
-    //   (*m)->GetTypeName().c_str(), e.what());
+    publisher_->add_stream(name, period, burst_period, std::max(burst_count, 0));
+  } catch (std::runtime_error &e) {
+    //logger_->log_warn("RefBox", "Cannot add stream: %s", e.what());
+    return false;
   }
+  published_streams_[name] = ps;
+  return true;
+}
+
+
+/** Remove periodically published stream.
+ * @param name name of the stream
+ */
+void
+ClipsProtobufCommunicator::clips_pb_publisher_remove(std::string name)
+{
+  publisher_->remove_stream(name);
+  published_streams_.erase(name);
+}
+
+
+/** Publish stream on next call to publish_due().
+ * @param name name of the stream
+ */
+void
+ClipsProtobufCommunicator::clips_pb_publisher_trigger(std::string name)
+{
+  publisher_->trigger(name);
+}
+
+
+/** Restart burst of stream.
+ * The stream is published on the next call to publish_due() and then
+ * with the burst period until the burst count has been reached again.
+ * @param name name of the stream
+ */
+void
+ClipsProtobufCommunicator::clips_pb_publisher_restart_burst(std::string name)
+{
+  publisher_->trigger(name, true);
+}
+
+
+/** Publish all streams which are due.
+ * Calls the builder functions of due streams and sends the messages.
+ * This is meant to be called once per main loop iteration, after the
+ * rules have run. The CLIPS environment must be locked.
+ * @param now current time, the schedule follows this time rather than the
+ * system clock, e.g., to publish at the same times when replaying a game
+ * @return number of published messages
+ */
+unsigned int
+ClipsProtobufCommunicator::publish_due(const struct timeval &now)
+{
+  unsigned int num_published = 0;
+
+  std::vector<std::string> due = publisher_->advance(now.tv_sec + now.tv_usec / 1000000.);
+  for (const std::string &name : due) {
+    if (published_streams_.find(name) == published_streams_.end())  continue;
+    // copy, the builder might remove the stream
+    const PublishedStream ps = published_streams_[name];
+
+    bool published = false;
+    CLIPS::Values rv =
+      clips_->function(ps.function, ps.args + std::to_string(publisher_->seq(name)));
+    if (rv.size() == 1 && rv[0].type() == CLIPS::TYPE_EXTERNAL_ADDRESS) {
+      void *msgptr = rv[0].as_address();
+      std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+      if (m && *m) {
+	for (long int peer_id : ps.peers) {
+	  send_message(peer_id, true, *m);
+	}
+	if (ps.clients) {
+	  std::vector<long int> client_ids;
+	  {
+	    fawkes::MutexLocker lock(&map_mutex_);
+	    for (const auto &c : server_clients_)  client_ids.push_back(c.first);
+	  }
+	  for (long int client_id : client_ids) {
+	    send_message(client_id, false, *m);
+	  }
+	}
+	published = true;
+	++num_published;
+      }
+      handles_->release(msgptr);
+    }
+    publisher_->done(name, published);
+  }
+
+  return num_published;
+}
+
 
-  sig_peer_sent_(peer_id, *m);
+/** Setup automatic reconnection for client.
+ * The client keeps reconnecting after losing the connection, messages
+ * sent while disconnected are buffered, cf. ProtobufStreamClient.
+ * A (protobuf-client-disconnected) fact is still asserted for each lost
+ * connection or failed attempt.
+ * @param client_id ID of the client created with pb-connect
+ * @param min_delay_ms delay before first reconnect attempt in ms, the
+ * delay doubles for each failed attempt
+ * @param max_delay_ms maximum delay between attempts in ms
+ * @param replay_size number of messages to buffer while disconnected, 0 to
+ * drop messages sent while disconnected
+ */
+void
+ClipsProtobufCommunicator::clips_pb_client_setup_reconnect(long int client_id,
+							   int min_delay_ms, int max_delay_ms,
+							   int replay_size)
+{
+  fawkes::MutexLocker lock(&map_mutex_);
+  if (clients_.find(client_id) != clients_.end()) {
+    clients_[client_id]->set_reconnect(true, std::max(min_delay_ms, 1),
+				       std::max(max_delay_ms, 1));
+    clients_[client_id]->set_replay_buffer(std::max(replay_size, 0));
+  }
 }
 
 
@@ -720,6 +1510,7 @@ ClipsProtobufCommunicator::clips_pb_disconnect(long int client_id)
 {
   //logger_->log_info("RefBox", "Disconnecting client %li", client_id);
 
+  ProtobufStreamClient *client = NULL;
   try {
     fawkes::MutexLocker lock(&map_mutex_);
 
@@ -729,23 +1520,25 @@ ClipsProtobufCommunicator::clips_pb_disconnect(long int client_id)
       server_clients_.erase(client_id);
       rev_server_clients_.erase(srv_client);
     } else if (clients_.find(client_id) != clients_.end()) {
-      delete clients_[client_id];
+      client = clients_[client_id];
       clients_.erase(client_id);
+      wait_sends_in_flight();
     }
   } catch (std::runtime_error &e) {
     //logger_->log_warn("RefBox", "Failed to disconnect from client %li: %s", client_id, e.what());
   }
+  // the client joins its thread, whose handlers lock map_mutex_
+  delete client;
 }
 
 CLIPS::Values
 ClipsProtobufCommunicator::clips_pb_field_list(void *msgptr, std::string field_name)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!(m || *m)) return CLIPS::Values(1, CLIPS::Value("INVALID-MESSAGE", CLIPS::TYPE_SYMBOL));
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return CLIPS::Values(1, CLIPS::Value("INVALID-MESSAGE", CLIPS::TYPE_SYMBOL));
 
   const Descriptor *desc       = (*m)->GetDescriptor();
-  const FieldDescriptor *field = desc->FindFieldByName(field_name);
+  const FieldDescriptor *field = find_field(desc, field_name);
   if (! field) {
     return CLIPS::Values(1, CLIPS::Value("DOES-NOT-EXIST", CLIPS::TYPE_SYMBOL));
   }
@@ -784,10 +1577,8 @@ ClipsProtobufCommunicator::clips_pb_field_list(void *msgptr, std::string field_n
       break;
     case FieldDescriptor::TYPE_MESSAGE:
       {
-	const google::protobuf::Message &msg = refl->GetRepeatedMessage(**m, field, i);
-	google::protobuf::Message *mcopy = msg.New();
-	mcopy->CopyFrom(msg);
-	void *ptr = new std::shared_ptr<google::protobuf::Message>(mcopy);
+	void *ptr =
+	  handles_->acquire(std::shared_ptr<google::protobuf::Message>(*m, refl->MutableRepeatedMessage(m->get(), field, i)));
 	rv[i] = CLIPS::Value(ptr);
       }
       break;
@@ -819,12 +1610,11 @@ ClipsProtobufCommunicator::clips_pb_field_list(void *msgptr, std::string field_n
 bool
 ClipsProtobufCommunicator::clips_pb_field_is_list(void *msgptr, std::string field_name)
 {
-  std::shared_ptr<google::protobuf::Message> *m =
-    static_cast<std::shared_ptr<google::protobuf::Message> *>(msgptr);
-  if (!(m || *m)) return false;
+  std::shared_ptr<google::protobuf::Message> *m = handles_->get(msgptr);
+  if (!(m && *m)) return false;
 
   const Descriptor *desc       = (*m)->GetDescriptor();
-  const FieldDescriptor *field = desc->FindFieldByName(field_name);
+  const FieldDescriptor *field = find_field(desc, field_name);
   if (! field) {
     return false;
   }
@@ -832,47 +1622,251 @@ ClipsProtobufCommunicator::clips_pb_field_is_list(void *msgptr, std::string fiel
 }
 
 
+/** Set handler for a message type.
+ * Received messages of the given type are passed to the handler first,
+ * which may consume them instead of having a protobuf-msg fact asserted.
+ * Handlers must be set before messages are received, i.e., before the
+ * server is enabled or peers are created, they are not synchronized.
+ * @param msg_type full name of the message type, e.g. llsf_msgs.BeaconSignal
+ * @param handler handler to call, an empty handler removes the entry
+ */
+void
+ClipsProtobufCommunicator::set_message_handler(const std::string &msg_type,
+					       MessageHandler handler)
+{
+  if (handler) {
+    msg_handlers_[msg_type] = handler;
+  } else {
+    msg_handlers_.erase(msg_type);
+  }
+}
+
+
+/** Enable or disable batched assertion of received messages.
+ * By default, a protobuf-msg fact is asserted for each message as soon as
+ * it has been received, locking the CLIPS environment for each message.
+ * With batched assertion, received messages are queued instead and only
+ * asserted on assert_queued_messages(), e.g. once per main loop iteration.
+ * Connection events of server and clients are queued as well, so that
+ * they keep their order relative to the messages.
+ * If more than @p queue_size messages are queued, further messages are
+ * dropped and accounted for, see num_queue_drops(). Events are never
+ * dropped. Messages already queued are kept when disabling.
+ * @param enabled true to queue received messages, false to assert immediately
+ * @param queue_size maximum number of queued messages, 0 for no limit
+ */
+void
+ClipsProtobufCommunicator::set_batch_assert(bool enabled, size_t queue_size)
+{
+  fawkes::MutexLocker lock(&queue_mutex_);
+  batch_assert_    = enabled;
+  max_queued_msgs_ = queue_size;
+}
+
+
+/** Assert all queued messages.
+ * Asserts a protobuf-msg fact for every message received since the last
+ * call, in the order of reception, interleaved with the connection event
+ * facts. The CLIPS environment must be locked.
+ * @return number of asserted messages
+ * @see set_batch_assert()
+ */
+unsigned int
+ClipsProtobufCommunicator::assert_queued_messages()
+{
+  {
+    fawkes::MutexLocker lock(&queue_mutex_);
+    if (queued_msgs_.empty())  return 0;
+    asserting_msgs_.swap(queued_msgs_);
+  }
+
+  release_retracted_msg_facts();
+  for (const ReceivedMessage &rm : asserting_msgs_) {
+    if (rm.msg) {
+      clips_assert_message(rm);
+    } else {
+      clips_->assert_fact(rm.event);
+    }
+  }
+
+  unsigned int num_asserted = asserting_msgs_.size();
+  asserting_msgs_.clear();
+  return num_asserted;
+}
+
+
+/** Enable or disable replay mode.
+ * In replay mode, messages are only taken from inject_message(), messages
+ * received from the network are ignored. Broadcasts and messages to servers
+ * we connected to are not sent, but the sent signals are still emitted.
+ * This way a recorded game can be replayed without interfering with a game
+ * running on the same network. Messages to clients connected to our server
+ * are still sent, e.g., to watch a replay with the shell.
+ * @param enabled true to enable replay mode, false to disable
+ */
+void
+ClipsProtobufCommunicator::set_replay(bool enabled)
+{
+  replay_ = enabled;
+}
+
+
+/** Inject a message as if it had been received.
+ * The message is processed like a message received from the network,
+ * i.e., it is passed to a registered message handler or asserted as a
+ * protobuf-msg fact, immediately or on the next assert_queued_messages().
+ * @param endpoint sender host and port
+ * @param comp_id component ID
+ * @param msg_type message type
+ * @param msg the message
+ * @param ct channel the message was received on
+ * @param client_id client or peer ID the message was received on
+ * @param rcvd_at time of reception
+ */
+void
+ClipsProtobufCommunicator::inject_message(const std::pair<std::string, unsigned short> &endpoint,
+					  uint16_t comp_id, uint16_t msg_type,
+					  std::shared_ptr<google::protobuf::Message> &msg,
+					  ClipsProtobufCommunicator::ClientType ct,
+					  long int client_id, const struct timeval &rcvd_at)
+{
+  dispatch_message(endpoint, comp_id, msg_type, msg, ct, client_id, rcvd_at);
+}
+
+
+void
+ClipsProtobufCommunicator::receive_message(const std::pair<std::string, unsigned short> &endpoint,
+					   uint16_t comp_id, uint16_t msg_type,
+					   std::shared_ptr<google::protobuf::Message> &msg,
+					   ClipsProtobufCommunicator::ClientType ct,
+					   long int client_id)
+{
+  if (replay_)  return;
+
+  struct timeval rcvd_at;
+  gettimeofday(&rcvd_at, 0);
+  dispatch_message(endpoint, comp_id, msg_type, msg, ct, client_id, rcvd_at);
+}
+
+
+void
+ClipsProtobufCommunicator::dispatch_message(const std::pair<std::string, unsigned short> &endpoint,
+					    uint16_t comp_id, uint16_t msg_type,
+					    std::shared_ptr<google::protobuf::Message> &msg,
+					    ClipsProtobufCommunicator::ClientType ct,
+					    long int client_id, const struct timeval &rcvd_at)
+{
+  if (! msg_handlers_.empty()) {
+    std::map<std::string, MessageHandler>::iterator h =
+      msg_handlers_.find(msg->GetDescriptor()->full_name());
+    if (h != msg_handlers_.end() && h->second(endpoint, rcvd_at, msg))  return;
+  }
+
+  ReceivedMessage rm;
+  rm.rcvd_at   = rcvd_at;
+  rm.endpoint  = endpoint;
+  rm.comp_id   = comp_id;
+  rm.msg_type  = msg_type;
+  rm.msg       = msg;
+  rm.ct        = ct;
+  rm.client_id = client_id;
+
+  {
+    fawkes::MutexLocker lock(&queue_mutex_);
+    if (batch_assert_) {
+      if (max_queued_msgs_ > 0 && queued_msgs_.size() >= max_queued_msgs_) {
+	++num_queue_drops_;
+      } else {
+	queued_msgs_.push_back(rm);
+      }
+      return;
+    }
+  }
+
+  fawkes::MutexLocker lock(&clips_mutex_);
+  release_retracted_msg_facts();
+  clips_assert_message(rm);
+}
+
+
+/* Assert a connection event fact. With batched assertion, the event is
+ * queued with the received messages to keep its order relative to them,
+ * otherwise it is asserted and the rules are run immediately. */
 void
-ClipsProtobufCommunicator::clips_assert_message(std::pair<std::string, unsigned short> &endpoint,
-						uint16_t comp_id, uint16_t msg_type,
-						std::shared_ptr<google::protobuf::Message> &msg,
-						ClipsProtobufCommunicator::ClientType ct,
-						unsigned int client_id)
-{
-  CLIPS::Template::pointer temp = clips_->get_template("protobuf-msg");
-  if (temp) {
-    struct timeval tv;
-    gettimeofday(&tv, 0);
-    void *ptr = new std::shared_ptr<google::protobuf::Message>(msg);
-    CLIPS::Fact::pointer fact = CLIPS::Fact::create(*clips_, temp);
-    fact->set_slot("type", msg->GetTypeName());
-    fact->set_slot("comp-id", comp_id);
-    fact->set_slot("msg-type", msg_type);
-    fact->set_slot("rcvd-via",
-		   CLIPS::Value((ct == CT_PEER) ? "BROADCAST" : "STREAM", CLIPS::TYPE_SYMBOL));
-    CLIPS::Values rcvd_at(2, CLIPS::Value(CLIPS::TYPE_INTEGER));
-    rcvd_at[0] = tv.tv_sec;
-    rcvd_at[1] = tv.tv_usec;
-    fact->set_slot("rcvd-at", rcvd_at);
-    CLIPS::Values host_port(2, CLIPS::Value(CLIPS::TYPE_STRING));
-    host_port[0] = endpoint.first;
-    host_port[1] = CLIPS::Value(endpoint.second);
-    fact->set_slot("rcvd-from", host_port);
-    fact->set_slot("client-type",
-      CLIPS::Value(ct == CT_CLIENT ? "CLIENT" :
-		   (ct == CT_SERVER ? "SERVER" : "PEER"), CLIPS::TYPE_SYMBOL));
-    fact->set_slot("client-id", client_id);
-    fact->set_slot("ptr", CLIPS::Value(ptr));
-    CLIPS::Fact::pointer new_fact = clips_->assert_fact(fact);
-
-    if (new_fact) {
-      msg_facts_[new_fact->index()] = new_fact;
+ClipsProtobufCommunicator::assert_event(const std::string &fact)
+{
+  {
+    fawkes::MutexLocker lock(&queue_mutex_);
+    if (batch_assert_) {
+      ReceivedMessage rm;
+      rm.event = fact;
+      queued_msgs_.push_back(rm);
+      return;
+    }
+  }
+
+  fawkes::MutexLocker lock(&clips_mutex_);
+  clips_->assert_fact(fact);
+  clips_->refresh_agenda();
+  clips_->run();
+}
+
+
+/* Release handles of received messages whose facts have been retracted.
+ * Must be called with the CLIPS environment locked. */
+void
+ClipsProtobufCommunicator::release_retracted_msg_facts()
+{
+  std::map<long int, CLIPS::Fact::pointer>::iterator f = msg_facts_.begin();
+  while (f != msg_facts_.end()) {
+    if (f->second->exists()) {
+      ++f;
     } else {
-      //logger_->log_warn("RefBox", "Asserting protobuf-msg fact failed");
-      delete static_cast<std::shared_ptr<google::protobuf::Message> *>(ptr);
+      handles_->release(f->second->slot_value("ptr")[0].as_address());
+      msg_facts_.erase(f++);
     }
+  }
+}
+
+
+/* Assert protobuf-msg fact, must be called with the CLIPS environment
+ * locked. The template is looked up once and then cached, the symbols
+ * for channel and client type are pre-built in setup_clips(). */
+void
+ClipsProtobufCommunicator::clips_assert_message(const ReceivedMessage &rm)
+{
+  if (! msg_template_) {
+    msg_template_ = clips_->get_template("protobuf-msg");
+    if (! msg_template_) {
+      //logger_->log_warn("RefBox", "Did not get template, did you load protobuf.clp?");
+      return;
+    }
+  }
+
+  void *ptr = handles_->acquire(rm.msg);
+  CLIPS::Fact::pointer fact = CLIPS::Fact::create(*clips_, msg_template_);
+  fact->set_slot("type", rm.msg->GetDescriptor()->full_name());
+  fact->set_slot("comp-id", rm.comp_id);
+  fact->set_slot("msg-type", rm.msg_type);
+  fact->set_slot("rcvd-via", rcvd_via_syms_[rm.ct]);
+  CLIPS::Values rcvd_at(2, CLIPS::Value(CLIPS::TYPE_INTEGER));
+  rcvd_at[0] = rm.rcvd_at.tv_sec;
+  rcvd_at[1] = rm.rcvd_at.tv_usec;
+  fact->set_slot("rcvd-at", rcvd_at);
+  CLIPS::Values host_port(2, CLIPS::Value(CLIPS::TYPE_STRING));
+  host_port[0] = rm.endpoint.first;
+  host_port[1] = CLIPS::Value(rm.endpoint.second);
+  fact->set_slot("rcvd-from", host_port);
+  fact->set_slot("client-type", client_type_syms_[rm.ct]);
+  fact->set_slot("client-id", rm.client_id);
+  fact->set_slot("ptr", CLIPS::Value(ptr));
+  CLIPS::Fact::pointer new_fact = clips_->assert_fact(fact);
+
+  if (new_fact) {
+    msg_facts_[new_fact->index()] = new_fact;
   } else {
-    //logger_->log_warn("RefBox", "Did not get template, did you load protobuf.clp?");
+    //logger_->log_warn("RefBox", "Asserting protobuf-msg fact failed");
+    handles_->release(ptr);
   }
 }
 
@@ -891,11 +1885,8 @@ ClipsProtobufCommunicator::handle_server_client_connected(ProtobufStreamServer::
     rev_server_clients_[client] = client_id;
   }
 
-  fawkes::MutexLocker lock(&clips_mutex_);
-  clips_->assert_fact_f("(protobuf-server-client-connected %li %s %u)", client_id,
-			endpoint.address().to_string().c_str(), endpoint.port());
-  clips_->refresh_agenda();
-  clips_->run();
+  assert_event(boost::str(boost::format("(protobuf-server-client-connected %li %s %u)")
+			  % client_id % endpoint.address().to_string() % endpoint.port()));
 }
 
 
@@ -915,10 +1906,8 @@ ClipsProtobufCommunicator::handle_server_client_disconnected(ProtobufStreamServe
   }
 
   if (client_id >= 0) {
-    fawkes::MutexLocker lock(&clips_mutex_);
-    clips_->assert_fact_f("(protobuf-server-client-disconnected %li)", client_id);
-    clips_->refresh_agenda();
-    clips_->run();
+    assert_event(boost::str(boost::format("(protobuf-server-client-disconnected %li)")
+			    % client_id));
   }
 }
 
@@ -934,13 +1923,16 @@ ClipsProtobufCommunicator::handle_server_client_msg(ProtobufStreamServer::Client
 						    uint16_t component_id, uint16_t msg_type,
 						    std::shared_ptr<google::protobuf::Message> msg)
 {
-  fawkes::MutexLocker lock(&clips_mutex_);
-  fawkes::MutexLocker lock2(&map_mutex_);
-  RevServerClientMap::iterator c;
-  if ((c = rev_server_clients_.find(client)) != rev_server_clients_.end()) {
-    clips_assert_message(client_endpoints_[c->second],
-			 component_id, msg_type, msg, CT_SERVER, c->second);
+  std::pair<std::string, unsigned short> endpoint;
+  long int client_id;
+  {
+    fawkes::MutexLocker lock(&map_mutex_);
+    RevServerClientMap::iterator c;
+    if ((c = rev_server_clients_.find(client)) == rev_server_clients_.end())  return;
+    client_id = c->second;
+    endpoint  = client_endpoints_[client_id];
   }
+  receive_message(endpoint, component_id, msg_type, msg, CT_SERVER, client_id);
 }
 
 /** Handle server reception failure
@@ -954,6 +1946,8 @@ ClipsProtobufCommunicator::handle_server_client_fail(ProtobufStreamServer::Clien
 						     uint16_t component_id, uint16_t msg_type,
 						     std::string msg)
 {
+  if (replay_)  return;
+
   fawkes::MutexLocker lock(&map_mutex_);
   RevServerClientMap::iterator c;
   if ((c = rev_server_clients_.find(client)) != rev_server_clients_.end()) {
@@ -980,10 +1974,9 @@ ClipsProtobufCommunicator::handle_peer_msg(long int peer_id,
 					   uint16_t component_id, uint16_t msg_type,
 					   std::shared_ptr<google::protobuf::Message> msg)
 {
-  fawkes::MutexLocker lock(&clips_mutex_);
   std::pair<std::string, unsigned short> endpp =
     std::make_pair(endpoint.address().to_string(), endpoint.port());
-  clips_assert_message(endpp, component_id, msg_type, msg, CT_PEER, peer_id);
+  receive_message(endpp, component_id, msg_type, msg, CT_PEER, peer_id);
 }
 
 
@@ -1012,20 +2005,14 @@ ClipsProtobufCommunicator::handle_peer_send_error(long int peer_id, std::string
 void
 ClipsProtobufCommunicator::handle_client_connected(long int client_id)
 {
-  fawkes::MutexLocker lock(&clips_mutex_);
-  clips_->assert_fact_f("(protobuf-client-connected %li)", client_id);
-  clips_->refresh_agenda();
-  clips_->run();
+  assert_event(boost::str(boost::format("(protobuf-client-connected %li)") % client_id));
 }
 
 void
 ClipsProtobufCommunicator::handle_client_disconnected(long int client_id,
 						      const boost::system::error_code &error)
 {
-  fawkes::MutexLocker lock(&clips_mutex_);
-  clips_->assert_fact_f("(protobuf-client-disconnected %li)", client_id);
-  clips_->refresh_agenda();
-  clips_->run();
+  assert_event(boost::str(boost::format("(protobuf-client-disconnected %li)") % client_id));
 }
 
 void
@@ -1033,9 +2020,8 @@ ClipsProtobufCommunicator::handle_client_msg(long int client_id,
 					     uint16_t comp_id, uint16_t msg_type,
 					     std::shared_ptr<google::protobuf::Message> msg)
 {
-  fawkes::MutexLocker lock(&clips_mutex_);
   std::pair<std::string, unsigned short> endpp = std::make_pair(std::string(), 0);
-  clips_assert_message(endpp, comp_id, msg_type, msg, CT_CLIENT, client_id);
+  receive_message(endpp, comp_id, msg_type, msg, CT_CLIENT, client_id);
 }
 
 
@@ -37,12 +37,21 @@
 #ifndef __PROTOBUF_CLIPS_COMMUNICATOR_H_
 #define __PROTOBUF_CLIPS_COMMUNICATOR_H_
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <list>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/time.h>
 #include <clipsmm.h>
 
 #include <protobuf_comm/server.h>
 #include <core/threading/mutex.h>
+#include <core/threading/wait_condition.h>
 
 namespace protobuf_comm {
   class ProtobufStreamClient;
@@ -54,6 +63,10 @@ namespace protobuf_clips {
 }
 #endif
 
+class ClipsMessageFacts;
+class MessageHandlePool;
+class PeriodicPublisher;
+
 class ClipsProtobufCommunicator
 {
  public:
@@ -101,6 +114,39 @@ class ClipsProtobufCommunicator
   boost::signals2::signal<void (long int, std::shared_ptr<google::protobuf::Message>)> &
     signal_peer_sent() { return sig_peer_sent_; }
 
+  /** Handler for messages which are processed natively.
+   * The handler is called from the receiving thread with the sender
+   * endpoint, the reception time, and the message. If it returns true
+   * the message is consumed and no protobuf-msg fact is asserted.
+   */
+  typedef std::function<bool (const std::pair<std::string, unsigned short> &endpoint,
+			      const struct timeval &rcvd_at,
+			      std::shared_ptr<google::protobuf::Message> &msg)> MessageHandler;
+  void set_message_handler(const std::string &msg_type, MessageHandler handler);
+
+  void set_batch_assert(bool enabled, size_t queue_size = 0);
+  unsigned long int num_queue_drops();
+  unsigned int assert_queued_messages();
+
+  /** Channel a message was received on. */
+  typedef enum {
+    CT_SERVER,	///< stream server, i.e., from a connected client
+    CT_CLIENT,	///< stream client, i.e., from a server we connected to
+    CT_PEER	///< broadcast peer
+  } ClientType;
+
+  void set_replay(bool enabled);
+  void inject_message(const std::pair<std::string, unsigned short> &endpoint,
+		      uint16_t comp_id, uint16_t msg_type,
+		      std::shared_ptr<google::protobuf::Message> &msg,
+		      ClientType ct, long int client_id,
+		      const struct timeval &rcvd_at);
+
+  void set_send_workers(unsigned int num_workers);
+  unsigned int num_send_failures();
+
+  unsigned int publish_due(const struct timeval &now);
+
  private:
   void          setup_clips();
 
@@ -108,18 +154,40 @@ class ClipsProtobufCommunicator
   CLIPS::Values clips_pb_field_names(void *msgptr);
   bool          clips_pb_has_field(void *msgptr, std::string field_name);
   CLIPS::Value  clips_pb_field_value(void *msgptr, std::string field_name);
+  CLIPS::Value  clips_pb_field_mutable(void *msgptr, std::string field_name);
+  bool          clips_pb_build_deftemplate(std::string full_name);
+  long int      clips_pb_build_deftemplates();
+  bool          clips_pb_assert_fact(void *msgptr);
+  bool          clips_pb_define_mapping(std::string name, std::string full_name,
+					std::string template_name, CLIPS::Values mapping);
+  bool          clips_pb_mapping_order(std::string name, CLIPS::Values slots);
+  CLIPS::Values clips_pb_create_from_facts(std::string name, CLIPS::Values filter);
+  long int      clips_pb_add_list_from_facts(void *msgptr, std::string field_name,
+					     std::string name, CLIPS::Values filter);
   CLIPS::Value  clips_pb_field_type(void *msgptr, std::string field_name);
   CLIPS::Value  clips_pb_field_label(void *msgptr, std::string field_name);
   CLIPS::Values clips_pb_field_list(void *msgptr, std::string field_name);
   bool          clips_pb_field_is_list(void *msgptr, std::string field_name);
   CLIPS::Value  clips_pb_create(std::string full_name);
   CLIPS::Value  clips_pb_ref(void *msgptr);
+  CLIPS::Value  clips_pb_digest(void *msgptr);
   void          clips_pb_destroy(void *msgptr);
+  CLIPS::Values clips_pb_handle_stats();
+  long int      clips_pb_send_failures();
+  long int      clips_pb_queue_drops();
+  bool          clips_pb_publisher_add(std::string name, std::string builder,
+				       double period, double burst_period, int burst_count,
+				       CLIPS::Values destinations);
+  void          clips_pb_publisher_remove(std::string name);
+  void          clips_pb_publisher_trigger(std::string name);
+  void          clips_pb_publisher_restart_burst(std::string name);
   void          clips_pb_set_field(void *msgptr, std::string field_name, CLIPS::Value value);
   void          clips_pb_add_list(void *msgptr, std::string field_name, CLIPS::Value value);
   void          clips_pb_send(long int client_id, void *msgptr);
   long int      clips_pb_client_connect(std::string host, int port);
   void          clips_pb_disconnect(long int client_id);
+  void          clips_pb_client_setup_reconnect(long int client_id, int min_delay_ms,
+						int max_delay_ms, int replay_size);
   void          clips_pb_broadcast(long int peer_id, void *msgptr);
   void          clips_pb_enable_server(int port);
 
@@ -134,17 +202,57 @@ class ClipsProtobufCommunicator
   void          clips_pb_peer_destroy(long int peer_id);
   void          clips_pb_peer_setup_crypto(long int peer_id,
 					   std::string crypto_key, std::string cipher);
+  bool          clips_pb_peer_setup_compression(long int peer_id,
+						std::string codec, int threshold);
+  bool          clips_pb_peer_setup_multicast(long int peer_id, std::string interface_address,
+					      int ttl, std::string loopback);
+  void          clips_pb_peer_setup_rate_limit(long int peer_id, double rate, int burst);
+  bool          clips_pb_peer_setup_type_rate_limit(long int peer_id, std::string full_name,
+						    double rate, int burst);
+  CLIPS::Values clips_pb_peer_rate_limit_drops(long int peer_id);
 
   CLIPS::Value  clips_pb_connect(std::string host, int port);
 
 
-  typedef enum {
-    CT_SERVER, CT_CLIENT, CT_PEER
-  } ClientType;
-  void clips_assert_message(std::pair<std::string, unsigned short> &endpoint,
-			    uint16_t comp_id, uint16_t msg_type,
-			    std::shared_ptr<google::protobuf::Message> &msg,
-			    ClientType ct, unsigned int client_id = 0);
+  /** Message received and to be asserted as protobuf-msg fact, or
+   * connection event to be asserted as fact if msg is not set. */
+  typedef struct {
+    std::pair<std::string, unsigned short> endpoint;	///< sender host and port
+    uint16_t                               comp_id;	///< component ID
+    uint16_t                               msg_type;	///< message type
+    std::shared_ptr<google::protobuf::Message> msg;	///< the message
+    ClientType                             ct;		///< type of receiving channel
+    long int                               client_id;	///< client or peer ID
+    struct timeval                         rcvd_at;	///< time of reception
+    std::string                            event;	///< event fact if msg is not set
+  } ReceivedMessage;
+
+  void receive_message(const std::pair<std::string, unsigned short> &endpoint,
+		       uint16_t comp_id, uint16_t msg_type,
+		       std::shared_ptr<google::protobuf::Message> &msg,
+		       ClientType ct, long int client_id = 0);
+  void dispatch_message(const std::pair<std::string, unsigned short> &endpoint,
+			uint16_t comp_id, uint16_t msg_type,
+			std::shared_ptr<google::protobuf::Message> &msg,
+			ClientType ct, long int client_id,
+			const struct timeval &rcvd_at);
+  void clips_assert_message(const ReceivedMessage &rm);
+  void assert_event(const std::string &fact);
+
+  /** Message to be sent by a send worker. */
+  typedef struct {
+    long int id;		///< client or peer ID
+    bool     peer_only;		///< true to only consider peers, i.e., for pb-broadcast
+    std::shared_ptr<google::protobuf::Message> msg;	///< message to send
+  } SendJob;
+
+  void send_message(long int id, bool peer_only, std::shared_ptr<google::protobuf::Message> &msg);
+  void send_now(const SendJob &job);
+  void send_worker(unsigned int worker);
+  void stop_send_workers();
+  void wait_until_sent(const std::shared_ptr<google::protobuf::Message> &msg);
+  void wait_sends_in_flight();
+  void release_retracted_msg_facts();
   void handle_server_client_connected(protobuf_comm::ProtobufStreamServer::ClientID client,
 				      boost::asio::ip::tcp::endpoint &endpoint);
   void handle_server_client_disconnected(protobuf_comm::ProtobufStreamServer::ClientID client,
@@ -171,6 +279,9 @@ class ClipsProtobufCommunicator
   void handle_client_msg(long int client_id,
 			 uint16_t comp_id, uint16_t msg_type,
 			 std::shared_ptr<google::protobuf::Message> msg);
+  const google::protobuf::FieldDescriptor *
+    find_field(const google::protobuf::Descriptor *desc, const std::string &field_name);
+
   void handle_client_receive_fail(long int client_id,
 				  uint16_t comp_id, uint16_t msg_type, std::string msg);
 
@@ -179,6 +290,9 @@ class ClipsProtobufCommunicator
   fawkes::Mutex        &clips_mutex_;
 
   protobuf_comm::MessageRegister       *message_register_;
+  ClipsMessageFacts                    *message_facts_;
+  MessageHandlePool                    *handles_;
+  PeriodicPublisher                    *publisher_;
   protobuf_comm::ProtobufStreamServer  *server_;
 
   boost::signals2::signal<void (protobuf_comm::ProtobufStreamServer::ClientID,
@@ -190,6 +304,19 @@ class ClipsProtobufCommunicator
   fawkes::Mutex map_mutex_;
   long int next_client_id_;
 
+  fawkes::WaitCondition    sends_done_cond_;
+  unsigned int             sends_in_flight_;
+  unsigned int             num_send_failures_;
+
+  std::mutex                            send_mutex_;
+  std::condition_variable               send_cond_;
+  std::condition_variable               sent_cond_;
+  bool                                  send_workers_quit_;
+  std::vector<std::thread>              send_workers_;
+  std::vector<std::deque<SendJob>>      send_queues_;
+  std::map<std::shared_ptr<google::protobuf::Message>, unsigned int,
+	   std::owner_less<std::shared_ptr<google::protobuf::Message>>>  pending_msgs_;
+
 
   std::map<long int, protobuf_comm::ProtobufStreamServer::ClientID> server_clients_;
   typedef std::map<protobuf_comm::ProtobufStreamServer::ClientID, long int> RevServerClientMap;
@@ -199,7 +326,32 @@ class ClipsProtobufCommunicator
 
   std::map<long int, std::pair<std::string, unsigned short>> client_endpoints_;
 
+  /** Builder and destinations of a published stream. */
+  typedef struct {
+    std::string           function;	///< builder function name
+    std::string           args;		///< arguments passed before the sequence number
+    std::vector<long int> peers;	///< IDs of peers to broadcast to
+    bool                  clients;	///< true to send to all server clients
+  } PublishedStream;
+  std::map<std::string, PublishedStream>    published_streams_;
+
   std::map<long int, CLIPS::Fact::pointer>  msg_facts_;
+  CLIPS::Template::pointer                  msg_template_;
+  CLIPS::Values                             client_type_syms_;
+  CLIPS::Values                             rcvd_via_syms_;
+
+  fawkes::Mutex                queue_mutex_;
+  std::map<std::string, MessageHandler> msg_handlers_;
+
+  bool                         batch_assert_;
+  bool                         replay_;
+  size_t                       max_queued_msgs_;
+  unsigned long int            num_queue_drops_;
+  std::vector<ReceivedMessage> queued_msgs_;
+  std::vector<ReceivedMessage> asserting_msgs_;
+
+  typedef std::unordered_map<std::string, const google::protobuf::FieldDescriptor *> FieldCache;
+  std::unordered_map<const google::protobuf::Descriptor *, FieldCache> field_cache_;
 
 
   std::list<std::string>  functions_;
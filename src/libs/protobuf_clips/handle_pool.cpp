@@ -0,0 +1,188 @@
+/***************************************************************************
+ *  handle_pool.cpp - pooled message handles for CLIPS
+ *
+ *  Created: Mon Oct 19 00:22:46 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <protobuf_clips/handle_pool.h>
+
+#include <stdexcept>
+
+namespace protobuf_clips {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+/// @cond INTERNALS
+// A handle encodes the slot index plus one in its lower half and the
+// slot's generation in its upper half. Zero is never a valid handle.
+static const unsigned int HANDLE_INDEX_BITS = sizeof(uintptr_t) * 4;
+static const uintptr_t    HANDLE_INDEX_MASK = (((uintptr_t)1) << HANDLE_INDEX_BITS) - 1;
+static const size_t       HANDLE_CHUNK_SIZE = 256;
+static const size_t       HANDLE_NO_SLOT    = (size_t)-1;
+/// @endcond
+
+/** @class MessageHandlePool <protobuf_clips/handle_pool.h>
+ * Pool of message handles passed to CLIPS as external addresses.
+ * Handles are allocated from slabs of slots which are recycled through
+ * a free list, instead of allocating a shared pointer on the heap for
+ * each handle. Slots are never moved or freed while the pool exists.
+ *
+ * A handle is not a pointer but encodes the slot index and a generation
+ * counter, which is incremented whenever the slot is released. Using a
+ * handle after it has been destroyed is therefore detected and rejected,
+ * even if the slot has been re-used in the meantime.
+ *
+ * The pool is not thread-safe, it is meant to be used with the CLIPS
+ * environment locked.
+ * @author agent
+ */
+
+/** Constructor. */
+MessageHandlePool::MessageHandlePool()
+  : num_slots_(0), free_head_(HANDLE_NO_SLOT), num_live_(0), peak_live_(0), num_stale_(0)
+{
+}
+
+/** Destructor.
+ * Releases all messages still referenced by live handles.
+ */
+MessageHandlePool::~MessageHandlePool()
+{
+}
+
+
+/** Acquire a handle.
+ * @param msg message to reference, may be empty
+ * @return new handle referencing the message
+ * @exception std::runtime_error thrown if the handle space is exhausted
+ */
+void *
+MessageHandlePool::acquire(const std::shared_ptr<google::protobuf::Message> &msg)
+{
+  if (free_head_ == HANDLE_NO_SLOT) {
+    if (num_slots_ + HANDLE_CHUNK_SIZE > HANDLE_INDEX_MASK) {
+      throw std::runtime_error("Message handle pool exhausted");
+    }
+    chunks_.push_back(std::unique_ptr<Slot[]>(new Slot[HANDLE_CHUNK_SIZE]));
+    Slot *chunk = chunks_.back().get();
+    for (size_t i = 0; i < HANDLE_CHUNK_SIZE; ++i) {
+      chunk[i].generation = 0;
+      chunk[i].live = false;
+      chunk[i].next_free =
+	(i + 1 < HANDLE_CHUNK_SIZE) ? num_slots_ + i + 1 : HANDLE_NO_SLOT;
+    }
+    free_head_ = num_slots_;
+    num_slots_ += HANDLE_CHUNK_SIZE;
+  }
+
+  size_t index = free_head_;
+  Slot &s = chunks_[index / HANDLE_CHUNK_SIZE][index % HANDLE_CHUNK_SIZE];
+  free_head_ = s.next_free;
+  s.msg  = msg;
+  s.live = true;
+
+  if (++num_live_ > peak_live_)  peak_live_ = num_live_;
+
+  return (void *)((s.generation << HANDLE_INDEX_BITS) | (uintptr_t)(index + 1));
+}
+
+
+MessageHandlePool::Slot *
+MessageHandlePool::slot(void *handle)
+{
+  uintptr_t h = (uintptr_t)handle;
+  size_t index = h & HANDLE_INDEX_MASK;
+  if (index == 0 || index > num_slots_) {
+    ++num_stale_;
+    return NULL;
+  }
+  index -= 1;
+  Slot &s = chunks_[index / HANDLE_CHUNK_SIZE][index % HANDLE_CHUNK_SIZE];
+  if (! s.live || s.generation != (h >> HANDLE_INDEX_BITS)) {
+    ++num_stale_;
+    return NULL;
+  }
+  return &s;
+}
+
+
+/** Get message referenced by a handle.
+ * The returned pointer remains valid until the handle is released.
+ * @param handle handle to resolve
+ * @return pointer to the message reference, NULL if the handle has
+ * already been released or is invalid
+ */
+std::shared_ptr<google::protobuf::Message> *
+MessageHandlePool::get(void *handle)
+{
+  Slot *s = slot(handle);
+  return s ? &s->msg : NULL;
+}
+
+
+/** Release a handle.
+ * The message reference is dropped and the handle becomes invalid.
+ * @param handle handle to release
+ * @return true if the handle was released, false if it has already been
+ * released before or is invalid
+ */
+bool
+MessageHandlePool::release(void *handle)
+{
+  Slot *s = slot(handle);
+  if (! s)  return false;
+
+  size_t index = ((uintptr_t)handle & HANDLE_INDEX_MASK) - 1;
+  s->msg.reset();
+  s->live = false;
+  s->generation = (s->generation + 1) & HANDLE_INDEX_MASK;
+  s->next_free = free_head_;
+  free_head_ = index;
+  --num_live_;
+  return true;
+}
+
+
+/** Release all handles.
+ * Slots are kept for re-use, all previously acquired handles become invalid.
+ */
+void
+MessageHandlePool::clear()
+{
+  for (size_t i = 0; i < num_slots_; ++i) {
+    Slot &s = chunks_[i / HANDLE_CHUNK_SIZE][i % HANDLE_CHUNK_SIZE];
+    if (s.live)  release((void *)((s.generation << HANDLE_INDEX_BITS) | (uintptr_t)(i + 1)));
+  }
+}
+
+} // end namespace protobuf_clips
@@ -0,0 +1,96 @@
+/***************************************************************************
+ *  handle_pool.h - pooled message handles for CLIPS
+ *
+ *  Created: Mon Oct 19 00:22:46 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PROTOBUF_CLIPS_HANDLE_POOL_H_
+#define __PROTOBUF_CLIPS_HANDLE_POOL_H_
+
+#include <google/protobuf/message.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace protobuf_clips {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+class MessageHandlePool
+{
+ public:
+  MessageHandlePool();
+  ~MessageHandlePool();
+
+  void * acquire(const std::shared_ptr<google::protobuf::Message> &msg);
+  std::shared_ptr<google::protobuf::Message> * get(void *handle);
+  bool release(void *handle);
+  void clear();
+
+  /** Get number of live handles.
+   * @return number of handles acquired and not yet released */
+  size_t num_live() const { return num_live_; }
+  /** Get peak number of live handles.
+   * @return maximum number of simultaneously live handles */
+  size_t peak_live() const { return peak_live_; }
+  /** Get number of allocated handle slots.
+   * @return number of slots, live or free */
+  size_t capacity() const { return num_slots_; }
+  /** Get number of rejected stale handles.
+   * @return number of times a released or invalid handle was passed to get() or release() */
+  unsigned long num_stale() const { return num_stale_; }
+
+ private:
+  /** Handle slot. */
+  typedef struct {
+    std::shared_ptr<google::protobuf::Message> msg;	///< referenced message
+    uintptr_t generation;	///< incremented on every release
+    size_t    next_free;	///< next slot in free list, if not live
+    bool      live;		///< true if the handle has been acquired
+  } Slot;
+
+  Slot * slot(void *handle);
+
+ private:
+  std::vector<std::unique_ptr<Slot[]>> chunks_;
+  size_t        num_slots_;
+  size_t        free_head_;
+  size_t        num_live_;
+  size_t        peak_live_;
+  unsigned long num_stale_;
+};
+
+} // end namespace protobuf_clips
+
+#endif
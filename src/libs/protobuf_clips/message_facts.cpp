@@ -0,0 +1,723 @@
+/***************************************************************************
+ *  message_facts.cpp - protobuf messages as CLIPS facts
+ *
+ *  Created: Mon Oct 19 00:16:25 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <protobuf_clips/message_facts.h>
+
+#include <google/protobuf/descriptor.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <iomanip>
+#include <sstream>
+
+extern "C" {
+#include <clips/clips.h>
+}
+
+using namespace google::protobuf;
+
+namespace protobuf_clips {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+/** @class ClipsMessageFacts <protobuf_clips/message_facts.h>
+ * Represent protobuf messages as CLIPS facts.
+ * For a message type a deftemplate is generated from its descriptor and
+ * messages can then be asserted as facts of that template with a single
+ * call, instead of querying each field individually from rules.
+ *
+ * The template is named pb-<full type name>, e.g. pb-llsf_msgs.BeaconSignal.
+ * Scalar fields map to a slot of the same name, repeated scalar fields to
+ * a multislot. Singular sub-messages are flattened, their fields become
+ * slots prefixed by the field name and a dash, e.g. pose-x or
+ * pose-timestamp-sec. A slot named like the sub-message field itself is
+ * TRUE if the sub-message is set and FALSE otherwise. Repeated message
+ * fields, bytes fields, and recursive sub-messages are not represented.
+ * Booleans are represented as the symbols TRUE and FALSE, enum values
+ * as symbols.
+ *
+ * All methods must be called with the CLIPS environment locked.
+ * @author agent
+ */
+
+/** Constructor.
+ * @param env CLIPS environment to create templates and facts in
+ */
+ClipsMessageFacts::ClipsMessageFacts(CLIPS::Environment *env)
+  : clips_(env)
+{
+}
+
+
+/** Destructor. */
+ClipsMessageFacts::~ClipsMessageFacts()
+{
+}
+
+
+/** Get name of template for a message type.
+ * @param desc message type descriptor
+ * @return template name
+ */
+std::string
+ClipsMessageFacts::template_name(const Descriptor *desc)
+{
+  return "pb-" + desc->full_name();
+}
+
+
+static std::string
+clips_string(const std::string &s)
+{
+  std::string rv = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')  rv += '\\';
+    rv += c;
+  }
+  return rv + "\"";
+}
+
+
+static std::string
+clips_float(double d)
+{
+  std::ostringstream os;
+  os << std::setprecision(17) << d;
+  std::string rv = os.str();
+  if (rv.find_first_of(".e") == std::string::npos)  rv += ".0";
+  return rv;
+}
+
+
+static std::string
+slot_constraints(const FieldDescriptor *field)
+{
+  const bool repeated = (field->label() == FieldDescriptor::LABEL_REPEATED);
+
+  switch (field->cpp_type()) {
+  case FieldDescriptor::CPPTYPE_DOUBLE:
+  case FieldDescriptor::CPPTYPE_FLOAT:
+    {
+      double d = (field->cpp_type() == FieldDescriptor::CPPTYPE_DOUBLE)
+	? field->default_value_double() : field->default_value_float();
+      if (repeated || ! std::isfinite(d))  return "(type FLOAT)";
+      return "(type FLOAT) (default " + clips_float(d) + ")";
+    }
+  case FieldDescriptor::CPPTYPE_INT32:
+    if (repeated)  return "(type INTEGER)";
+    return "(type INTEGER) (default " + std::to_string(field->default_value_int32()) + ")";
+  case FieldDescriptor::CPPTYPE_INT64:
+    if (repeated)  return "(type INTEGER)";
+    return "(type INTEGER) (default " + std::to_string(field->default_value_int64()) + ")";
+  case FieldDescriptor::CPPTYPE_UINT32:
+    if (repeated)  return "(type INTEGER)";
+    return "(type INTEGER) (default " + std::to_string(field->default_value_uint32()) + ")";
+  case FieldDescriptor::CPPTYPE_UINT64:
+    if (repeated)  return "(type INTEGER)";
+    return "(type INTEGER) (default " +
+      std::to_string((long int)field->default_value_uint64()) + ")";
+  case FieldDescriptor::CPPTYPE_BOOL:
+    if (repeated)  return "(type SYMBOL) (allowed-values TRUE FALSE)";
+    return std::string("(type SYMBOL) (allowed-values TRUE FALSE) (default ") +
+      (field->default_value_bool() ? "TRUE" : "FALSE") + ")";
+  case FieldDescriptor::CPPTYPE_STRING:
+    if (repeated)  return "(type STRING)";
+    return "(type STRING) (default " + clips_string(field->default_value_string()) + ")";
+  case FieldDescriptor::CPPTYPE_ENUM:
+    {
+      const EnumDescriptor *enumdesc = field->enum_type();
+      std::string rv = "(type SYMBOL) (allowed-values";
+      for (int i = 0; i < enumdesc->value_count(); ++i) {
+	rv += " " + enumdesc->value(i)->name();
+      }
+      rv += ")";
+      if (! repeated)  rv += " (default " + field->default_value_enum()->name() + ")";
+      return rv;
+    }
+  default:
+    return "";
+  }
+}
+
+
+void
+ClipsMessageFacts::add_slots(const Descriptor *desc, const std::string &prefix,
+			     std::vector<const FieldDescriptor *> &path,
+			     std::vector<Slot> &slots, std::string &def)
+{
+  for (int i = 0; i < desc->field_count(); ++i) {
+    const FieldDescriptor *field = desc->field(i);
+    const std::string name = prefix + field->name();
+    const bool repeated = (field->label() == FieldDescriptor::LABEL_REPEATED);
+
+    if (field->type() == FieldDescriptor::TYPE_BYTES)  continue;
+
+    if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
+      if (repeated)  continue;
+      // do not recurse into a type we are already within
+      const Descriptor *sub = field->message_type();
+      if (sub == desc ||
+	  std::find_if(path.begin(), path.end(),
+		       [sub](const FieldDescriptor *f) { return f->containing_type() == sub; })
+	  != path.end())
+      {
+	continue;
+      }
+
+      path.push_back(field);
+      def += "  (slot " + name + " (type SYMBOL) (allowed-values TRUE FALSE) (default FALSE))\n";
+      slots.push_back(Slot{name, path, true});
+      add_slots(sub, name + "-", path, slots, def);
+      path.pop_back();
+    } else {
+      path.push_back(field);
+      def += std::string("  (") + (repeated ? "multislot " : "slot ") + name +
+	" " + slot_constraints(field) + ")\n";
+      slots.push_back(Slot{name, path, false});
+      path.pop_back();
+    }
+  }
+}
+
+
+/** Generate deftemplate for a message type.
+ * @param desc message type descriptor
+ * @return deftemplate construct suitable to be passed to build
+ */
+std::string
+ClipsMessageFacts::deftemplate(const Descriptor *desc)
+{
+  std::vector<Slot> slots;
+  return deftemplate(desc, slots);
+}
+
+
+std::string
+ClipsMessageFacts::deftemplate(const Descriptor *desc, std::vector<Slot> &slots)
+{
+  std::vector<const FieldDescriptor *> path;
+  std::string def = "(deftemplate " + template_name(desc) + "\n";
+  add_slots(desc, "", path, slots, def);
+  return def + ")";
+}
+
+
+/** Build deftemplate for a message type.
+ * Does nothing if the template has already been built.
+ * @param desc message type descriptor
+ * @return true if the template exists, false if building it failed
+ */
+bool
+ClipsMessageFacts::build_deftemplate(const Descriptor *desc)
+{
+  if (templates_.find(desc) != templates_.end())  return true;
+
+  Template t;
+  if (! clips_->build(deftemplate(desc, t.slots)))  return false;
+  t.template_ = clips_->get_template(template_name(desc));
+  if (! t.template_)  return false;
+
+  templates_[desc] = t;
+  return true;
+}
+
+
+static CLIPS::Value
+field_value(const Message &m, const FieldDescriptor *field)
+{
+  const Reflection *refl = m.GetReflection();
+  switch (field->cpp_type()) {
+  case FieldDescriptor::CPPTYPE_DOUBLE: return CLIPS::Value(refl->GetDouble(m, field));
+  case FieldDescriptor::CPPTYPE_FLOAT:  return CLIPS::Value(refl->GetFloat(m, field));
+  case FieldDescriptor::CPPTYPE_INT32:  return CLIPS::Value(refl->GetInt32(m, field));
+  case FieldDescriptor::CPPTYPE_INT64:  return CLIPS::Value((long int)refl->GetInt64(m, field));
+  case FieldDescriptor::CPPTYPE_UINT32: return CLIPS::Value((long int)refl->GetUInt32(m, field));
+  case FieldDescriptor::CPPTYPE_UINT64: return CLIPS::Value((long int)refl->GetUInt64(m, field));
+  case FieldDescriptor::CPPTYPE_BOOL:
+    return CLIPS::Value(refl->GetBool(m, field) ? "TRUE" : "FALSE", CLIPS::TYPE_SYMBOL);
+  case FieldDescriptor::CPPTYPE_STRING: return CLIPS::Value(refl->GetString(m, field));
+  case FieldDescriptor::CPPTYPE_ENUM:
+    return CLIPS::Value(refl->GetEnum(m, field)->name(), CLIPS::TYPE_SYMBOL);
+  default:
+    return CLIPS::Value("INVALID", CLIPS::TYPE_SYMBOL);
+  }
+}
+
+
+static CLIPS::Value
+repeated_field_value(const Message &m, const FieldDescriptor *field, int i)
+{
+  const Reflection *refl = m.GetReflection();
+  switch (field->cpp_type()) {
+  case FieldDescriptor::CPPTYPE_DOUBLE:
+    return CLIPS::Value(refl->GetRepeatedDouble(m, field, i));
+  case FieldDescriptor::CPPTYPE_FLOAT:
+    return CLIPS::Value(refl->GetRepeatedFloat(m, field, i));
+  case FieldDescriptor::CPPTYPE_INT32:
+    return CLIPS::Value(refl->GetRepeatedInt32(m, field, i));
+  case FieldDescriptor::CPPTYPE_INT64:
+    return CLIPS::Value((long int)refl->GetRepeatedInt64(m, field, i));
+  case FieldDescriptor::CPPTYPE_UINT32:
+    return CLIPS::Value((long int)refl->GetRepeatedUInt32(m, field, i));
+  case FieldDescriptor::CPPTYPE_UINT64:
+    return CLIPS::Value((long int)refl->GetRepeatedUInt64(m, field, i));
+  case FieldDescriptor::CPPTYPE_BOOL:
+    return CLIPS::Value(refl->GetRepeatedBool(m, field, i) ? "TRUE" : "FALSE",
+			CLIPS::TYPE_SYMBOL);
+  case FieldDescriptor::CPPTYPE_STRING:
+    return CLIPS::Value(refl->GetRepeatedString(m, field, i));
+  case FieldDescriptor::CPPTYPE_ENUM:
+    return CLIPS::Value(refl->GetRepeatedEnum(m, field, i)->name(), CLIPS::TYPE_SYMBOL);
+  default:
+    return CLIPS::Value("INVALID", CLIPS::TYPE_SYMBOL);
+  }
+}
+
+
+/** Assert message as fact.
+ * The template for the message type is built if necessary.
+ * @param msg message to assert
+ * @return asserted fact, invalid pointer if asserting failed
+ */
+CLIPS::Fact::pointer
+ClipsMessageFacts::assert_message(const Message &msg)
+{
+  const Descriptor *desc = msg.GetDescriptor();
+  if (! build_deftemplate(desc))  return CLIPS::Fact::pointer();
+  const Template &t = templates_[desc];
+
+  CLIPS::Fact::pointer fact = CLIPS::Fact::create(*clips_, t.template_);
+  for (const Slot &slot : t.slots) {
+    // descend to the message containing the field, default instances
+    // are returned for unset sub-messages
+    const Message *m = &msg;
+    for (size_t i = 0; i < slot.path.size() - 1; ++i) {
+      m = &m->GetReflection()->GetMessage(*m, slot.path[i]);
+    }
+    const FieldDescriptor *field = slot.path.back();
+
+    if (slot.presence) {
+      fact->set_slot(slot.name,
+		     CLIPS::Value(m->GetReflection()->HasField(*m, field) ? "TRUE" : "FALSE",
+				  CLIPS::TYPE_SYMBOL));
+    } else if (field->label() == FieldDescriptor::LABEL_REPEATED) {
+      int size = m->GetReflection()->FieldSize(*m, field);
+      CLIPS::Values values;
+      values.reserve(size);
+      for (int i = 0; i < size; ++i) {
+	values.push_back(repeated_field_value(*m, field, i));
+      }
+      fact->set_slot(slot.name, values);
+    } else {
+      fact->set_slot(slot.name, field_value(*m, field));
+    }
+  }
+
+  return clips_->assert_fact(fact);
+}
+
+
+/** Set order of facts for a mapping.
+ * Facts are otherwise processed in the order of their fact index, which
+ * changes whenever a fact is modified. With an order, the facts matching
+ * a filter are sorted by the values of the given slots, the first slot
+ * being the most significant. Numbers are compared numerically and sort
+ * before symbols and strings, which are compared lexicographically.
+ * @param name name of the mapping
+ * @param slots names of the slots to sort by, empty to use the fact order
+ * @exception std::runtime_error thrown if the mapping does not exist
+ */
+void
+ClipsMessageFacts::set_mapping_order(const std::string &name, const CLIPS::Values &slots)
+{
+  std::map<std::string, Mapping>::iterator m = mappings_.find(name);
+  if (m == mappings_.end()) {
+    throw std::runtime_error("Mapping " + name + " has not been defined");
+  }
+  m->second.order.clear();
+  for (const CLIPS::Value &v : slots) {
+    m->second.order.push_back(v.as_string());
+  }
+}
+
+
+/** Define mapping from facts to messages.
+ * The mapping is given as pairs of a field path and a slot specification.
+ * A field path names a field of the message type, fields of singular
+ * sub-messages are addressed by dot-separated paths, e.g.
+ * "pose.timestamp.sec". A slot specification names a slot of the
+ * template. For a multislot a single value can be selected with a 1-based
+ * index in brackets, e.g. "pose[2]". A numeric value can be scaled by a
+ * factor, e.g. "last-seen[2]*1000". A multislot without index is mapped
+ * to a repeated field. Symbols are mapped to enum values by name, values
+ * not defined in the enum are ignored, TRUE and FALSE to booleans.
+ *
+ * The mapping is parsed and resolved once when defined, building messages
+ * does not perform any lookups by name.
+ * @param name name of the mapping, an existing mapping of that name is replaced
+ * @param prototype message of the type to create, new messages are spawned from it
+ * @param template_name name of the fact template
+ * @param mapping pairs of field path and slot specification
+ * @exception std::runtime_error thrown if the mapping is invalid
+ */
+void
+ClipsMessageFacts::define_mapping(const std::string &name,
+				  std::shared_ptr<Message> prototype,
+				  const std::string &template_name, const CLIPS::Values &mapping)
+{
+  if (mapping.size() % 2 != 0) {
+    throw std::runtime_error("Mapping must consist of field path and slot pairs");
+  }
+
+  Mapping m;
+  m.prototype = prototype;
+  m.template_name = template_name;
+
+  for (size_t i = 0; i < mapping.size(); i += 2) {
+    const std::string path = mapping[i].as_string();
+    const std::string spec = mapping[i+1].as_string();
+
+    FieldMapping f;
+    const Descriptor *desc = prototype->GetDescriptor();
+    std::string::size_type start = 0, end;
+    do {
+      end = path.find('.', start);
+      std::string field_name = path.substr(start, end - start);
+      if (! desc) {
+	throw std::runtime_error("Field " + path + " descends into non-message field");
+      }
+      const FieldDescriptor *field = desc->FindFieldByName(field_name);
+      if (! field) {
+	throw std::runtime_error("Field " + path + " does not exist in " +
+				 prototype->GetTypeName());
+      }
+      if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE &&
+	  field->label() == FieldDescriptor::LABEL_REPEATED)
+      {
+	throw std::runtime_error("Field " + path + " descends into repeated field");
+      }
+      f.path.push_back(field);
+      desc = field->message_type();
+      start = end + 1;
+    } while (end != std::string::npos);
+
+    if (f.path.back()->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE ||
+	f.path.back()->type() == FieldDescriptor::TYPE_BYTES)
+    {
+      throw std::runtime_error("Field " + path + " is not of a scalar type");
+    }
+
+    std::string::size_type factor_pos = spec.find('*');
+    std::string::size_type index_pos  = spec.find('[');
+    f.slot   = spec.substr(0, std::min(factor_pos, index_pos));
+    f.index  = 0;
+    f.factor = 1.0;
+    try {
+      if (index_pos != std::string::npos) {
+	f.index = std::stoul(spec.substr(index_pos + 1));
+	if (f.index == 0)  throw std::invalid_argument("index must be larger than zero");
+      }
+      if (factor_pos != std::string::npos) {
+	f.factor = std::stod(spec.substr(factor_pos + 1));
+      }
+    } catch (std::logic_error &e) {
+      throw std::runtime_error("Invalid slot specification " + spec + ": " + e.what());
+    }
+    m.fields.push_back(f);
+  }
+
+  mappings_[name] = m;
+}
+
+
+const ClipsMessageFacts::Mapping &
+ClipsMessageFacts::mapping(const std::string &name)
+{
+  std::map<std::string, Mapping>::const_iterator m = mappings_.find(name);
+  if (m == mappings_.end()) {
+    throw std::runtime_error("Mapping " + name + " has not been defined");
+  }
+  return m->second;
+}
+
+
+static bool
+values_equal(const CLIPS::Value &a, const CLIPS::Value &b)
+{
+  if (a.type() != b.type())  return false;
+  switch (a.type()) {
+  case CLIPS::TYPE_FLOAT:            return a.as_float() == b.as_float();
+  case CLIPS::TYPE_INTEGER:          return a.as_integer() == b.as_integer();
+  case CLIPS::TYPE_EXTERNAL_ADDRESS: return a.as_address() == b.as_address();
+  default:                           return a.as_string() == b.as_string();
+  }
+}
+
+
+/* Order values, numbers before symbols and strings. */
+static int
+values_compare(const CLIPS::Value &a, const CLIPS::Value &b)
+{
+  const bool a_num = (a.type() == CLIPS::TYPE_FLOAT || a.type() == CLIPS::TYPE_INTEGER);
+  const bool b_num = (b.type() == CLIPS::TYPE_FLOAT || b.type() == CLIPS::TYPE_INTEGER);
+  if (a_num != b_num)  return a_num ? -1 : 1;
+  if (a_num) {
+    double da = (a.type() == CLIPS::TYPE_FLOAT) ? a.as_float() : (double)a.as_integer();
+    double db = (b.type() == CLIPS::TYPE_FLOAT) ? b.as_float() : (double)b.as_integer();
+    return (da < db) ? -1 : ((da > db) ? 1 : 0);
+  }
+  if (a.type() == CLIPS::TYPE_EXTERNAL_ADDRESS || b.type() == CLIPS::TYPE_EXTERNAL_ADDRESS) {
+    return 0;
+  }
+  return a.as_string().compare(b.as_string());
+}
+
+
+/* Filter is given as triples of slot name, eq or neq, and value. */
+std::list<CLIPS::Fact::pointer>
+ClipsMessageFacts::matching_facts(const Mapping &mapping, const CLIPS::Values &filter)
+{
+  if (filter.size() % 3 != 0) {
+    throw std::runtime_error("Filter must consist of slot, eq/neq, and value triples");
+  }
+
+  std::list<CLIPS::Fact::pointer> rv;
+  CLIPS::Template::pointer tmpl = clips_->get_template(mapping.template_name);
+  if (! tmpl)  return rv;
+
+  // only walk the facts of the template, not the whole fact list
+  void *env = clips_->cobj();
+  for (void *f = EnvGetNextFactInTemplate(env, tmpl->cobj(), NULL); f;
+       f = EnvGetNextFactInTemplate(env, tmpl->cobj(), f))
+  {
+    CLIPS::Fact::pointer fact = CLIPS::Fact::create(*clips_, f);
+
+    bool matches = true;
+    for (size_t i = 0; matches && i < filter.size(); i += 3) {
+      CLIPS::Values v = fact->slot_value(filter[i].as_string());
+      bool equal = (v.size() == 1) && values_equal(v[0], filter[i+2]);
+      matches = (filter[i+1].as_string() == "neq") ? ! equal : equal;
+    }
+    if (matches)  rv.push_back(fact);
+  }
+
+  if (! mapping.order.empty() && rv.size() > 1) {
+    // read sort keys once, comparing would otherwise query slots repeatedly
+    typedef std::pair<std::vector<CLIPS::Values>, CLIPS::Fact::pointer> KeyedFact;
+    std::vector<KeyedFact> keyed;
+    keyed.reserve(rv.size());
+    for (CLIPS::Fact::pointer &fact : rv) {
+      std::vector<CLIPS::Values> key;
+      key.reserve(mapping.order.size());
+      for (const std::string &slot : mapping.order) {
+	key.push_back(fact->slot_value(slot));
+      }
+      keyed.push_back(std::make_pair(key, fact));
+    }
+
+    std::stable_sort(keyed.begin(), keyed.end(),
+		     [](const KeyedFact &a, const KeyedFact &b) -> bool
+		     {
+		       for (size_t i = 0; i < a.first.size(); ++i) {
+			 const CLIPS::Values &va = a.first[i], &vb = b.first[i];
+			 for (size_t j = 0; j < va.size() && j < vb.size(); ++j) {
+			   int c = values_compare(va[j], vb[j]);
+			   if (c != 0)  return c < 0;
+			 }
+			 if (va.size() != vb.size())  return va.size() < vb.size();
+		       }
+		       return false;
+		     });
+
+    rv.clear();
+    for (KeyedFact &kf : keyed)  rv.push_back(kf.second);
+  }
+
+  return rv;
+}
+
+
+static double
+number(const CLIPS::Value &v)
+{
+  return (v.type() == CLIPS::TYPE_FLOAT) ? v.as_float() : (double)v.as_integer();
+}
+
+
+static void
+set_field(Message *msg, const FieldDescriptor *field, const CLIPS::Value &v, double factor)
+{
+  const Reflection *refl = msg->GetReflection();
+  const bool repeated = (field->label() == FieldDescriptor::LABEL_REPEATED);
+
+  switch (field->cpp_type()) {
+  case FieldDescriptor::CPPTYPE_DOUBLE:
+  case FieldDescriptor::CPPTYPE_FLOAT:
+  case FieldDescriptor::CPPTYPE_INT32:
+  case FieldDescriptor::CPPTYPE_INT64:
+  case FieldDescriptor::CPPTYPE_UINT32:
+  case FieldDescriptor::CPPTYPE_UINT64:
+    {
+      if (v.type() != CLIPS::TYPE_FLOAT && v.type() != CLIPS::TYPE_INTEGER)  return;
+      double d = number(v) * factor;
+      switch (field->cpp_type()) {
+      case FieldDescriptor::CPPTYPE_DOUBLE:
+	if (repeated) refl->AddDouble(msg, field, d); else refl->SetDouble(msg, field, d);
+	break;
+      case FieldDescriptor::CPPTYPE_FLOAT:
+	if (repeated) refl->AddFloat(msg, field, d); else refl->SetFloat(msg, field, d);
+	break;
+      case FieldDescriptor::CPPTYPE_INT32:
+	if (repeated) refl->AddInt32(msg, field, d); else refl->SetInt32(msg, field, d);
+	break;
+      case FieldDescriptor::CPPTYPE_INT64:
+	if (repeated) refl->AddInt64(msg, field, d); else refl->SetInt64(msg, field, d);
+	break;
+      case FieldDescriptor::CPPTYPE_UINT32:
+	if (repeated) refl->AddUInt32(msg, field, d); else refl->SetUInt32(msg, field, d);
+	break;
+      default:
+	if (repeated) refl->AddUInt64(msg, field, d); else refl->SetUInt64(msg, field, d);
+	break;
+      }
+    }
+    break;
+  case FieldDescriptor::CPPTYPE_BOOL:
+    {
+      bool b = (v.type() == CLIPS::TYPE_SYMBOL) ? (v.as_string() == "TRUE") : (number(v) != 0.);
+      if (repeated) refl->AddBool(msg, field, b); else refl->SetBool(msg, field, b);
+    }
+    break;
+  case FieldDescriptor::CPPTYPE_STRING:
+    if (v.type() != CLIPS::TYPE_STRING && v.type() != CLIPS::TYPE_SYMBOL)  return;
+    if (repeated) refl->AddString(msg, field, v.as_string());
+    else          refl->SetString(msg, field, v.as_string());
+    break;
+  case FieldDescriptor::CPPTYPE_ENUM:
+    {
+      if (v.type() != CLIPS::TYPE_SYMBOL && v.type() != CLIPS::TYPE_STRING)  return;
+      const EnumValueDescriptor *enumval = field->enum_type()->FindValueByName(v.as_string());
+      if (! enumval)  return;
+      if (repeated) refl->AddEnum(msg, field, enumval); else refl->SetEnum(msg, field, enumval);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+
+void
+ClipsMessageFacts::fill_message(Message *msg, const Mapping &mapping, CLIPS::Fact::pointer &fact)
+{
+  for (const FieldMapping &f : mapping.fields) {
+    CLIPS::Values values = fact->slot_value(f.slot);
+
+    Message *m = msg;
+    for (size_t i = 0; i < f.path.size() - 1; ++i) {
+      m = m->GetReflection()->MutableMessage(m, f.path[i]);
+    }
+    const FieldDescriptor *field = f.path.back();
+
+    if (f.index > 0) {
+      if (f.index <= values.size())  set_field(m, field, values[f.index - 1], f.factor);
+    } else if (field->label() == FieldDescriptor::LABEL_REPEATED) {
+      for (const CLIPS::Value &v : values)  set_field(m, field, v, f.factor);
+    } else if (! values.empty()) {
+      set_field(m, field, values[0], f.factor);
+    }
+  }
+}
+
+
+/** Create messages from facts.
+ * A message is created for each fact of the mapping's template which
+ * matches the filter. The filter consists of triples of a slot name,
+ * eq or neq, and a value, a fact matches if all conditions hold.
+ * @param name name of the mapping to use
+ * @param filter filter triples, empty to create a message for every fact
+ * @return created messages, in the order of the fact list
+ * @exception std::runtime_error thrown if mapping or filter are invalid
+ */
+std::list<std::shared_ptr<Message>>
+ClipsMessageFacts::create_from_facts(const std::string &name, const CLIPS::Values &filter)
+{
+  const Mapping &m = mapping(name);
+
+  std::list<std::shared_ptr<Message>> rv;
+  std::list<CLIPS::Fact::pointer> facts = matching_facts(m, filter);
+  for (CLIPS::Fact::pointer &fact : facts) {
+    std::shared_ptr<Message> msg(m.prototype->New());
+    fill_message(msg.get(), m, fact);
+    rv.push_back(msg);
+  }
+  return rv;
+}
+
+
+/** Add messages created from facts to a repeated field.
+ * Like create_from_facts(), but the messages are created directly within
+ * the repeated message field of the given message.
+ * @param msg message to add to
+ * @param field_name name of repeated message field to add to
+ * @param name name of the mapping to use
+ * @param filter filter triples, empty to add a message for every fact
+ * @return number of messages added
+ * @exception std::runtime_error thrown if mapping, filter, or field are invalid
+ */
+unsigned int
+ClipsMessageFacts::add_list_from_facts(Message &msg, const std::string &field_name,
+				       const std::string &name, const CLIPS::Values &filter)
+{
+  const Mapping &m = mapping(name);
+
+  const FieldDescriptor *field = msg.GetDescriptor()->FindFieldByName(field_name);
+  if (! field || field->label() != FieldDescriptor::LABEL_REPEATED ||
+      field->message_type() != m.prototype->GetDescriptor())
+  {
+    throw std::runtime_error("Field " + field_name + " is not a repeated " +
+			     m.prototype->GetTypeName() + " field");
+  }
+
+  std::list<CLIPS::Fact::pointer> facts = matching_facts(m, filter);
+  for (CLIPS::Fact::pointer &fact : facts) {
+    fill_message(msg.GetReflection()->AddMessage(&msg, field), m, fact);
+  }
+  return facts.size();
+}
+
+} // end namespace protobuf_clips
@@ -0,0 +1,126 @@
+/***************************************************************************
+ *  message_facts.h - protobuf messages as CLIPS facts
+ *
+ *  Created: Mon Oct 19 00:16:25 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PROTOBUF_CLIPS_MESSAGE_FACTS_H_
+#define __PROTOBUF_CLIPS_MESSAGE_FACTS_H_
+
+#include <clipsmm.h>
+#include <google/protobuf/message.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace protobuf_clips {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+class ClipsMessageFacts
+{
+ public:
+  ClipsMessageFacts(CLIPS::Environment *env);
+  ~ClipsMessageFacts();
+
+  static std::string template_name(const google::protobuf::Descriptor *desc);
+  static std::string deftemplate(const google::protobuf::Descriptor *desc);
+
+  bool build_deftemplate(const google::protobuf::Descriptor *desc);
+  CLIPS::Fact::pointer assert_message(const google::protobuf::Message &msg);
+
+  void define_mapping(const std::string &name,
+		      std::shared_ptr<google::protobuf::Message> prototype,
+		      const std::string &template_name, const CLIPS::Values &mapping);
+  void set_mapping_order(const std::string &name, const CLIPS::Values &slots);
+  std::list<std::shared_ptr<google::protobuf::Message>>
+    create_from_facts(const std::string &name, const CLIPS::Values &filter);
+  unsigned int add_list_from_facts(google::protobuf::Message &msg, const std::string &field_name,
+				   const std::string &name, const CLIPS::Values &filter);
+
+ private:
+  /** Slot of a generated template. */
+  typedef struct {
+    std::string name;	///< slot name
+    /** Fields leading to the value, the last one is the field of the slot. */
+    std::vector<const google::protobuf::FieldDescriptor *> path;
+    bool presence;	///< true if the slot denotes presence of a sub-message
+  } Slot;
+
+  /** Generated template. */
+  typedef struct {
+    CLIPS::Template::pointer template_;	///< CLIPS template
+    std::vector<Slot>        slots;	///< slots in template
+  } Template;
+
+  /** Mapping of a template slot to a message field. */
+  typedef struct {
+    /** Fields leading to the value, the last one is the field to set. */
+    std::vector<const google::protobuf::FieldDescriptor *> path;
+    std::string slot;	///< slot name
+    size_t      index;	///< 1-based index into multislot, 0 for all values
+    double      factor;	///< factor applied to numeric values
+  } FieldMapping;
+
+  /** Mapping of facts of a template to messages of a type. */
+  typedef struct {
+    std::shared_ptr<google::protobuf::Message> prototype;	///< message to spawn new ones from
+    std::string               template_name;	///< name of fact template
+    std::vector<FieldMapping> fields;		///< field mappings
+    std::vector<std::string>  order;		///< slots to sort facts by
+  } Mapping;
+
+  static std::string deftemplate(const google::protobuf::Descriptor *desc,
+				 std::vector<Slot> &slots);
+  static void add_slots(const google::protobuf::Descriptor *desc, const std::string &prefix,
+			std::vector<const google::protobuf::FieldDescriptor *> &path,
+			std::vector<Slot> &slots, std::string &def);
+
+  const Mapping & mapping(const std::string &name);
+  std::list<CLIPS::Fact::pointer> matching_facts(const Mapping &mapping,
+						 const CLIPS::Values &filter);
+  static void fill_message(google::protobuf::Message *msg, const Mapping &mapping,
+			   CLIPS::Fact::pointer &fact);
+
+ private:
+  CLIPS::Environment *clips_;
+  std::map<const google::protobuf::Descriptor *, Template> templates_;
+  std::map<std::string, Mapping> mappings_;
+};
+
+} // end namespace protobuf_clips
+
+#endif
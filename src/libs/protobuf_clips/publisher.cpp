@@ -0,0 +1,245 @@
+/***************************************************************************
+ *  publisher.cpp - periodic message publishing schedule
+ *
+ *  Created: Mon Oct 19 00:28:56 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <protobuf_clips/publisher.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace protobuf_clips {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+/** @class PeriodicPublisher <protobuf_clips/publisher.h>
+ * Schedule for periodically published message streams.
+ * Each stream has a period, and optionally a shorter burst period which
+ * is used for the first messages after the stream was added or its burst
+ * was restarted, e.g. to quickly distribute new information.
+ *
+ * Streams are kept in a hashed timer wheel, advancing the schedule only
+ * touches the slots of the elapsed ticks instead of all streams. The
+ * publisher only decides which streams are due, building and sending the
+ * messages is up to the caller, which reports back with done().
+ *
+ * The publisher has no clock of its own, the caller passes the current
+ * time to advance(). This way the schedule follows the time of the
+ * caller, e.g., the replay clock when replaying a game.
+ *
+ * The publisher is not thread-safe.
+ * @author agent
+ */
+
+/** Constructor.
+ * @param resolution length of a tick in seconds, periods are rounded up
+ * to full ticks
+ * @param num_slots number of slots of the timer wheel
+ */
+PeriodicPublisher::PeriodicPublisher(double resolution, unsigned int num_slots)
+  : resolution_(resolution), started_(false), start_(0.), current_tick_(0),
+    slots_(std::max(num_slots, 1u))
+{
+}
+
+
+/** Add a stream.
+ * The stream is due on the next call to advance().
+ * @param name name of the stream
+ * @param period period in seconds
+ * @param burst_period period in seconds for the first @p burst_count messages
+ * @param burst_count number of messages to publish with @p burst_period
+ * @exception std::runtime_error thrown if a stream of that name already exists
+ */
+void
+PeriodicPublisher::add_stream(const std::string &name, double period,
+			      double burst_period, unsigned int burst_count)
+{
+  if (streams_.find(name) != streams_.end()) {
+    throw std::runtime_error("Stream " + name + " already exists");
+  }
+
+  Stream &s = streams_[name];
+  s.name         = name;
+  s.period       = period;
+  s.burst_period = burst_period;
+  s.burst_count  = burst_count;
+  s.count        = 1;
+  s.seq          = 1;
+  s.scheduled    = false;
+  schedule(s, 0.);
+}
+
+
+/** Remove a stream.
+ * @param name name of the stream
+ */
+void
+PeriodicPublisher::remove_stream(const std::string &name)
+{
+  std::map<std::string, Stream>::iterator s = streams_.find(name);
+  if (s != streams_.end()) {
+    unschedule(s->second);
+    streams_.erase(s);
+  }
+}
+
+
+/** Check if stream exists.
+ * @param name name of the stream
+ * @return true if the stream exists, false otherwise
+ */
+bool
+PeriodicPublisher::has_stream(const std::string &name) const
+{
+  return streams_.find(name) != streams_.end();
+}
+
+
+/** Make a stream due immediately.
+ * @param name name of the stream
+ * @param restart_burst true to publish the next messages with the burst
+ * period again
+ */
+void
+PeriodicPublisher::trigger(const std::string &name, bool restart_burst)
+{
+  std::map<std::string, Stream>::iterator s = streams_.find(name);
+  if (s == streams_.end())  return;
+
+  if (restart_burst)  s->second.count = 1;
+  unschedule(s->second);
+  schedule(s->second, 0.);
+}
+
+
+/** Advance schedule.
+ * Streams which are due are taken out of the schedule, each of them must
+ * be passed to done() to be scheduled again. The first call starts the
+ * schedule, streams added so far are due right away.
+ * @param now current time in seconds, e.g., since the epoch
+ * @return names of due streams
+ */
+std::vector<std::string>
+PeriodicPublisher::advance(double now)
+{
+  std::vector<std::string> due;
+
+  if (! started_) {
+    start_   = now;
+    started_ = true;
+  }
+  // the first call is tick 1, streams added before are scheduled for it
+  uint64_t now_tick = 1 + (uint64_t)std::max(0., std::floor((now - start_) / resolution_));
+  if (now_tick <= current_tick_)  return due;
+
+  // each slot needs to be visited at most once
+  uint64_t num_ticks = std::min(now_tick - current_tick_, (uint64_t)slots_.size());
+  for (uint64_t t = now_tick - num_ticks + 1; t <= now_tick; ++t) {
+    std::list<Stream *> &slot = slots_[t % slots_.size()];
+    std::list<Stream *>::iterator i = slot.begin();
+    while (i != slot.end()) {
+      Stream *s = *i;
+      if (s->expires <= now_tick) {
+	i = slot.erase(i);
+	s->scheduled = false;
+	due.push_back(s->name);
+      } else {
+	++i;
+      }
+    }
+  }
+  current_tick_ = now_tick;
+
+  return due;
+}
+
+
+/** Get sequence number of a stream.
+ * @param name name of the stream
+ * @return sequence number for the next message, starting at 1, or 0 if
+ * the stream does not exist
+ */
+unsigned long
+PeriodicPublisher::seq(const std::string &name) const
+{
+  std::map<std::string, Stream>::const_iterator s = streams_.find(name);
+  return (s != streams_.end()) ? s->second.seq : 0;
+}
+
+
+/** Reschedule a stream after it has been due.
+ * @param name name of the stream
+ * @param published true if a message has been published, which advances
+ * the sequence number and burst, false if nothing was published, e.g.
+ * because there was nothing to publish at this time
+ */
+void
+PeriodicPublisher::done(const std::string &name, bool published)
+{
+  std::map<std::string, Stream>::iterator i = streams_.find(name);
+  if (i == streams_.end())  return;
+
+  Stream &s = i->second;
+  if (published) {
+    s.seq   += 1;
+    s.count += 1;
+  }
+  unschedule(s);
+  schedule(s, (s.count > s.burst_count) ? s.period : s.burst_period);
+}
+
+
+void
+PeriodicPublisher::schedule(Stream &s, double delay)
+{
+  uint64_t ticks = (uint64_t)std::max(1., std::ceil(delay / resolution_));
+  s.expires = current_tick_ + ticks;
+  std::list<Stream *> &slot = slots_[s.expires % slots_.size()];
+  s.slot_it = slot.insert(slot.end(), &s);
+  s.scheduled = true;
+}
+
+
+void
+PeriodicPublisher::unschedule(Stream &s)
+{
+  if (s.scheduled) {
+    slots_[s.expires % slots_.size()].erase(s.slot_it);
+    s.scheduled = false;
+  }
+}
+
+} // end namespace protobuf_clips
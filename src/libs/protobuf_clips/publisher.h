@@ -0,0 +1,93 @@
+/***************************************************************************
+ *  publisher.h - periodic message publishing schedule
+ *
+ *  Created: Mon Oct 19 00:28:56 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PROTOBUF_CLIPS_PUBLISHER_H_
+#define __PROTOBUF_CLIPS_PUBLISHER_H_
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace protobuf_clips {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+class PeriodicPublisher
+{
+ public:
+  PeriodicPublisher(double resolution = 0.01, unsigned int num_slots = 256);
+
+  void add_stream(const std::string &name, double period,
+		  double burst_period = 0., unsigned int burst_count = 0);
+  void remove_stream(const std::string &name);
+  bool has_stream(const std::string &name) const;
+  void trigger(const std::string &name, bool restart_burst = false);
+
+  std::vector<std::string> advance(double now);
+  unsigned long seq(const std::string &name) const;
+  void done(const std::string &name, bool published);
+
+ private:
+  /** Stream of periodically published messages. */
+  typedef struct Stream {
+    std::string   name;		///< stream name
+    double        period;	///< period after the burst
+    double        burst_period;	///< period during the burst
+    unsigned int  burst_count;	///< number of messages published with burst_period
+    unsigned int  count;	///< number of messages published since burst start
+    unsigned long seq;		///< sequence number of next message
+    uint64_t      expires;	///< tick at which the stream is due
+    bool          scheduled;	///< true if currently in the wheel
+    std::list<Stream *>::iterator slot_it;	///< position in wheel slot
+  } Stream;
+
+  void schedule(Stream &s, double delay);
+  void unschedule(Stream &s);
+
+ private:
+  double                           resolution_;
+  bool                             started_;
+  double                           start_;
+  uint64_t                         current_tick_;
+  std::vector<std::list<Stream *>> slots_;
+  std::map<std::string, Stream>    streams_;
+};
+
+} // end namespace protobuf_clips
+
+#endif
@@ -35,6 +35,7 @@
  */
 
 #include <protobuf_comm/client.h>
+#include <protobuf_comm/compression.h>
 
 #include <boost/lexical_cast.hpp>
 
@@ -50,12 +51,16 @@ namespace protobuf_comm {
  * Stream client for protobuf message transmission.
  * The client opens a TCP connection (IPv4) to a specified server and
  * send and receives messages to the remote.
+ * Optionally, the client re-establishes lost connections by itself and
+ * buffers messages sent in the meantime, see set_reconnect() and
+ * set_replay_buffer().
  * @author Tim Niemueller
  */
 
 /** Constructor. */
 ProtobufStreamClient::ProtobufStreamClient()
-  : resolver_(io_service_), socket_(io_service_), io_service_work_(io_service_)
+  : resolver_(io_service_), socket_(io_service_), io_service_work_(io_service_),
+    reconnect_timer_(io_service_)
 {
   message_register_ = new MessageRegister();
   own_message_register_ = true;
@@ -66,6 +71,10 @@ ProtobufStreamClient::ProtobufStreamClient()
   in_frame_header_size_ = sizeof(frame_header_t);
   in_frame_header_ = malloc(in_frame_header_size_);
   in_data_ = malloc(in_data_size_);
+  compression_codec_ = PB_COMPRESSION_NONE;
+  compression_threshold_ = 0;
+  subscribe_ = false;
+  init_reconnect();
   run_asio();
 }
 
@@ -75,7 +84,8 @@ ProtobufStreamClient::ProtobufStreamClient()
  * message creation.
  */
 ProtobufStreamClient::ProtobufStreamClient(std::vector<std::string> &proto_path)
-  : resolver_(io_service_), socket_(io_service_), io_service_work_(io_service_)
+  : resolver_(io_service_), socket_(io_service_), io_service_work_(io_service_),
+    reconnect_timer_(io_service_)
 {
   message_register_ = new MessageRegister(proto_path);
   own_message_register_ = true;
@@ -86,6 +96,10 @@ ProtobufStreamClient::ProtobufStreamClient(std::vector<std::string> &proto_path)
   frame_header_version_ = PB_FRAME_V2;
   in_frame_header_size_ = sizeof(frame_header_t);
   in_frame_header_ = malloc(in_frame_header_size_);
+  compression_codec_ = PB_COMPRESSION_NONE;
+  compression_threshold_ = 0;
+  subscribe_ = false;
+  init_reconnect();
   run_asio();
 }
 
@@ -97,7 +111,7 @@ ProtobufStreamClient::ProtobufStreamClient(std::vector<std::string> &proto_path)
 ProtobufStreamClient::ProtobufStreamClient(MessageRegister *mr,
 					   frame_header_version_t header_version)
   : resolver_(io_service_), socket_(io_service_), io_service_work_(io_service_),
-    message_register_(mr), own_message_register_(false),
+    reconnect_timer_(io_service_), message_register_(mr), own_message_register_(false),
     frame_header_version_(header_version)
 {
   connected_ = false;
@@ -110,6 +124,10 @@ ProtobufStreamClient::ProtobufStreamClient(MessageRegister *mr,
     in_frame_header_size_ = sizeof(frame_header_t);
   }
   in_frame_header_ = malloc(in_frame_header_size_);
+  compression_codec_ = PB_COMPRESSION_NONE;
+  compression_threshold_ = 0;
+  subscribe_ = false;
+  init_reconnect();
   run_asio();
 }
 
@@ -125,6 +143,55 @@ ProtobufStreamClient::~ProtobufStreamClient()
   if (own_message_register_) {
     delete message_register_;
   }
+  while (! replay_queue_.empty()) {
+    delete replay_queue_.front();
+    replay_queue_.pop_front();
+  }
+}
+
+
+/** Enable compression.
+ * The client announces the codec to the server after connecting. If the
+ * server supports it, messages larger than the threshold are compressed
+ * in both directions. Servers which do not know about compression will
+ * report a failure to receive the announcement but otherwise communicate
+ * normally. Must be called before connecting.
+ * @param codec codec to announce, one of PB_COMPRESSION_*
+ * @param threshold minimum size in bytes of messages to compress
+ */
+void
+ProtobufStreamClient::set_compression(int codec, size_t threshold)
+{
+  if (frame_header_version_ == PB_FRAME_V1) {
+    throw std::runtime_error("Compression support only available with V3+ frame header");
+  }
+  if (! compression_supported(codec)) {
+    throw std::runtime_error(std::string("Compression codec ") +
+			     compression_name_by_id(codec) + " not supported");
+  }
+  compression_codec_     = codec;
+  compression_threshold_ = threshold;
+}
+
+
+/** Subscribe to message types.
+ * After this call the server only sends messages of the given types to
+ * this client. The subscription replaces any previous one and is renewed
+ * automatically after reconnecting. Servers without subscription support
+ * (frame header V2 and earlier) ignore it and send all messages.
+ * @param types list of (component ID, message type) pairs to receive, an
+ * empty list subscribes to all messages
+ */
+void
+ProtobufStreamClient::subscribe(const std::vector<std::pair<uint16_t, uint16_t>> &types)
+{
+  if (frame_header_version_ == PB_FRAME_V1) {
+    throw std::runtime_error("Subscriptions only available with V3+ frame header");
+  }
+  std::lock_guard<std::mutex> lock(outbound_mutex_);
+  subscriptions_ = types;
+  subscribe_     = true;
+  if (connected_)  enqueue_locked(create_subscription_control());
 }
 
 
@@ -145,6 +212,13 @@ ProtobufStreamClient::run_asio()
 void
 ProtobufStreamClient::async_connect(const char *host, unsigned short port)
 {
+  {
+    std::lock_guard<std::mutex> lock(reconnect_mutex_);
+    connect_host_       = host;
+    connect_port_       = port;
+    connect_local_path_ = "";
+    disconnecting_      = false;
+  }
   ip::tcp::resolver::query query(host, boost::lexical_cast<std::string>(port));
   resolver_.async_resolve(query,
 			  boost::bind(&ProtobufStreamClient::handle_resolve, this,
@@ -154,6 +228,27 @@ ProtobufStreamClient::async_connect(const char *host, unsigned short port)
 }
 
 
+/** Asynchronous connect to a local socket.
+ * Connect to a server on the same host through a Unix domain socket,
+ * cf. ProtobufStreamServer::listen_local(). Apart from the connection
+ * establishment the client behaves exactly as for TCP connections.
+ * The method does not block.
+ * @param socket_path file system path of the server's local socket
+ */
+void
+ProtobufStreamClient::async_connect_local(const char *socket_path)
+{
+  {
+    std::lock_guard<std::mutex> lock(reconnect_mutex_);
+    connect_local_path_ = socket_path;
+    disconnecting_      = false;
+  }
+  socket_.async_connect(local::stream_protocol::endpoint(socket_path),
+			boost::bind(&ProtobufStreamClient::handle_connect, this,
+				    boost::asio::placeholders::error));
+}
+
+
 void
 ProtobufStreamClient::handle_resolve(const boost::system::error_code& err,
 				     ip::tcp::resolver::iterator endpoint_iterator)
@@ -161,16 +256,19 @@ ProtobufStreamClient::handle_resolve(const boost::system::error_code& err,
   if (! err) {
     // Attempt a connection to each endpoint in the list until we
     // successfully establish a connection.
+    connect_endpoints_.clear();
+    for (; endpoint_iterator != ip::tcp::resolver::iterator(); ++endpoint_iterator) {
+      connect_endpoints_.push_back(endpoint_iterator->endpoint());
+    }
 #if BOOST_ASIO_VERSION > 100409
-    boost::asio::async_connect(socket_, endpoint_iterator,
+    boost::asio::async_connect(socket_, connect_endpoints_.begin(), connect_endpoints_.end(),
 #else
-    socket_.async_connect(*endpoint_iterator,
+    socket_.async_connect(connect_endpoints_.front(),
 #endif
 			       boost::bind(&ProtobufStreamClient::handle_connect, this,
 					   boost::asio::placeholders::error));
   } else {
-    disconnect_nosig();
-    sig_disconnected_(err);
+    handle_disconnect(err);
   }
 }
 
@@ -178,22 +276,191 @@ void
 ProtobufStreamClient::handle_connect(const boost::system::error_code &err)
 {
   if (! err) {
-    connected_ = true;
+    {
+      std::lock_guard<std::mutex> lock(reconnect_mutex_);
+      reconnect_attempts_ = 0;
+    }
     start_recv();
+    {
+      // compression must be negotiated anew for each connection. Control
+      // frames and replayed messages are queued before marking the client
+      // connected, so that no concurrent send() can overtake them.
+      std::lock_guard<std::mutex> lock(outbound_mutex_);
+      compressor_.reset();
+      if (compression_codec_ != PB_COMPRESSION_NONE) {
+	enqueue_locked(create_compression_control());
+      }
+      if (subscribe_)  enqueue_locked(create_subscription_control());
+      for (QueueEntry *entry : replay_queue_)  enqueue_locked(entry);
+      replay_queue_.clear();
+      connected_ = true;
+    }
     sig_connected_();
   } else {
-    disconnect_nosig();
-    sig_disconnected_(err);
+    handle_disconnect(err);
+  }
+}
+
+/** Handle loss of connection or failure to connect.
+ * Messages still queued for sending are moved to the replay buffer (or
+ * dropped if there is none). If enabled, a reconnect is scheduled.
+ * @param error error that caused the disconnect
+ */
+void
+ProtobufStreamClient::handle_disconnect(const boost::system::error_code &error)
+{
+  disconnect_nosig();
+  {
+    std::lock_guard<std::mutex> lock(outbound_mutex_);
+    connected_ = false;
+    while (! outbound_queue_.empty()) {
+      replay_push(outbound_queue_.front());
+      outbound_queue_.pop();
+    }
+    outbound_active_ = false;
+  }
+  sig_disconnected_(error);
+
+  std::lock_guard<std::mutex> lock(reconnect_mutex_);
+  if (reconnect_ && ! reconnect_pending_ && ! disconnecting_) {
+    // exponential backoff with jitter, avoids all clients of a restarted
+    // server reconnecting at the same time
+    unsigned int delay = reconnect_max_ms_;
+    if (reconnect_attempts_ < 16) {
+      delay = std::min(reconnect_max_ms_, reconnect_min_ms_ << reconnect_attempts_);
+    }
+    std::uniform_int_distribution<unsigned int> jitter(delay / 2, delay);
+    reconnect_attempts_ += 1;
+    reconnect_pending_   = true;
+    reconnect_timer_.expires_from_now(boost::posix_time::milliseconds(jitter(rng_)));
+    reconnect_timer_.async_wait(boost::bind(&ProtobufStreamClient::handle_reconnect_timer,
+					    this, boost::asio::placeholders::error));
+  }
+}
+
+
+void
+ProtobufStreamClient::handle_reconnect_timer(const boost::system::error_code &error)
+{
+  std::string host, local_path;
+  unsigned short port;
+  {
+    std::lock_guard<std::mutex> lock(reconnect_mutex_);
+    reconnect_pending_ = false;
+    if (error || ! reconnect_ || disconnecting_)  return;
+    host       = connect_host_;
+    port       = connect_port_;
+    local_path = connect_local_path_;
+  }
+  if (local_path.empty()) {
+    async_connect(host.c_str(), port);
+  } else {
+    async_connect_local(local_path.c_str());
+  }
+}
+
+
+void
+ProtobufStreamClient::init_reconnect()
+{
+  reconnect_          = false;
+  reconnect_pending_  = false;
+  disconnecting_      = false;
+  reconnect_min_ms_   = 500;
+  reconnect_max_ms_   = 30000;
+  reconnect_attempts_ = 0;
+  connect_port_       = 0;
+  replay_max_         = 0;
+  replay_dropped_     = 0;
+  rng_.seed(std::random_device()());
+}
+
+
+/** Enable automatic reconnection.
+ * If enabled, the client tries to re-establish the connection to the
+ * host given to async_connect() (or async_connect_local()) whenever the
+ * connection is lost or could not be established. The delay between
+ * attempts doubles with each failed attempt, starting at @p min_delay_ms
+ * up to @p max_delay_ms, and is randomly shortened by up to half so that
+ * many clients do not reconnect in lock-step. The disconnected signal is
+ * still emitted for each lost connection or failed attempt.
+ * @param enable true to enable reconnecting, false to disable
+ * @param min_delay_ms delay before the first reconnect attempt in ms
+ * @param max_delay_ms maximum delay between reconnect attempts in ms
+ */
+void
+ProtobufStreamClient::set_reconnect(bool enable, unsigned int min_delay_ms,
+				    unsigned int max_delay_ms)
+{
+  std::lock_guard<std::mutex> lock(reconnect_mutex_);
+  reconnect_        = enable;
+  reconnect_min_ms_ = std::max(1u, min_delay_ms);
+  reconnect_max_ms_ = std::max(reconnect_min_ms_, max_delay_ms);
+}
+
+
+/** Set size of replay buffer.
+ * Messages sent while not connected are kept in the replay buffer and
+ * sent after the connection has been (re-)established, instead of
+ * throwing an exception. If the buffer is full the oldest message is
+ * dropped. Messages queued but not yet written when the connection was
+ * lost are kept as well, a message in transmission at that time is lost.
+ * @param max_messages maximum number of buffered messages, 0 disables
+ * the buffer
+ */
+void
+ProtobufStreamClient::set_replay_buffer(size_t max_messages)
+{
+  std::lock_guard<std::mutex> lock(outbound_mutex_);
+  replay_max_ = max_messages;
+  while (replay_queue_.size() > replay_max_) {
+    delete replay_queue_.front();
+    replay_queue_.pop_front();
+    replay_dropped_ += 1;
   }
 }
 
+
+/** Get number of messages dropped from the replay buffer.
+ * @return number of messages dropped because the replay buffer was full,
+ * or because it was disabled when the connection was lost
+ */
+size_t
+ProtobufStreamClient::replay_dropped()
+{
+  std::lock_guard<std::mutex> lock(outbound_mutex_);
+  return replay_dropped_;
+}
+
+
+/** Put an entry into the replay buffer.
+ * The outbound mutex must be locked.
+ * @param entry entry to buffer, ownership is taken
+ */
+void
+ProtobufStreamClient::replay_push(QueueEntry *entry)
+{
+  if (replay_max_ == 0) {
+    delete entry;
+    replay_dropped_ += 1;
+    return;
+  }
+  if (replay_queue_.size() >= replay_max_) {
+    delete replay_queue_.front();
+    replay_queue_.pop_front();
+    replay_dropped_ += 1;
+  }
+  replay_queue_.push_back(entry);
+}
+
+
 void
 ProtobufStreamClient::disconnect_nosig()
 {
 	io_service_.dispatch([this](){
 			boost::system::error_code err;
 			if (this->socket_.is_open()) {
-				this->socket_.shutdown(ip::tcp::socket::shutdown_both, err);
+				this->socket_.shutdown(socket_base::shutdown_both, err);
 				this->socket_.close();
 			}
 			this->connected_ = false;
@@ -201,10 +468,17 @@ ProtobufStreamClient::disconnect_nosig()
 }
 
 
-/** Disconnect from remote host. */
+/** Disconnect from remote host.
+ * This also stops reconnecting until the next call to async_connect().
+ */
 void
 ProtobufStreamClient::disconnect()
 {
+  {
+    std::lock_guard<std::mutex> lock(reconnect_mutex_);
+    disconnecting_ = true;
+  }
+  io_service_.dispatch([this]() { this->reconnect_timer_.cancel(); });
   disconnect_nosig();
   sig_disconnected_(boost::system::error_code());
 }
@@ -237,8 +511,7 @@ ProtobufStreamClient::handle_read_header(const boost::system::error_code& error)
 	in_data_size_ = to_read;
 	in_data_ = new_data;
       } else {
-	disconnect_nosig();
-	sig_disconnected_(errc::make_error_code(errc::not_enough_memory));
+	handle_disconnect(errc::make_error_code(errc::not_enough_memory));
       }
     }
     // setup new read
@@ -247,8 +520,7 @@ ProtobufStreamClient::handle_read_header(const boost::system::error_code& error)
 			    boost::bind(&ProtobufStreamClient::handle_read_message,
 					this, boost::asio::placeholders::error));
   } else {
-    disconnect_nosig();
-    sig_disconnected_(error);
+    handle_disconnect(error);
   }
 }
 
@@ -280,22 +552,88 @@ ProtobufStreamClient::handle_read_message(const boost::system::error_code& error
 
     uint16_t comp_id   = ntohs(message_header.component_id);
     uint16_t msg_type  = ntohs(message_header.msg_type);
-    try {
-      std::shared_ptr<google::protobuf::Message> m =
-	message_register_->deserialize(frame_header, message_header, data);
+    if (frame_header.header_version >= PB_FRAME_V3 && comp_id == PB_CONTROL_COMP_ID) {
+      handle_control(msg_type, frame_header);
+    } else {
+      try {
+	std::shared_ptr<google::protobuf::Message> m =
+	  message_register_->deserialize(frame_header, message_header, data);
 
-      sig_rcvd_(comp_id, msg_type, m);
-    } catch (std::runtime_error &e) {
-      sig_recv_failed_(comp_id, msg_type, e.what());
+	sig_rcvd_(comp_id, msg_type, m);
+      } catch (std::runtime_error &e) {
+	sig_recv_failed_(comp_id, msg_type, e.what());
+      }
     }
 
     start_recv();
   } else {
-    disconnect_nosig();
-    sig_disconnected_(error);
+    handle_disconnect(error);
+  }
+}
+
+void
+ProtobufStreamClient::handle_control(uint16_t msg_type, frame_header_t &frame_header)
+{
+  if (msg_type == PB_CONTROL_MSG_COMPRESSION) {
+    // server replied with the codec it agreed to use
+    std::lock_guard<std::mutex> lock(outbound_mutex_);
+    if (! compressor_ && frame_header.compression != PB_COMPRESSION_NONE &&
+	frame_header.compression == compression_codec_)
+    {
+      compressor_ = std::make_shared<BufferCompressor>(compression_codec_,
+						       compression_threshold_);
+    }
   }
 }
 
+
+/** Create compression negotiation control frame.
+ * @return queue entry to send
+ */
+QueueEntry *
+ProtobufStreamClient::create_compression_control()
+{
+  QueueEntry *entry = new QueueEntry();
+  entry->frame_header.header_version = PB_FRAME_V3;
+  entry->frame_header.compression    = compression_codec_;
+  entry->frame_header.payload_size   = htonl(sizeof(message_header_t));
+  entry->message_header.component_id = htons(PB_CONTROL_COMP_ID);
+  entry->message_header.msg_type     = htons(PB_CONTROL_MSG_COMPRESSION);
+
+  entry->buffers[0] = boost::asio::buffer(&entry->frame_header, sizeof(frame_header_t));
+  entry->buffers[1] = boost::asio::buffer(&entry->message_header, sizeof(message_header_t));
+  entry->buffers[2] = boost::asio::const_buffer();
+
+  return entry;
+}
+
+
+/** Create subscription control frame.
+ * The outbound mutex must be held when calling this method.
+ * @return queue entry to send
+ */
+QueueEntry *
+ProtobufStreamClient::create_subscription_control()
+{
+  QueueEntry *entry = new QueueEntry();
+  for (const std::pair<uint16_t, uint16_t> &t : subscriptions_) {
+    uint16_t type[2] = { htons(t.first), htons(t.second) };
+    entry->serialized_message.append((char *)type, sizeof(type));
+  }
+  entry->frame_header.header_version = PB_FRAME_V3;
+  entry->frame_header.payload_size   =
+    htonl(sizeof(message_header_t) + entry->serialized_message.size());
+  entry->message_header.component_id = htons(PB_CONTROL_COMP_ID);
+  entry->message_header.msg_type     = htons(PB_CONTROL_MSG_SUBSCRIBE);
+
+  entry->buffers[0] = boost::asio::buffer(&entry->frame_header, sizeof(frame_header_t));
+  entry->buffers[1] = boost::asio::buffer(&entry->message_header, sizeof(message_header_t));
+  entry->buffers[2] = boost::asio::buffer(entry->serialized_message);
+
+  return entry;
+}
+
+
 /** Check whether all outbound messages have been sent.
  * @return true if outbound sending is still active, false otherwise
  */
@@ -327,8 +665,7 @@ ProtobufStreamClient::handle_write(const boost::system::error_code& error,
       outbound_active_ = false;
     }
   } else {
-    disconnect_nosig();
-    sig_disconnected_(error);
+    handle_disconnect(error);
   }
 }
 
@@ -342,8 +679,11 @@ void
 ProtobufStreamClient::send(uint16_t component_id, uint16_t msg_type,
 			   google::protobuf::Message &m)
 {
-  if (!connected_) {
-    throw std::runtime_error("Cannot send while not connected");
+  {
+    std::lock_guard<std::mutex> lock(outbound_mutex_);
+    if (!connected_ && replay_max_ == 0) {
+      throw std::runtime_error("Cannot send while not connected");
+    }
   }
 
   QueueEntry *entry = new QueueEntry();
@@ -351,6 +691,16 @@ ProtobufStreamClient::send(uint16_t component_id, uint16_t msg_type,
 			       entry->frame_header, entry->message_header,
 			       entry->serialized_message);
 
+  // the copy keeps the compressor alive if it is replaced meanwhile
+  std::shared_ptr<BufferCompressor> compressor;
+  {
+    std::lock_guard<std::mutex> lock(outbound_mutex_);
+    compressor = compressor_;
+  }
+  if (compressor) {
+    compressor->compress(entry->frame_header, entry->serialized_message);
+  }
+
   if (frame_header_version_ == PB_FRAME_V1) {
     entry->frame_header_v1.component_id = entry->message_header.component_id;
     entry->frame_header_v1.msg_type     = entry->message_header.msg_type;
@@ -364,8 +714,19 @@ ProtobufStreamClient::send(uint16_t component_id, uint16_t msg_type,
     entry->buffers[1] = boost::asio::buffer(&entry->message_header, sizeof(message_header_t));
   }
   entry->buffers[2] = boost::asio::buffer(entry->serialized_message);
- 
+
   std::lock_guard<std::mutex> lock(outbound_mutex_);
+  if (connected_) {
+    enqueue_locked(entry);
+  } else {
+    replay_push(entry);
+  }
+}
+
+
+void
+ProtobufStreamClient::enqueue_locked(QueueEntry *entry)
+{
   if (outbound_active_) {
     outbound_queue_.push(entry);
   } else {
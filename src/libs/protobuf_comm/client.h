@@ -45,7 +45,11 @@
 #include <boost/signals2.hpp>
 #include <google/protobuf/message.h>
 #include <queue>
+#include <deque>
+#include <random>
 #include <string>
+#include <vector>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <cstdint>
@@ -55,6 +59,7 @@ namespace protobuf_comm {
 }
 #endif
 
+class BufferCompressor;
 
 class ProtobufStreamClient
 {
@@ -71,6 +76,7 @@ class ProtobufStreamClient
   { return *message_register_; }
 
   void async_connect(const char *host, unsigned short port);
+  void async_connect_local(const char *socket_path);
   void disconnect();
 
   /** Check if client is connected.
@@ -87,6 +93,14 @@ class ProtobufStreamClient
 
   bool outbound_done();
 
+  void set_compression(int codec, size_t threshold = 256);
+  void subscribe(const std::vector<std::pair<uint16_t, uint16_t>> &types);
+
+  void set_reconnect(bool enable, unsigned int min_delay_ms = 500,
+		     unsigned int max_delay_ms = 30000);
+  void set_replay_buffer(size_t max_messages);
+  size_t replay_dropped();
+
   /** Signal that is invoked when a message has been received.
    * @return signal
    */
@@ -120,19 +134,29 @@ class ProtobufStreamClient
   void handle_resolve(const boost::system::error_code& err,
 		      boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
   void handle_connect(const boost::system::error_code& err);
+  void handle_disconnect(const boost::system::error_code& error);
+  void handle_reconnect_timer(const boost::system::error_code& error);
+  void init_reconnect();
+  void replay_push(QueueEntry *entry);
   void handle_write(const boost::system::error_code& error,
 		    size_t /*bytes_transferred*/, QueueEntry *entry);
   void start_recv();
   void handle_read_header(const boost::system::error_code& error);
   void handle_read_message(const boost::system::error_code& error);
+  void handle_control(uint16_t msg_type, frame_header_t &frame_header);
+  QueueEntry * create_compression_control();
+  QueueEntry * create_subscription_control();
+  void enqueue_locked(QueueEntry *entry);
 
  private: // members
   bool connected_;
   std::mutex                      asio_mutex_;
   boost::asio::io_service         io_service_;
   boost::asio::ip::tcp::resolver  resolver_;
-  boost::asio::ip::tcp::socket    socket_;
+  boost::asio::generic::stream_protocol::socket socket_;
   boost::asio::io_service::work   io_service_work_;
+  boost::asio::deadline_timer     reconnect_timer_;
+  std::vector<boost::asio::generic::stream_protocol::endpoint> connect_endpoints_;
 
   boost::signals2::signal<void (uint16_t, uint16_t,
 				std::shared_ptr<google::protobuf::Message>)>  sig_rcvd_;
@@ -155,6 +179,29 @@ class ProtobufStreamClient
   bool             own_message_register_;
 
   frame_header_version_t frame_header_version_;
+
+  int               compression_codec_;
+  size_t            compression_threshold_;
+  std::shared_ptr<BufferCompressor> compressor_;
+
+  bool                                       subscribe_;
+  std::vector<std::pair<uint16_t, uint16_t>> subscriptions_;
+
+  std::mutex     reconnect_mutex_;
+  bool           reconnect_;
+  bool           reconnect_pending_;
+  bool           disconnecting_;
+  unsigned int   reconnect_min_ms_;
+  unsigned int   reconnect_max_ms_;
+  unsigned int   reconnect_attempts_;
+  std::string    connect_host_;
+  unsigned short connect_port_;
+  std::string    connect_local_path_;
+  std::minstd_rand rng_;
+
+  std::deque<QueueEntry *> replay_queue_;
+  size_t                   replay_max_;
+  size_t                   replay_dropped_;
 };
 
 } // end namespace protobuf_comm
@@ -0,0 +1,232 @@
+/***************************************************************************
+ *  compression.cpp - Protobuf stream protocol - compression utils
+ *
+ *  Created: Sun Oct 18 23:46:11 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <protobuf_comm/compression.h>
+
+#include <stdexcept>
+#include <cstring>
+#include <arpa/inet.h>
+#ifdef HAVE_LIBZ
+#  include <zlib.h>
+#endif
+
+namespace protobuf_comm {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+/// Maximum size of decompressed data, guards against corrupt frames
+#define PB_COMPRESSION_MAX_PLAIN_SIZE (64 * 1024 * 1024)
+
+/** @class BufferCompressor <protobuf_comm/compression.h>
+ * Compress message data of outgoing frames.
+ * Data is only compressed if it exceeds a given threshold and if the
+ * compressed data is actually smaller than the original. In that case
+ * the frame header is turned into a V3 header indicating the codec.
+ * @author agent
+ */
+
+/** Constructor.
+ * @param codec codec to use, one of PB_COMPRESSION_*
+ * @param threshold minimum size in bytes of data to compress, smaller
+ * messages are sent as-is since the overhead does not pay off
+ */
+BufferCompressor::BufferCompressor(int codec, size_t threshold)
+  : codec_(codec), threshold_(threshold)
+{
+  if (! compression_supported(codec)) {
+    throw std::runtime_error(std::string("Compression codec ") +
+			     compression_name_by_id(codec) + " not supported");
+  }
+}
+
+
+/** Compress frame data.
+ * @param frame_header frame header of message, header version, codec,
+ * and payload size are updated if the data is compressed
+ * @param data serialized message data, replaced by the compressed data
+ * if compression was applied
+ * @return true if the data has been compressed, false if it was left as-is
+ */
+bool
+BufferCompressor::compress(frame_header_t &frame_header, std::string &data)
+{
+  if (codec_ == PB_COMPRESSION_NONE || data.size() < threshold_)  return false;
+
+  std::string compressed;
+  compress_buffer(codec_, data, compressed);
+  if (compressed.size() >= data.size())  return false;
+
+  data.swap(compressed);
+  frame_header.header_version = PB_FRAME_V3;
+  frame_header.compression    = codec_;
+  frame_header.payload_size   = htonl(sizeof(message_header_t) + data.size());
+  return true;
+}
+
+
+/** Compress a buffer.
+ * The compressed buffer is prefixed with the size of the plain data
+ * as 32 bit unsigned integer in network byte order.
+ * @param codec codec to use, one of PB_COMPRESSION_*
+ * @param plain data to compress
+ * @param compressed upon return contains the compressed data
+ */
+void
+compress_buffer(int codec, const std::string &plain, std::string &compressed)
+{
+  switch (codec) {
+#ifdef HAVE_LIBZ
+  case PB_COMPRESSION_ZLIB:
+    {
+      uLongf comp_size = compressBound(plain.size());
+      compressed.resize(sizeof(uint32_t) + comp_size);
+      uint32_t plain_size = htonl(plain.size());
+      memcpy(&compressed[0], &plain_size, sizeof(uint32_t));
+      if (compress2((Bytef *)&compressed[sizeof(uint32_t)], &comp_size,
+		    (const Bytef *)plain.data(), plain.size(), Z_BEST_SPEED) != Z_OK)
+      {
+	throw std::runtime_error("Failed to compress buffer");
+      }
+      compressed.resize(sizeof(uint32_t) + comp_size);
+    }
+    break;
+#endif
+
+  default:
+    throw std::runtime_error("Unsupported compression codec");
+  }
+}
+
+
+/** Decompress a buffer.
+ * @param codec codec the data has been compressed with
+ * @param data compressed data as created by compress_buffer()
+ * @param data_size size in bytes of @p data
+ * @param plain upon return contains the decompressed data
+ * @exception std::runtime_error thrown if the codec is not supported or
+ * if the data is corrupt
+ */
+void
+decompress_buffer(int codec, const void *data, size_t data_size, std::string &plain)
+{
+  if (data_size < sizeof(uint32_t)) {
+    throw std::runtime_error("Compressed buffer too short");
+  }
+  uint32_t plain_size;
+  memcpy(&plain_size, data, sizeof(uint32_t));
+  plain_size = ntohl(plain_size);
+  if (plain_size > PB_COMPRESSION_MAX_PLAIN_SIZE) {
+    throw std::runtime_error("Compressed buffer exceeds maximum size");
+  }
+
+  switch (codec) {
+#ifdef HAVE_LIBZ
+  case PB_COMPRESSION_ZLIB:
+    {
+      plain.resize(plain_size);
+      uLongf out_size = plain_size;
+      if (uncompress((Bytef *)&plain[0], &out_size,
+		     (const Bytef *)data + sizeof(uint32_t),
+		     data_size - sizeof(uint32_t)) != Z_OK || out_size != plain_size)
+      {
+	throw std::runtime_error("Failed to decompress buffer");
+      }
+    }
+    break;
+#endif
+
+  default:
+    throw std::runtime_error("Unsupported compression codec");
+  }
+}
+
+
+/** Check if codec is supported.
+ * @param codec codec ID, one of PB_COMPRESSION_*
+ * @return true if data can be (de)compressed with the given codec
+ */
+bool
+compression_supported(int codec)
+{
+  switch (codec) {
+  case PB_COMPRESSION_NONE:
+    return true;
+#ifdef HAVE_LIBZ
+  case PB_COMPRESSION_ZLIB:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+
+/** Get codec name for PB_COMPRESSION_* constants.
+ * @param codec codec ID
+ * @return codec name
+ */
+const char *
+compression_name_by_id(int codec)
+{
+  switch (codec) {
+  case PB_COMPRESSION_NONE:
+    return "none";
+  case PB_COMPRESSION_ZLIB:
+    return "zlib";
+  default:
+    throw std::runtime_error("Unknown compression codec");
+  }
+}
+
+
+/** Get codec ID by name.
+ * @param codec codec name
+ * @return codec ID, one of PB_COMPRESSION_*
+ */
+int
+compression_name_to_id(const char *codec)
+{
+  if (strcmp(codec, "none") == 0) {
+    return PB_COMPRESSION_NONE;
+  } else if (strcmp(codec, "zlib") == 0) {
+    return PB_COMPRESSION_ZLIB;
+  } else {
+    throw std::runtime_error("Unknown compression codec");
+  }
+}
+
+
+} // end namespace protobuf_comm
@@ -0,0 +1,79 @@
+/***************************************************************************
+ *  compression.h - Protobuf stream protocol - compression utils
+ *
+ *  Created: Sun Oct 18 23:46:11 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PROTOBUF_COMM_COMPRESSION_H_
+#define __PROTOBUF_COMM_COMPRESSION_H_
+
+#include <protobuf_comm/frame_header.h>
+
+#include <string>
+#include <cstddef>
+
+namespace protobuf_comm {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+class BufferCompressor {
+ public:
+  BufferCompressor(int codec = PB_COMPRESSION_ZLIB, size_t threshold = 256);
+
+  bool compress(frame_header_t &frame_header, std::string &data);
+
+  /** Get codec ID.
+   * @return codec ID, one of PB_COMPRESSION_* */
+  int codec() const
+  { return codec_; }
+
+  /** Get compression threshold.
+   * @return minimum size in bytes of data to compress */
+  size_t threshold() const
+  { return threshold_; }
+
+ private:
+  int    codec_;
+  size_t threshold_;
+};
+
+void compress_buffer(int codec, const std::string &plain, std::string &compressed);
+void decompress_buffer(int codec, const void *data, size_t data_size, std::string &plain);
+
+bool         compression_supported(int codec);
+const char * compression_name_by_id(int codec);
+int          compression_name_to_id(const char *codec);
+
+} // end namespace protobuf_comm
+
+#endif
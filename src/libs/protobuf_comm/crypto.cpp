@@ -266,6 +266,36 @@ BufferDecryptor::decrypt(int cipher, const void *enc, size_t enc_size, void *pla
 }
 
 
+/** Decrypt a buffer in place.
+ * The plain text overwrites the cipher text in @p buffer, no separate
+ * output buffer is required.
+ * @param cipher cipher ID
+ * @param buffer encrypted buffer, contains plain text data on return
+ * @param size number of bytes in @p buffer
+ * @param plain upon return points to the start of the plain text data
+ * within @p buffer (i.e., after the initialization vector)
+ * @return number of plain text bytes starting at @p plain
+ */
+size_t
+BufferDecryptor::decrypt(int cipher, void *buffer, size_t size, void **plain)
+{
+#ifdef HAVE_LIBCRYPTO
+  const EVP_CIPHER *evp_cipher = cipher_by_id(cipher);
+  const size_t iv_size = EVP_CIPHER_iv_length(evp_cipher);
+  if (size < iv_size) {
+    throw std::runtime_error("Encrypted buffer too short");
+  }
+
+  // decrypting exactly in place (output == input) is supported by
+  // OpenSSL, the IV is copied to the cipher context on initialization
+  *plain = (unsigned char *)buffer + iv_size;
+  return decrypt(cipher, buffer, size, *plain, size - iv_size);
+#else
+  throw std::runtime_error("Decryption support not available");
+#endif
+}
+
+
 /** Get cipher name for PB_ENCRYPTION_* constants.
  * @param cipher cipher ID
  * @return string representing the cipher
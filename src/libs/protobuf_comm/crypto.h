@@ -79,6 +79,7 @@ class BufferDecryptor {
   ~BufferDecryptor();
 
   size_t decrypt(int cipher, const void *enc, size_t enc_size, void *plain, size_t plain_size);
+  size_t decrypt(int cipher, void *buffer, size_t size, void **plain);
 
  private:
   void generate_key(int cipher);
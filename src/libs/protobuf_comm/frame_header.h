@@ -52,14 +52,29 @@ namespace protobuf_comm {
 #define PB_ENCRYPTION_AES_256_ECB  0x03
 #define PB_ENCRYPTION_AES_256_CBC  0x04
 
+#define PB_COMPRESSION_NONE        0x00
+#define PB_COMPRESSION_ZLIB        0x01
+
+/** Component ID of protocol control frames (V3+). */
+#define PB_CONTROL_COMP_ID             0
+/** Control message type to announce the accepted compression codec (V3+). */
+#define PB_CONTROL_MSG_COMPRESSION     1
+/** Control message type to subscribe to message types (V3+). The payload
+ * is a list of (component ID, message type) pairs of two uint16_t each in
+ * network byte order, an empty list subscribes to all messages. */
+#define PB_CONTROL_MSG_SUBSCRIBE       2
+
 /** Network frame header version to use.
  * V1 is the old version which for example is required to communicate with the
  * LLSF Referee Box before RC2014
  * V2 supports data encryption.
+ * V3 additionally supports payload compression. Frames which are not
+ * compressed are sent with a V2 header and can be read by V2 peers.
  */
 typedef enum {
   PB_FRAME_V1 = 1,	///< Version 1
-  PB_FRAME_V2 = 2	///< Version 2
+  PB_FRAME_V2 = 2,	///< Version 2
+  PB_FRAME_V3 = 3	///< Version 3
 } frame_header_version_t;
 
 /** Network framing header.
@@ -68,7 +83,10 @@ typedef enum {
  * network byte order (big endian). The encryption type can be set if
  * encryption is used. If the mode requires an initialization vector
  * (IV) it is appended directly after the frame header (and not
- * counted in the payload size).
+ * counted in the payload size). Since V3 the compression codec can be
+ * set if the message data (following the message header) is compressed.
+ * The field is undefined for earlier versions and must be ignored.
+ * Compression is applied before encryption.
  * @author Tim Niemueller
  */
 typedef struct {
@@ -76,8 +94,8 @@ typedef struct {
   uint8_t  header_version;
   /// One of PB_ENCRYPTION_*
   uint8_t  cipher;
-  /// reserved for future use
-  uint8_t  reserved_2;
+  /// One of PB_COMPRESSION_* (V3+)
+  uint8_t  compression;
   /// reserved for future use
   uint8_t  reserved_3;
   /// payload size in bytes
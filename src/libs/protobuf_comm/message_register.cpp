@@ -35,6 +35,7 @@
  */
 
 #include <protobuf_comm/message_register.h>
+#include <protobuf_comm/compression.h>
 
 #include <google/protobuf/compiler/importer.h>
 #include <google/protobuf/dynamic_message.h>
@@ -237,6 +238,22 @@ MessageRegister::new_message_for(uint16_t component_id, uint16_t msg_type)
 }
 
 
+/** Get registered message types.
+ * @return full names of all registered message types
+ */
+std::list<std::string>
+MessageRegister::message_types()
+{
+  std::lock_guard<std::mutex> lock(maps_mutex_);
+  std::list<std::string> rv;
+  TypeNameMap::iterator t;
+  for (t = message_by_typename_.begin(); t != message_by_typename_.end(); ++t) {
+    rv.push_back(t->first);
+  }
+  return rv;
+}
+
+
 /** Create a new message instance.
  * @param full_name full message type name, i.e. the message type name
  * possibly with a package name prefix.
@@ -293,7 +310,8 @@ MessageRegister::serialize(uint16_t component_id, uint16_t msg_type,
  * @param message_header incoming message's message header
  * @param data incoming message's data buffer
  * @return new instance of a protobuf message type that has been registered
- * for the given type.
+ * for the given type. If the frame header indicates compression (V3+), the
+ * data is decompressed before parsing.
  * @exception std::runtime_error thrown if anything goes wrong when
  * deserializing the message, e.g. if no protobuf message has been registered
  * for the given component ID and message type.
@@ -307,6 +325,18 @@ MessageRegister::deserialize(frame_header_t &frame_header, message_header_t &mes
 
   std::shared_ptr<google::protobuf::Message> m =
     new_message_for(comp_id, msg_type);
+
+  if (frame_header.header_version >= PB_FRAME_V3 &&
+      frame_header.compression != PB_COMPRESSION_NONE)
+  {
+    std::string plain;
+    decompress_buffer(frame_header.compression, data, data_size, plain);
+    if (! m->ParseFromString(plain)) {
+      throw std::runtime_error("Failed to parse message");
+    }
+    return m;
+  }
+
   if (! m->ParseFromArray(data, data_size)) {
     throw std::runtime_error("Failed to parse message");
   }
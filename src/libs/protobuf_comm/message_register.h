@@ -46,6 +46,7 @@
 #include <boost/thread/mutex.hpp>
 
 #include <map>
+#include <list>
 #include <cstdint>
 #include <stdexcept>
 #include <memory>
@@ -119,6 +120,8 @@ class MessageRegister : boost::noncopyable
 
   void remove_message_type(uint16_t component_id, uint16_t msg_type);
 
+  std::list<std::string> message_types();
+
   std::shared_ptr<google::protobuf::Message>
   new_message_for(uint16_t component_id, uint16_t msg_type);
 
@@ -35,6 +35,7 @@
 
 #include <protobuf_comm/peer.h>
 #include <protobuf_comm/crypto.h>
+#include <protobuf_comm/compression.h>
 
 #include <boost/lexical_cast.hpp>
 #include <ifaddrs.h>
@@ -50,7 +51,8 @@ namespace protobuf_comm {
 /** @class ProtobufBroadcastPeer <protobuf_comm/peer.h>
  * Communicate by broadcasting protobuf messages.
  * This class allows to communicate via UDP by broadcasting messages to the
- * network.
+ * network. Alternatively, the peer can send to and receive from an IP
+ * multicast group, cf. setup_multicast().
  * @author Tim Niemueller
  */
 
@@ -249,11 +251,15 @@ ProtobufBroadcastPeer::ctor(const std::string &address, unsigned int send_to_por
   crypto_       = false;
   crypto_enc_   = NULL;
   crypto_dec_   = NULL;
+  compressor_   = NULL;
+  multicast_    = false;
+  rate_limit_rate_  = 0.;
+  rate_limit_burst_ = 0;
   frame_header_version_ = header_version;
+  send_to_address_ = address;
 
   in_data_size_ = max_packet_length;
   in_data_ = malloc(in_data_size_);
-  enc_in_data_ = NULL;
 
   socket_.set_option(socket_base::broadcast(true));
   socket_.set_option(socket_base::reuse_address(true));
@@ -280,14 +286,15 @@ ProtobufBroadcastPeer::~ProtobufBroadcastPeer()
     io_service_.stop();
     asio_thread_.join();
   }
+  leave_multicast();
   free(in_data_);
-  if (enc_in_data_)  free(enc_in_data_);
   if (own_message_register_) {
     delete message_register_;
   }
 
   delete crypto_enc_;
   delete crypto_dec_;
+  delete compressor_;
 }
 
 
@@ -316,19 +323,275 @@ ProtobufBroadcastPeer::setup_crypto(const std::string &key, const std::string &c
 
   if (key != "" && cipher != "") {
     crypto_enc_ = new BufferEncryptor(key, cipher);
-
-    if (! enc_in_data_) {
-      // this depends on the cipher, but nothing is two times the incoming buffer...
-      enc_in_data_size_ = 2 * in_data_size_;
-      enc_in_data_      = malloc(enc_in_data_size_);
-    }
-
     crypto_dec_ = new BufferDecryptor(key);
     crypto_     = true;
     crypto_buf_ = false;
   }
 }
 
+/** Setup compression.
+ * After this call messages exceeding the threshold are sent compressed
+ * with a V3 frame header. Only enable this if all receivers support
+ * V3 frames, V2 peers will fail to parse compressed messages. Incoming
+ * compressed messages are always accepted, independent of this setting.
+ * @param codec name of codec to use, "none" or empty to disable compression
+ * @param threshold minimum size in bytes of messages to compress
+ * @see BufferCompressor for supported codecs
+ */
+void
+ProtobufBroadcastPeer::setup_compression(const std::string &codec, size_t threshold)
+{
+  if (frame_header_version_ == PB_FRAME_V1) {
+    throw std::runtime_error("Compression support only available with V3+ frame header");
+  }
+
+  int codec_id = codec.empty() ? PB_COMPRESSION_NONE : compression_name_to_id(codec.c_str());
+
+  std::lock_guard<std::mutex> lock(compressor_mutex_);
+  delete compressor_;
+  compressor_ = NULL;
+  if (codec_id != PB_COMPRESSION_NONE) {
+    compressor_ = new BufferCompressor(codec_id, threshold);
+  }
+}
+
+/** Setup multicast communication.
+ * Joins the multicast group given as send-to address at construction
+ * time, which therefore must be a multicast IPv4 address (and not a
+ * host name). Messages are then only delivered to hosts which joined
+ * the group instead of every host on the network. Unless @p loopback
+ * is enabled, the kernel does not deliver our own messages back to us,
+ * therefore filtering own messages is disabled in that case.
+ * @param interface_address address of the local interface on which to
+ * join the group and send messages, empty to let the system choose
+ * @param ttl time-to-live (hop limit) of sent messages, 1 keeps them
+ * on the local network
+ * @param loopback true to receive own messages (e.g. for multiple
+ * peers on the same host), false otherwise
+ * @exception std::runtime_error thrown if the address is no multicast
+ * address or joining the group fails
+ */
+void
+ProtobufBroadcastPeer::setup_multicast(const std::string &interface_address,
+				       unsigned int ttl, bool loopback)
+{
+  boost::system::error_code ec;
+  ip::address_v4 group = ip::address_v4::from_string(send_to_address_, ec);
+  if (ec || ! group.is_multicast()) {
+    throw std::runtime_error("Peer address " + send_to_address_ + " is not a multicast address");
+  }
+  ip::address_v4 iface = ip::address_v4::any();
+  if (! interface_address.empty()) {
+    iface = ip::address_v4::from_string(interface_address, ec);
+    if (ec) {
+      throw std::runtime_error("Invalid multicast interface address " + interface_address);
+    }
+  }
+
+  leave_multicast();
+
+  socket_.set_option(ip::multicast::join_group(group, iface), ec);
+  if (ec) {
+    throw std::runtime_error("Failed to join multicast group " + send_to_address_ +
+			     ": " + ec.message());
+  }
+  multicast_           = true;
+  multicast_group_     = group;
+  multicast_interface_ = iface;
+
+  if (! interface_address.empty()) {
+    socket_.set_option(ip::multicast::outbound_interface(iface));
+  }
+  socket_.set_option(ip::multicast::hops(ttl));
+  socket_.set_option(ip::multicast::enable_loopback(loopback));
+  filter_self_ = loopback;
+}
+
+
+/** Leave multicast group.
+ * Stop receiving messages sent to the group joined with
+ * setup_multicast(). Messages are still sent to the group address.
+ * Does nothing if no group has been joined.
+ */
+void
+ProtobufBroadcastPeer::leave_multicast()
+{
+  if (multicast_) {
+    boost::system::error_code ec;
+    socket_.set_option(ip::multicast::leave_group(multicast_group_, multicast_interface_), ec);
+    multicast_ = false;
+  }
+}
+
+/** Limit rate of incoming messages per remote endpoint.
+ * Messages from each remote endpoint are limited by a token bucket which
+ * is refilled at the given rate and can hold up to @p burst messages.
+ * Messages exceeding the limit are dropped right after receiving,
+ * before decryption and deserialization, so that a flooding sender
+ * cannot starve the application. Own messages are not limited.
+ * @param rate average number of messages per second, 0 to disable
+ * @param burst maximum number of messages accepted at once
+ * @see rate_limit_drops()
+ */
+void
+ProtobufBroadcastPeer::set_rate_limit(double rate, unsigned int burst)
+{
+  std::lock_guard<std::mutex> lock(rate_limit_mutex_);
+  rate_limit_rate_  = rate;
+  rate_limit_burst_ = std::max(1u, burst);
+  endpoint_buckets_.clear();
+}
+
+
+/** Limit rate of incoming messages of a type per remote endpoint.
+ * Like set_rate_limit(), but only applies to messages of the given type.
+ * Since the type is only known after decryption, these messages are
+ * dropped after decryption but before deserialization.
+ * @param component_id ID of the component
+ * @param msg_type numeric message type
+ * @param rate average number of messages per second, 0 to disable
+ * @param burst maximum number of messages accepted at once
+ */
+void
+ProtobufBroadcastPeer::set_rate_limit(uint16_t component_id, uint16_t msg_type,
+				      double rate, unsigned int burst)
+{
+  std::lock_guard<std::mutex> lock(rate_limit_mutex_);
+  std::pair<uint16_t, uint16_t> type(component_id, msg_type);
+  if (rate > 0.) {
+    type_rate_limits_[type] = std::make_pair(rate, std::max(1u, burst));
+  } else {
+    type_rate_limits_.erase(type);
+  }
+  type_buckets_.clear();
+}
+
+
+/** Get number of messages dropped due to rate limits.
+ * Counts are kept for at most 1024 senders. If more senders are dropped
+ * from, all counts are reset.
+ * @return map from remote endpoint to number of dropped messages
+ */
+std::map<ip::udp::endpoint, unsigned long>
+ProtobufBroadcastPeer::rate_limit_drops()
+{
+  std::lock_guard<std::mutex> lock(rate_limit_mutex_);
+  return rate_limit_drops_;
+}
+
+
+bool
+ProtobufBroadcastPeer::rate_limit_accept(const ip::udp::endpoint &endpoint)
+{
+  std::lock_guard<std::mutex> lock(rate_limit_mutex_);
+  if (rate_limit_rate_ <= 0.)  return true;
+  if (filter_self_ &&
+      std::binary_search(local_endpoints_.begin(), local_endpoints_.end(), endpoint))
+  {
+    return true;
+  }
+
+  // senders may be spoofed, do not grow without bounds
+  if (endpoint_buckets_.size() >= 1024 &&
+      endpoint_buckets_.find(endpoint) == endpoint_buckets_.end())
+  {
+    endpoint_buckets_.clear();
+  }
+  std::map<ip::udp::endpoint, TokenBucket>::iterator b = endpoint_buckets_.find(endpoint);
+  if (b == endpoint_buckets_.end()) {
+    b = endpoint_buckets_.insert(std::make_pair(endpoint,
+						TokenBucket(rate_limit_rate_,
+							    rate_limit_burst_))).first;
+  }
+  if (! b->second.consume(std::chrono::steady_clock::now())) {
+    count_rate_limit_drop(endpoint);
+    return false;
+  }
+  return true;
+}
+
+
+bool
+ProtobufBroadcastPeer::rate_limit_accept(const ip::udp::endpoint &endpoint,
+					 uint16_t component_id, uint16_t msg_type)
+{
+  std::lock_guard<std::mutex> lock(rate_limit_mutex_);
+  if (type_rate_limits_.empty())  return true;
+  std::pair<uint16_t, uint16_t> type(component_id, msg_type);
+  std::map<std::pair<uint16_t, uint16_t>, std::pair<double, unsigned int>>::iterator l =
+    type_rate_limits_.find(type);
+  if (l == type_rate_limits_.end())  return true;
+
+  TypeBucketKey key(endpoint, type);
+  if (type_buckets_.size() >= 1024 && type_buckets_.find(key) == type_buckets_.end()) {
+    type_buckets_.clear();
+  }
+  std::map<TypeBucketKey, TokenBucket>::iterator b = type_buckets_.find(key);
+  if (b == type_buckets_.end()) {
+    b = type_buckets_.insert(std::make_pair(key, TokenBucket(l->second.first,
+							     l->second.second))).first;
+  }
+  if (! b->second.consume(std::chrono::steady_clock::now())) {
+    count_rate_limit_drop(endpoint);
+    return false;
+  }
+  return true;
+}
+
+
+void
+ProtobufBroadcastPeer::count_rate_limit_drop(const ip::udp::endpoint &endpoint)
+{
+  // like the buckets, flooding from spoofed senders must not grow the counts
+  if (rate_limit_drops_.size() >= 1024 &&
+      rate_limit_drops_.find(endpoint) == rate_limit_drops_.end())
+  {
+    rate_limit_drops_.clear();
+  }
+  rate_limit_drops_[endpoint] += 1;
+}
+
+
+/** @class ProtobufBroadcastPeer::TokenBucket <protobuf_comm/peer.h>
+ * Token bucket for rate limiting.
+ * The bucket is refilled continuously at a given rate and each accepted
+ * event consumes one token.
+ * @author agent
+ */
+
+/** Empty constructor, accepts nothing. */
+ProtobufBroadcastPeer::TokenBucket::TokenBucket()
+  : rate_(0.), burst_(0.), tokens_(0.)
+{
+}
+
+/** Constructor.
+ * @param rate refill rate in tokens per second
+ * @param burst maximum number of tokens, the bucket starts full
+ */
+ProtobufBroadcastPeer::TokenBucket::TokenBucket(double rate, double burst)
+  : rate_(rate), burst_(burst), tokens_(burst), last_(std::chrono::steady_clock::now())
+{
+}
+
+/** Try to consume a token.
+ * @param now current time
+ * @return true if a token was available, false if the event must be dropped
+ */
+bool
+ProtobufBroadcastPeer::TokenBucket::consume(std::chrono::steady_clock::time_point now)
+{
+  double elapsed = std::chrono::duration<double>(now - last_).count();
+  last_   = now;
+  tokens_ = std::min(burst_, tokens_ + elapsed * rate_);
+  if (tokens_ >= 1.) {
+    tokens_ -= 1.;
+    return true;
+  }
+  return false;
+}
+
+
 void
 ProtobufBroadcastPeer::determine_local_endpoints()
 {
@@ -398,9 +661,17 @@ ProtobufBroadcastPeer::handle_recv(const boost::system::error_code& error,
     (frame_header_version_ == PB_FRAME_V1)
     ? sizeof(frame_header_v1_t) : (sizeof(frame_header_t) + sizeof(message_header_t));
 
+  if (! error && ! rate_limit_accept(in_endpoint_)) {
+    // flooding, drop before doing any work on the datagram
+    start_recv();
+    return;
+  }
+
   if (!error && bytes_rcvd >= expected_min_size ) {
     frame_header_t frame_header;
     size_t header_size;
+    // points to message header and payload, moves on in-place decryption
+    char *payload = (char *)in_data_ + sizeof(frame_header_t);
     if (frame_header_version_ == PB_FRAME_V1) {
       frame_header_v1_t *frame_header_v1 = static_cast<frame_header_v1_t *>(in_data_);
       frame_header.header_version = PB_FRAME_V1;
@@ -408,17 +679,11 @@ ProtobufBroadcastPeer::handle_recv(const boost::system::error_code& error,
       frame_header.payload_size   = frame_header_v1->payload_size;
       header_size  = sizeof(frame_header_v1_t);
     } else {
-      memcpy(&frame_header, crypto_buf_ ? enc_in_data_ : in_data_, sizeof(frame_header_t));
+      memcpy(&frame_header, in_data_, sizeof(frame_header_t));
       header_size  = sizeof(frame_header_t);
 
-      if (crypto_buf_) {
-	sig_rcvd_raw_(in_endpoint_, frame_header,
-		      (unsigned char *)enc_in_data_ + sizeof(frame_header_t),
-		      bytes_rcvd - sizeof(frame_header_t));
-      } else {
-	sig_rcvd_raw_(in_endpoint_, frame_header,
-		      (unsigned char *)in_data_ + sizeof(frame_header_t),
-		      bytes_rcvd - sizeof(frame_header_t));
+      if (sig_rcvd_raw_.num_slots() > 0) {
+	sig_rcvd_raw_(in_endpoint_, frame_header, payload, bytes_rcvd - sizeof(frame_header_t));
       }
 
       if (sig_rcvd_.num_slots() > 0) {
@@ -431,11 +696,10 @@ ProtobufBroadcastPeer::handle_recv(const boost::system::error_code& error,
 	  if (crypto_buf_ && (frame_header.cipher != PB_ENCRYPTION_NONE)) {
 	    // we need to decrypt first
 	    try {
-	      memcpy(in_data_, enc_in_data_, sizeof(frame_header_t));
 	      size_t to_decrypt = bytes_rcvd - sizeof(frame_header_t);
-	      bytes_rcvd = crypto_dec_->decrypt(frame_header.cipher,
-						(unsigned char *)enc_in_data_ + sizeof(frame_header_t), to_decrypt,
-						(unsigned char *)in_data_ + sizeof(frame_header_t), in_data_size_);
+	      void *plain;
+	      bytes_rcvd = crypto_dec_->decrypt(frame_header.cipher, payload, to_decrypt, &plain);
+	      payload = (char *)plain;
 	      frame_header.payload_size = htonl(bytes_rcvd);
 	      bytes_rcvd += sizeof(frame_header_t);
 	    } catch (std::runtime_error &e) {
@@ -465,16 +729,18 @@ ProtobufBroadcastPeer::handle_recv(const boost::system::error_code& error,
 	    // message register expects payload size to include message header
 	    frame_header.payload_size = htonl(ntohl(frame_header.payload_size) + sizeof(message_header_t));
 	  } else {
-	    message_header_t *msg_header =
-	    static_cast<message_header_t *>((void*)((char *)in_data_ + sizeof(frame_header_t)));
-	    message_header.component_id = msg_header->component_id;
-	    message_header.msg_type     = msg_header->msg_type;
-	    data = (char *)in_data_ + sizeof(frame_header_t) + sizeof(message_header_t);
+	    memcpy(&message_header, payload, sizeof(message_header_t));
+	    data = payload + sizeof(message_header_t);
 	  }
 
 	  uint16_t comp_id  = ntohs(message_header.component_id);
 	  uint16_t msg_type = ntohs(message_header.msg_type);
 
+	  if (! rate_limit_accept(in_endpoint_, comp_id, msg_type)) {
+	    start_recv();
+	    return;
+	  }
+
 	  try {
 	    std::shared_ptr<google::protobuf::Message> m =
 	      message_register_->deserialize(frame_header, message_header, data);
@@ -530,6 +796,11 @@ ProtobufBroadcastPeer::send(uint16_t component_id, uint16_t msg_type,
 			       entry->frame_header, entry->message_header,
 			       entry->serialized_message);
 
+  if (frame_header_version_ != PB_FRAME_V1) {
+    std::lock_guard<std::mutex> lock(compressor_mutex_);
+    if (compressor_)  compressor_->compress(entry->frame_header, entry->serialized_message);
+  }
+
   if (entry->serialized_message.size() > max_packet_length) {
     throw std::runtime_error("Serialized message too big");
   }
@@ -640,7 +911,7 @@ void
 ProtobufBroadcastPeer::start_recv()
 {
   crypto_buf_ = crypto_;
-  socket_.async_receive_from(boost::asio::buffer(crypto_ ? enc_in_data_ : in_data_, in_data_size_),
+  socket_.async_receive_from(boost::asio::buffer(in_data_, in_data_size_),
 			     in_endpoint_,
 			     boost::bind(&ProtobufBroadcastPeer::handle_recv,
 					 this, boost::asio::placeholders::error,
@@ -48,6 +48,8 @@
 #include <thread>
 #include <mutex>
 #include <queue>
+#include <map>
+#include <chrono>
 
 namespace protobuf_comm {
 #if 0 /* just to make Emacs auto-indent happy */
@@ -56,6 +58,7 @@ namespace protobuf_comm {
 
 class BufferEncryptor;
 class BufferDecryptor;
+class BufferCompressor;
 
 class ProtobufBroadcastPeer
 {
@@ -97,6 +100,15 @@ class ProtobufBroadcastPeer
   void send_raw(const frame_header_t &frame_header, const void *data, size_t data_size);
 
   void setup_crypto(const std::string &key, const std::string &cipher);
+  void setup_compression(const std::string &codec, size_t threshold = 256);
+  void setup_multicast(const std::string &interface_address = "",
+		       unsigned int ttl = 1, bool loopback = false);
+  void leave_multicast();
+
+  void set_rate_limit(double rate, unsigned int burst);
+  void set_rate_limit(uint16_t component_id, uint16_t msg_type,
+		      double rate, unsigned int burst);
+  std::map<boost::asio::ip::udp::endpoint, unsigned long> rate_limit_drops();
 
   /** Get the server's message register.
    * @return message register
@@ -153,7 +165,29 @@ class ProtobufBroadcastPeer
   { return sig_send_error_; }
 
 
+ private: // types
+  /** Token bucket for rate limiting. */
+  class TokenBucket
+  {
+   public:
+    TokenBucket();
+    TokenBucket(double rate, double burst);
+    bool consume(std::chrono::steady_clock::time_point now);
+   private:
+    double rate_;
+    double burst_;
+    double tokens_;
+    std::chrono::steady_clock::time_point last_;
+  };
+
+  /** Key for per endpoint and message type token buckets. */
+  typedef std::pair<boost::asio::ip::udp::endpoint, std::pair<uint16_t, uint16_t>> TypeBucketKey;
+
  private: // methods
+  bool rate_limit_accept(const boost::asio::ip::udp::endpoint &endpoint);
+  bool rate_limit_accept(const boost::asio::ip::udp::endpoint &endpoint,
+			 uint16_t component_id, uint16_t msg_type);
+  void count_rate_limit_drop(const boost::asio::ip::udp::endpoint &endpoint);
   void ctor(const std::string &address, unsigned int send_to_port,
 	    const std::string crypto_key = "", const std::string cipher = "aes-128-ecb",
 	    frame_header_version_t = PB_FRAME_V2);
@@ -189,9 +223,7 @@ class ProtobufBroadcastPeer
   boost::asio::ip::udp::endpoint in_endpoint_;
 
   void *         in_data_;
-  void *         enc_in_data_;
   size_t         in_data_size_;
-  size_t         enc_in_data_size_;
 
   bool           filter_self_;
 
@@ -205,6 +237,21 @@ class ProtobufBroadcastPeer
   bool             crypto_buf_;
   BufferEncryptor *crypto_enc_;
   BufferDecryptor *crypto_dec_;
+
+  std::mutex        compressor_mutex_;
+  BufferCompressor *compressor_;
+
+  bool                          multicast_;
+  boost::asio::ip::address_v4   multicast_group_;
+  boost::asio::ip::address_v4   multicast_interface_;
+
+  std::mutex   rate_limit_mutex_;
+  double       rate_limit_rate_;
+  unsigned int rate_limit_burst_;
+  std::map<std::pair<uint16_t, uint16_t>, std::pair<double, unsigned int>> type_rate_limits_;
+  std::map<boost::asio::ip::udp::endpoint, TokenBucket>  endpoint_buckets_;
+  std::map<TypeBucketKey, TokenBucket>                   type_buckets_;
+  std::map<boost::asio::ip::udp::endpoint, unsigned long> rate_limit_drops_;
 };
 
 } // end namespace protobuf_comm
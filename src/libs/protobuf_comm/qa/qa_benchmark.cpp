@@ -0,0 +1,523 @@
+/***************************************************************************
+ *  qa_benchmark.cpp - protobuf_comm throughput and latency benchmarks
+ *
+ *  Created: Sun Oct 18 23:55:04 2026
+ *  Copyright  2026  agent
+ *
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <protobuf_comm/server.h>
+#include <protobuf_comm/client.h>
+#include <protobuf_comm/peer.h>
+#ifdef HAVE_LIBCRYPTO
+#  include <protobuf_comm/crypto.h>
+#endif
+
+#include <msgs/AttentionMessage.pb.h>
+#include <msgs/BeaconSignal.pb.h>
+#include <msgs/ExplorationInfo.pb.h>
+#include <msgs/GameInfo.pb.h>
+#include <msgs/GameState.pb.h>
+#include <msgs/MachineCommands.pb.h>
+#include <msgs/MachineInfo.pb.h>
+#include <msgs/MachineInstructions.pb.h>
+#include <msgs/MachineReport.pb.h>
+#include <msgs/OrderInfo.pb.h>
+#include <msgs/RingInfo.pb.h>
+#include <msgs/RobotCommands.pb.h>
+#include <msgs/RobotInfo.pb.h>
+#include <msgs/SimTimeSync.pb.h>
+#include <msgs/VersionInfo.pb.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace protobuf_comm;
+using namespace google::protobuf;
+
+/// @cond QA
+
+/* Benchmarks for the protobuf_comm library, all run over the loopback
+ * device. Results are printed as one JSON object per line, e.g.
+ *   qa_protobuf_comm_benchmark all > results.json
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static double
+usec_since(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+/* Counter which can be waited on from the main thread while it is
+ * increased from an ASIO thread. */
+class Counter
+{
+ public:
+  Counter() : value_(0) {}
+
+  void increment()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    value_ += 1;
+    last_   = Clock::now();
+    cond_.notify_all();
+  }
+
+  Clock::time_point last()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_;
+  }
+
+  unsigned int value()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return value_;
+  }
+
+  bool wait_for(unsigned int value, unsigned int timeout_ms = 5000)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+			  [this, value]{ return value_ >= value; });
+  }
+
+ private:
+  std::mutex              mutex_;
+  std::condition_variable cond_;
+  unsigned int            value_;
+  Clock::time_point       last_;
+};
+
+/* Fill all fields of a message with sample data, repeated fields get
+ * a few entries, so that serialized sizes resemble real traffic. */
+static void
+fill_message(Message *m, unsigned int depth = 0)
+{
+  const Descriptor *desc = m->GetDescriptor();
+  const Reflection *refl = m->GetReflection();
+  for (int i = 0; i < desc->field_count(); ++i) {
+    const FieldDescriptor *f = desc->field(i);
+    int count = f->is_repeated() ? 4 : 1;
+    for (int j = 0; j < count; ++j) {
+      switch (f->cpp_type()) {
+      case FieldDescriptor::CPPTYPE_INT32:
+	if (f->is_repeated()) refl->AddInt32(m, f, -j);   else refl->SetInt32(m, f, -42);
+	break;
+      case FieldDescriptor::CPPTYPE_INT64:
+	if (f->is_repeated()) refl->AddInt64(m, f, -j);   else refl->SetInt64(m, f, -1234567);
+	break;
+      case FieldDescriptor::CPPTYPE_UINT32:
+	if (f->is_repeated()) refl->AddUInt32(m, f, j);   else refl->SetUInt32(m, f, 42);
+	break;
+      case FieldDescriptor::CPPTYPE_UINT64:
+	if (f->is_repeated()) refl->AddUInt64(m, f, j);   else refl->SetUInt64(m, f, 1234567);
+	break;
+      case FieldDescriptor::CPPTYPE_DOUBLE:
+	if (f->is_repeated()) refl->AddDouble(m, f, j);   else refl->SetDouble(m, f, 3.1415);
+	break;
+      case FieldDescriptor::CPPTYPE_FLOAT:
+	if (f->is_repeated()) refl->AddFloat(m, f, j);    else refl->SetFloat(m, f, 2.71f);
+	break;
+      case FieldDescriptor::CPPTYPE_BOOL:
+	if (f->is_repeated()) refl->AddBool(m, f, j % 2); else refl->SetBool(m, f, true);
+	break;
+      case FieldDescriptor::CPPTYPE_ENUM:
+	{
+	  const EnumValueDescriptor *v =
+	    f->enum_type()->value(j % f->enum_type()->value_count());
+	  if (f->is_repeated()) refl->AddEnum(m, f, v);     else refl->SetEnum(m, f, v);
+	}
+	break;
+      case FieldDescriptor::CPPTYPE_STRING:
+	if (f->is_repeated()) refl->AddString(m, f, "Benchmark");
+	else                  refl->SetString(m, f, "Benchmark");
+	break;
+      case FieldDescriptor::CPPTYPE_MESSAGE:
+	if (depth < 4) {
+	  fill_message(f->is_repeated() ? refl->AddMessage(m, f) : refl->MutableMessage(m, f),
+		       depth + 1);
+	}
+	break;
+      }
+    }
+  }
+}
+
+static void
+register_types(MessageRegister &mr)
+{
+  mr.add_message_type<llsf_msgs::GameState>();
+  mr.add_message_type<llsf_msgs::MachineInfo>();
+  mr.add_message_type<llsf_msgs::BeaconSignal>();
+}
+
+static void
+print_latency(const char *benchmark, std::vector<double> &rtt)
+{
+  if (rtt.empty()) {
+    printf("{\"benchmark\": \"%s\", \"error\": \"no round trips\"}\n", benchmark);
+    return;
+  }
+  std::sort(rtt.begin(), rtt.end());
+  double sum = 0.;
+  for (double r : rtt)  sum += r;
+  printf("{\"benchmark\": \"%s\", \"iterations\": %zu, \"min_us\": %.2f, \"mean_us\": %.2f, "
+	 "\"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f}\n",
+	 benchmark, rtt.size(), rtt.front(), sum / rtt.size(), rtt[rtt.size() / 2],
+	 rtt[(rtt.size() * 99) / 100], rtt.back());
+}
+
+
+/* Round trip time of a GameState message echoed by the server. */
+static void
+bench_stream_latency(unsigned short port, unsigned int iterations)
+{
+  MessageRegister server_mr, client_mr;
+  register_types(server_mr);
+  register_types(client_mr);
+
+  ProtobufStreamServer server(port, &server_mr);
+  server.signal_received().connect(
+    [&server](ProtobufStreamServer::ClientID client, uint16_t, uint16_t,
+	      std::shared_ptr<google::protobuf::Message> msg)
+    { server.send(client, msg); });
+
+  Counter connected, received;
+  ProtobufStreamClient client(&client_mr);
+  client.signal_connected().connect([&connected]() { connected.increment(); });
+  client.signal_received().connect(
+    [&received](uint16_t, uint16_t, std::shared_ptr<google::protobuf::Message>)
+    { received.increment(); });
+  client.async_connect("localhost", port);
+  if (! connected.wait_for(1)) {
+    printf("{\"benchmark\": \"stream_latency\", \"error\": \"connection failed\"}\n");
+    return;
+  }
+
+  llsf_msgs::GameState gs;
+  fill_message(&gs);
+
+  std::vector<double> rtt;
+  rtt.reserve(iterations);
+  for (unsigned int i = 1; i <= iterations; ++i) {
+    Clock::time_point start = Clock::now();
+    client.send(gs);
+    if (! received.wait_for(i))  break;
+    rtt.push_back(usec_since(start));
+  }
+  print_latency("stream_latency", rtt);
+  client.disconnect();
+}
+
+
+/* Throughput of MachineInfo messages sent to all connected clients. */
+static void
+bench_stream_fanout(unsigned short port, unsigned int num_clients, unsigned int messages)
+{
+  MessageRegister server_mr;
+  register_types(server_mr);
+  ProtobufStreamServer server(port, &server_mr);
+
+  Counter connected, received;
+  std::vector<MessageRegister *> client_mrs;
+  std::vector<ProtobufStreamClient *> clients;
+  for (unsigned int i = 0; i < num_clients; ++i) {
+    MessageRegister *mr = new MessageRegister();
+    register_types(*mr);
+    ProtobufStreamClient *client = new ProtobufStreamClient(mr);
+    client->signal_connected().connect([&connected]() { connected.increment(); });
+    client->signal_received().connect(
+      [&received](uint16_t, uint16_t, std::shared_ptr<google::protobuf::Message>)
+      { received.increment(); });
+    client->async_connect("localhost", port);
+    client_mrs.push_back(mr);
+    clients.push_back(client);
+  }
+
+  if (connected.wait_for(num_clients)) {
+    llsf_msgs::MachineInfo mi;
+    fill_message(&mi);
+    size_t msg_size = mi.SerializeAsString().size();
+
+    Clock::time_point start = Clock::now();
+    for (unsigned int i = 0; i < messages; ++i) {
+      server.send_to_all(mi);
+    }
+    bool complete = received.wait_for(num_clients * messages, 30000);
+    double sec = usec_since(start) / 1000000.;
+    unsigned int num_received = received.value();
+
+    printf("{\"benchmark\": \"stream_fanout\", \"clients\": %u, \"messages\": %u, "
+	   "\"message_size\": %zu, \"received\": %u, \"complete\": %s, \"seconds\": %.4f, "
+	   "\"msgs_per_sec\": %.1f, \"bytes_per_sec\": %.1f}\n",
+	   num_clients, messages, msg_size, num_received, complete ? "true" : "false", sec,
+	   num_received / sec, (num_received * msg_size) / sec);
+  } else {
+    printf("{\"benchmark\": \"stream_fanout\", \"error\": \"connection failed\"}\n");
+  }
+
+  for (ProtobufStreamClient *c : clients)  delete c;
+  for (MessageRegister *mr : client_mrs)   delete mr;
+}
+
+
+/* Rate at which BeaconSignal datagrams are received from another peer. */
+static void
+bench_peer_throughput(unsigned short port, unsigned int datagrams, const std::string &cipher)
+{
+  const std::string key = "benchmark";
+  unsigned short port_a = port, port_b = port + 1;
+  ProtobufBroadcastPeer *sender, *receiver;
+  if (cipher.empty()) {
+    sender   = new ProtobufBroadcastPeer("127.0.0.1", port_a, port_b);
+    receiver = new ProtobufBroadcastPeer("127.0.0.1", port_b, port_a);
+  } else {
+    sender   = new ProtobufBroadcastPeer("127.0.0.1", port_a, port_b, key, cipher);
+    receiver = new ProtobufBroadcastPeer("127.0.0.1", port_b, port_a, key, cipher);
+  }
+  register_types(sender->message_register());
+  register_types(receiver->message_register());
+  receiver->set_filter_self(false);
+
+  Counter received;
+  receiver->signal_received().connect(
+    [&received](boost::asio::ip::udp::endpoint &, uint16_t, uint16_t,
+		std::shared_ptr<google::protobuf::Message>)
+    { received.increment(); });
+
+  llsf_msgs::BeaconSignal bs;
+  fill_message(&bs);
+
+  Clock::time_point start = Clock::now();
+  for (unsigned int i = 0; i < datagrams; ++i) {
+    bs.set_seq(i);
+    sender->send(bs);
+  }
+  // datagrams may be dropped, wait until no more arrive
+  unsigned int last = 0;
+  while (! received.wait_for(datagrams, 500) && received.value() != last) {
+    last = received.value();
+  }
+  unsigned int num_received = received.value();
+  double sec = (num_received > 0)
+    ? std::chrono::duration<double>(received.last() - start).count() : 0.;
+
+  printf("{\"benchmark\": \"peer_throughput\", \"cipher\": \"%s\", \"datagrams\": %u, "
+	 "\"received\": %u, \"seconds\": %.4f, \"datagrams_per_sec\": %.1f}\n",
+	 cipher.empty() ? "none" : cipher.c_str(), datagrams, num_received, sec,
+	 (sec > 0.) ? num_received / sec : 0.);
+
+  delete sender;
+  delete receiver;
+}
+
+
+#ifdef HAVE_LIBCRYPTO
+/* Cost of decrypting a received datagram, once into a separate plain
+ * text buffer (as the peer did before) and once in place. Each round
+ * first copies the datagram into the receive buffer as the socket would. */
+static void
+bench_decrypt(unsigned int iterations, size_t size, const std::string &cipher)
+{
+  const std::string key = "benchmark";
+  BufferEncryptor enc(key, cipher);
+  BufferDecryptor dec(key);
+  int cipher_id = cipher_name_to_id(cipher.c_str());
+
+  std::string plain(size, 'x');
+  std::string datagram(enc.encrypted_buffer_size(size), '\0');
+  enc.encrypt(plain, datagram);
+
+  std::vector<unsigned char> recv_buf(datagram.size()), plain_buf(datagram.size());
+  double sep_usec = 0., inplace_usec = 0.;
+  for (unsigned int i = 0; i < iterations; ++i) {
+    Clock::time_point start = Clock::now();
+    memcpy(&recv_buf[0], datagram.data(), datagram.size());
+    dec.decrypt(cipher_id, &recv_buf[0], datagram.size(), &plain_buf[0], plain_buf.size());
+    sep_usec += usec_since(start);
+
+    start = Clock::now();
+    memcpy(&recv_buf[0], datagram.data(), datagram.size());
+    void *p;
+    dec.decrypt(cipher_id, &recv_buf[0], datagram.size(), &p);
+    inplace_usec += usec_since(start);
+  }
+
+  printf("{\"benchmark\": \"decrypt\", \"cipher\": \"%s\", \"size\": %zu, "
+	 "\"iterations\": %u, \"separate_ns\": %.1f, \"separate_buffer_bytes\": %zu, "
+	 "\"inplace_ns\": %.1f, \"inplace_buffer_bytes\": %zu}\n",
+	 cipher.c_str(), datagram.size(), iterations,
+	 1000. * sep_usec / iterations, recv_buf.size() + plain_buf.size(),
+	 1000. * inplace_usec / iterations, recv_buf.size());
+}
+#endif
+
+
+/* Serialization and deserialization cost for each message type with
+ * a component ID and message type of the llsf_msgs library. */
+static void
+bench_serialize(unsigned int iterations)
+{
+  // one type per file suffices to get hold of all types in the file
+  const FileDescriptor *files[] = {
+    llsf_msgs::AttentionMessage::descriptor()->file(),
+    llsf_msgs::BeaconSignal::descriptor()->file(),
+    llsf_msgs::ExplorationInfo::descriptor()->file(),
+    llsf_msgs::GameInfo::descriptor()->file(),
+    llsf_msgs::GameState::descriptor()->file(),
+    llsf_msgs::SetMachineState::descriptor()->file(),
+    llsf_msgs::MachineInfo::descriptor()->file(),
+    llsf_msgs::PrepareMachine::descriptor()->file(),
+    llsf_msgs::MachineReport::descriptor()->file(),
+    llsf_msgs::OrderInfo::descriptor()->file(),
+    llsf_msgs::RingInfo::descriptor()->file(),
+    llsf_msgs::SetRobotMaintenance::descriptor()->file(),
+    llsf_msgs::RobotInfo::descriptor()->file(),
+    llsf_msgs::SimTimeSync::descriptor()->file(),
+    llsf_msgs::VersionInfo::descriptor()->file()
+  };
+
+  MessageRegister mr;
+  for (const FileDescriptor *file : files) {
+    for (int i = 0; i < file->message_type_count(); ++i) {
+      const Descriptor *desc = file->message_type(i);
+      const EnumDescriptor *comp_type = desc->FindEnumTypeByName("CompType");
+      if (! comp_type)  continue;
+      const EnumValueDescriptor *comp_id = comp_type->FindValueByName("COMP_ID");
+      const EnumValueDescriptor *msg_type = comp_type->FindValueByName("MSG_TYPE");
+      if (! comp_id || ! msg_type)  continue;
+
+      try {
+	mr.add_message_type(desc->full_name());
+      } catch (std::runtime_error &e) {
+	printf("{\"benchmark\": \"serialize\", \"type\": \"%s\", \"error\": \"%s\"}\n",
+	       desc->full_name().c_str(), e.what());
+	continue;
+      }
+      std::string full_name = desc->full_name();
+      std::shared_ptr<Message> m = mr.new_message_for(full_name);
+      fill_message(m.get());
+
+      frame_header_t fh;
+      memset(&fh, 0, sizeof(fh));
+      fh.header_version = PB_FRAME_V2;
+      message_header_t mh;
+      std::string data;
+      double ser_usec = 0., deser_usec = 0.;
+      for (unsigned int j = 0; j < iterations; ++j) {
+	Clock::time_point start = Clock::now();
+	mr.serialize(comp_id->number(), msg_type->number(), *m, fh, mh, data);
+	ser_usec += usec_since(start);
+
+	start = Clock::now();
+	std::shared_ptr<Message> d = mr.deserialize(fh, mh, (void *)data.data());
+	deser_usec += usec_since(start);
+      }
+
+      printf("{\"benchmark\": \"serialize\", \"type\": \"%s\", \"size\": %zu, "
+	     "\"iterations\": %u, \"serialize_ns\": %.1f, \"deserialize_ns\": %.1f}\n",
+	     desc->full_name().c_str(), data.size(), iterations,
+	     1000. * ser_usec / iterations, 1000. * deser_usec / iterations);
+    }
+  }
+}
+
+
+static void
+usage(const char *progname)
+{
+  printf("Usage: %s [-n N] [-c CLIENTS] [-p PORT] [latency|fanout|peer|decrypt|serialize|all]\n"
+	 " -n N        number of iterations or messages (default 1000)\n"
+	 " -c CLIENTS  number of clients for fan-out benchmark (default 4)\n"
+	 " -p PORT     base port on loopback device (default 14444)\n",
+	 progname);
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned int   iterations = 1000;
+  unsigned int   num_clients = 4;
+  unsigned short port = 14444;
+  std::string    which = "all";
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = boost::lexical_cast<unsigned int>(argv[++i]);
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      num_clients = boost::lexical_cast<unsigned int>(argv[++i]);
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      port = boost::lexical_cast<unsigned short>(argv[++i]);
+    } else if (argv[i][0] == '-') {
+      usage(argv[0]);
+      return 1;
+    } else {
+      which = argv[i];
+    }
+  }
+
+  if (which == "latency" || which == "all") {
+    bench_stream_latency(port, iterations);
+  }
+  if (which == "fanout" || which == "all") {
+    bench_stream_fanout(port + 1, num_clients, iterations);
+  }
+  if (which == "peer" || which == "all") {
+    bench_peer_throughput(port + 2, iterations, "");
+    bench_peer_throughput(port + 4, iterations, "aes-128-cbc");
+  }
+#ifdef HAVE_LIBCRYPTO
+  if (which == "decrypt" || which == "all") {
+    bench_decrypt(iterations, 128, "aes-128-cbc");
+    bench_decrypt(iterations, 960, "aes-128-cbc");
+  }
+#endif
+  if (which == "serialize" || which == "all") {
+    bench_serialize(iterations);
+  }
+
+  // Delete all global objects allocated by libprotobuf
+  google::protobuf::ShutdownProtobufLibrary();
+  return 0;
+}
+
+/// @endcond
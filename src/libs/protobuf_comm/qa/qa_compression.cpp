@@ -0,0 +1,155 @@
+/***************************************************************************
+ *  qa_compression.cpp - protobuf_comm compression benchmark
+ *
+ *  Created: Sun Oct 18 23:46:11 2026
+ *  Copyright  2026  agent
+ *
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <protobuf_comm/compression.h>
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <arpa/inet.h>
+
+using namespace protobuf_comm;
+
+/// @cond QA
+
+/* Benchmark compression over recorded traffic.
+ * The input is a raw dump of a V2 protobuf stream as received from the
+ * refbox, e.g. recorded with: nc localhost 4444 > traffic.bin
+ */
+
+struct Stats {
+  unsigned int count = 0;
+  unsigned int compressed_count = 0;
+  size_t plain_bytes = 0;
+  size_t wire_bytes = 0;
+  double compress_usec = 0.;
+  double decompress_usec = 0.;
+};
+
+static void
+print_stats(const char *name, const Stats &s)
+{
+  printf("%-12s %8u %8u %12zu %12zu %7.1f%% %10.2f %10.2f\n", name,
+	 s.count, s.compressed_count, s.plain_bytes, s.wire_bytes,
+	 s.plain_bytes > 0 ? (100. * s.wire_bytes / s.plain_bytes) : 0.,
+	 s.count > 0 ? s.compress_usec / s.count : 0.,
+	 s.count > 0 ? s.decompress_usec / s.count : 0.);
+}
+
+int
+main(int argc, char **argv)
+{
+  if (argc < 2) {
+    printf("Usage: %s <traffic.bin> [threshold] [codec]\n", argv[0]);
+    return 1;
+  }
+  size_t threshold = (argc >= 3) ? atoi(argv[2]) : 256;
+  int codec = compression_name_to_id((argc >= 4) ? argv[3] : "zlib");
+
+  std::ifstream in(argv[1], std::ios::binary);
+  if (! in) {
+    printf("Cannot open %s\n", argv[1]);
+    return 1;
+  }
+
+  BufferCompressor compressor(codec, threshold);
+  std::map<std::pair<uint16_t, uint16_t>, Stats> stats;
+  Stats total;
+
+  frame_header_t fh;
+  while (in.read((char *)&fh, sizeof(fh))) {
+    size_t payload_size = ntohl(fh.payload_size);
+    if (payload_size < sizeof(message_header_t)) {
+      printf("Invalid frame, aborting\n");
+      break;
+    }
+    message_header_t mh;
+    std::string data(payload_size - sizeof(message_header_t), '\0');
+    if (! in.read((char *)&mh, sizeof(mh)) || ! in.read(&data[0], data.size()))  break;
+
+    Stats &s = stats[std::make_pair(ntohs(mh.component_id), ntohs(mh.msg_type))];
+    size_t plain_size = data.size();
+
+    std::chrono::high_resolution_clock::time_point start =
+      std::chrono::high_resolution_clock::now();
+    frame_header_t out_fh = fh;
+    bool compressed = compressor.compress(out_fh, data);
+    std::chrono::high_resolution_clock::time_point end =
+      std::chrono::high_resolution_clock::now();
+    double compress_usec =
+      std::chrono::duration<double, std::micro>(end - start).count();
+
+    double decompress_usec = 0.;
+    if (compressed) {
+      std::string plain;
+      start = std::chrono::high_resolution_clock::now();
+      decompress_buffer(out_fh.compression, data.data(), data.size(), plain);
+      end = std::chrono::high_resolution_clock::now();
+      decompress_usec = std::chrono::duration<double, std::micro>(end - start).count();
+      if (plain.size() != plain_size) {
+	printf("Decompressed size mismatch (%zu != %zu)\n", plain.size(), plain_size);
+	return 2;
+      }
+    }
+
+    for (Stats *st : {&s, &total}) {
+      st->count += 1;
+      st->compressed_count += compressed ? 1 : 0;
+      st->plain_bytes += sizeof(fh) + sizeof(mh) + plain_size;
+      st->wire_bytes += sizeof(fh) + sizeof(mh) + data.size();
+      st->compress_usec += compress_usec;
+      st->decompress_usec += decompress_usec;
+    }
+  }
+
+  printf("Codec %s, threshold %zu bytes\n\n", compression_name_by_id(codec), threshold);
+  printf("%-12s %8s %8s %12s %12s %8s %10s %10s\n", "comp:type", "count", "compr",
+	 "plain B", "wire B", "ratio", "comp us", "decomp us");
+  for (const auto &s : stats) {
+    char name[16];
+    snprintf(name, sizeof(name), "%u:%u", s.first.first, s.first.second);
+    print_stats(name, s.second);
+  }
+  print_stats("total", total);
+
+  return 0;
+}
+
+/// @endcond
@@ -53,6 +53,8 @@ public:
   {
     frame_header.header_version = PB_FRAME_V2;
     frame_header.cipher         = PB_ENCRYPTION_NONE;
+    frame_header.compression    = PB_COMPRESSION_NONE;
+    frame_header.reserved_3     = 0;
   };
   std::string  serialized_message;	///< serialized protobuf message
   frame_header_t    frame_header;	///< Frame header (network byte order), never encrypted
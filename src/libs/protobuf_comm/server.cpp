@@ -35,8 +35,12 @@
  */
 
 #include <protobuf_comm/server.h>
+#include <protobuf_comm/compression.h>
 
 #include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
 
 using namespace boost::asio;
 using namespace boost::system;
@@ -66,6 +70,7 @@ ProtobufStreamServer::Session::Session(ClientID id, ProtobufStreamServer *parent
   in_data_size_ = 1024;
   in_data_ = malloc(in_data_size_);
   outbound_active_ = false;
+  subscribed_all_ = true;
 }
 
 /** Destructor. */
@@ -73,7 +78,7 @@ ProtobufStreamServer::Session::~Session()
 {
   boost::system::error_code err;
   if (socket_.is_open()) {
-    socket_.shutdown(ip::tcp::socket::shutdown_both, err);
+    socket_.shutdown(socket_base::shutdown_both, err);
     socket_.close();
   }
   free(in_data_);
@@ -84,7 +89,14 @@ ProtobufStreamServer::Session::~Session()
 void
 ProtobufStreamServer::Session::start_session()
 {
-  remote_endpoint_ = socket_.remote_endpoint();
+  boost::asio::generic::stream_protocol::endpoint ep = socket_.remote_endpoint();
+  if (ep.protocol().family() == AF_INET || ep.protocol().family() == AF_INET6) {
+    memcpy(remote_endpoint_.data(), ep.data(), ep.size());
+    remote_endpoint_.resize(ep.size());
+  } else {
+    // local (Unix domain socket) connection, report as loopback
+    remote_endpoint_ = ip::tcp::endpoint(ip::address_v4::loopback(), 0);
+  }
 }
 
 /** Start reading a message on this session.
@@ -110,15 +122,37 @@ void
 ProtobufStreamServer::Session::send(uint16_t component_id, uint16_t msg_type,
 				    google::protobuf::Message &m)
 {
+  if (! subscribed(component_id, msg_type))  return;
+
   QueueEntry *entry = new QueueEntry();
   parent_->message_register().serialize(component_id, msg_type, m,
 					entry->frame_header, entry->message_header,
 					entry->serialized_message);
 
+  // the copy keeps the compressor alive if it is replaced meanwhile
+  std::shared_ptr<BufferCompressor> compressor;
+  {
+    std::lock_guard<std::mutex> lock(outbound_mutex_);
+    compressor = compressor_;
+  }
+  if (compressor) {
+    compressor->compress(entry->frame_header, entry->serialized_message);
+  }
+
   entry->buffers[0] = boost::asio::buffer(&entry->frame_header, sizeof(frame_header_t));
   entry->buffers[1] = boost::asio::buffer(&entry->message_header, sizeof(message_header_t));
   entry->buffers[2] = boost::asio::buffer(entry->serialized_message);
- 
+
+  enqueue(entry);
+}
+
+
+/** Queue an entry for sending.
+ * @param entry entry to send, ownership is taken
+ */
+void
+ProtobufStreamServer::Session::enqueue(QueueEntry *entry)
+{
   std::lock_guard<std::mutex> lock(outbound_mutex_);
   if (outbound_active_) {
     outbound_queue_.push(entry);
@@ -134,13 +168,28 @@ ProtobufStreamServer::Session::send(uint16_t component_id, uint16_t msg_type,
 }
 
 
+/** Check if the client subscribed to a message type.
+ * Clients which never sent a subscription receive all messages.
+ * @param component_id ID of the component
+ * @param msg_type numeric message type
+ * @return true if messages of the given type should be sent to the client
+ */
+bool
+ProtobufStreamServer::Session::subscribed(uint16_t component_id, uint16_t msg_type)
+{
+  std::lock_guard<std::mutex> lock(subscriptions_mutex_);
+  return subscribed_all_ ||
+    (subscriptions_.find(std::make_pair(component_id, msg_type)) != subscriptions_.end());
+}
+
+
 /** Disconnect from client. */
 void
 ProtobufStreamServer::Session::disconnect()
 {
   boost::system::error_code err;
   if (socket_.is_open()) {
-    socket_.shutdown(ip::tcp::socket::shutdown_both, err);
+    socket_.shutdown(socket_base::shutdown_both, err);
     socket_.close();
   }
 }
@@ -221,14 +270,19 @@ ProtobufStreamServer::Session::handle_read_message(const boost::system::error_co
 
     uint16_t comp_id   = ntohs(message_header->component_id);
     uint16_t msg_type  = ntohs(message_header->msg_type);
-    try {
-      std::shared_ptr<google::protobuf::Message> m =
-	parent_->message_register().deserialize(in_frame_header_, *message_header,
-						(char *)in_data_ + sizeof(message_header_t));
-      parent_->sig_rcvd_(id_, comp_id, msg_type, m);
-    } catch (std::runtime_error &e) {
-      // ignored, most likely unknown message tpye
-      parent_->sig_recv_failed_(id_, comp_id, msg_type, e.what());
+    if (in_frame_header_.header_version >= PB_FRAME_V3 && comp_id == PB_CONTROL_COMP_ID) {
+      handle_control(msg_type, (char *)in_data_ + sizeof(message_header_t),
+		     ntohl(in_frame_header_.payload_size) - sizeof(message_header_t));
+    } else {
+      try {
+	std::shared_ptr<google::protobuf::Message> m =
+	  parent_->message_register().deserialize(in_frame_header_, *message_header,
+						  (char *)in_data_ + sizeof(message_header_t));
+	parent_->sig_rcvd_(id_, comp_id, msg_type, m);
+      } catch (std::runtime_error &e) {
+	// ignored, most likely unknown message tpye
+	parent_->sig_recv_failed_(id_, comp_id, msg_type, e.what());
+      }
     }
     start_read();
   } else {
@@ -237,11 +291,68 @@ ProtobufStreamServer::Session::handle_read_message(const boost::system::error_co
 }
 
 
+/** Handle protocol control frame.
+ * On a compression announcement the session agrees to the client's codec
+ * if it matches the server's, and replies with the codec that will be used
+ * (or none). A subscription replaces the set of message types sent to the
+ * client.
+ * @param msg_type control message type
+ * @param data control message payload
+ * @param data_size size in bytes of @p data
+ */
+void
+ProtobufStreamServer::Session::handle_control(uint16_t msg_type,
+					      const char *data, size_t data_size)
+{
+  if (msg_type == PB_CONTROL_MSG_SUBSCRIBE) {
+    std::lock_guard<std::mutex> lock(subscriptions_mutex_);
+    subscriptions_.clear();
+    for (size_t i = 0; i + 2 * sizeof(uint16_t) <= data_size; i += 2 * sizeof(uint16_t)) {
+      uint16_t type[2];
+      memcpy(type, data + i, sizeof(type));
+      subscriptions_.insert(std::make_pair(ntohs(type[0]), ntohs(type[1])));
+    }
+    subscribed_all_ = subscriptions_.empty();
+  }
+
+
+  if (msg_type == PB_CONTROL_MSG_COMPRESSION) {
+    int codec = PB_COMPRESSION_NONE;
+    if (in_frame_header_.compression == parent_->compression_codec_) {
+      codec = parent_->compression_codec_;
+    }
+
+    if (codec != PB_COMPRESSION_NONE) {
+      std::lock_guard<std::mutex> lock(outbound_mutex_);
+      if (! compressor_) {
+	compressor_ = std::make_shared<BufferCompressor>(codec, parent_->compression_threshold_);
+      }
+    }
+
+    QueueEntry *entry = new QueueEntry();
+    entry->frame_header.header_version = PB_FRAME_V3;
+    entry->frame_header.compression    = codec;
+    entry->frame_header.payload_size   = htonl(sizeof(message_header_t));
+    entry->message_header.component_id = htons(PB_CONTROL_COMP_ID);
+    entry->message_header.msg_type     = htons(PB_CONTROL_MSG_COMPRESSION);
+
+    entry->buffers[0] = boost::asio::buffer(&entry->frame_header, sizeof(frame_header_t));
+    entry->buffers[1] = boost::asio::buffer(&entry->message_header, sizeof(message_header_t));
+    entry->buffers[2] = boost::asio::const_buffer();
+    enqueue(entry);
+  }
+}
+
+
 /** @class ProtobufStreamServer <protobuf_comm/server.h>
  * Stream server for protobuf message transmission.
  * The server opens a TCP socket (IPv4) and waits for incoming connections.
+ * Optionally, it can additionally listen on a Unix domain socket for
+ * clients running on the same host, see listen_local().
  * Each incoming connection is given a unique client ID. Signals are
  * provided that can be used to react to connections and incoming data.
+ * Clients may subscribe to a set of message types, in which case other
+ * messages are dropped for this client before serialization.
  * @author Tim Niemueller
  */
 
@@ -250,11 +361,13 @@ ProtobufStreamServer::Session::handle_read_message(const boost::system::error_co
  */
 ProtobufStreamServer::ProtobufStreamServer(unsigned short port)
   : io_service_(),
-    acceptor_(io_service_, ip::tcp::endpoint(ip::tcp::v6(), port))
+    acceptor_(io_service_, ip::tcp::endpoint(ip::tcp::v6(), port)),
+    local_acceptor_(io_service_)
 {
   message_register_ = new MessageRegister();
   own_message_register_ = true;
   next_cid_ = 1;
+  set_compression(PB_COMPRESSION_ZLIB);
 
   acceptor_.set_option(socket_base::reuse_address(true));
 
@@ -272,11 +385,13 @@ ProtobufStreamServer::ProtobufStreamServer(unsigned short port)
 ProtobufStreamServer::ProtobufStreamServer(unsigned short port,
 					   std::vector<std::string> &proto_path)
   : io_service_(),
-    acceptor_(io_service_, ip::tcp::endpoint(ip::tcp::v6(), port))
+    acceptor_(io_service_, ip::tcp::endpoint(ip::tcp::v6(), port)),
+    local_acceptor_(io_service_)
 {
   message_register_ = new MessageRegister(proto_path);
   own_message_register_ = true;
   next_cid_ = 1;
+  set_compression(PB_COMPRESSION_ZLIB);
 
   acceptor_.set_option(socket_base::reuse_address(true));
 
@@ -292,9 +407,11 @@ ProtobufStreamServer::ProtobufStreamServer(unsigned short port,
 					   MessageRegister *mr)
   : io_service_(),
     acceptor_(io_service_, ip::tcp::endpoint(ip::tcp::v6(), port)),
+    local_acceptor_(io_service_),
     message_register_(mr), own_message_register_(false)
 {
   next_cid_ = 1;
+  set_compression(PB_COMPRESSION_ZLIB);
 
   acceptor_.set_option(socket_base::reuse_address(true));
 
@@ -308,12 +425,46 @@ ProtobufStreamServer::~ProtobufStreamServer()
 {
   io_service_.stop();
   asio_thread_.join();
+  if (! local_socket_path_.empty()) {
+    unlink(local_socket_path_.c_str());
+  }
   if (own_message_register_) {
     delete message_register_;
   }
 }
 
 
+/// @cond INTERNALS
+/* Get component ID and message type from the CompType enum of a message. */
+static void
+get_comp_type(google::protobuf::Message &m, uint16_t &component_id, uint16_t &msg_type)
+{
+  const google::protobuf::Descriptor *desc = m.GetDescriptor();
+  const google::protobuf::EnumDescriptor *enumdesc = desc->FindEnumTypeByName("CompType");
+  if (! enumdesc) {
+    throw std::logic_error("Message does not have CompType enum");
+  }
+  const google::protobuf::EnumValueDescriptor *compdesc =
+    enumdesc->FindValueByName("COMP_ID");
+  const google::protobuf::EnumValueDescriptor *msgtdesc =
+    enumdesc->FindValueByName("MSG_TYPE");
+  if (! compdesc || ! msgtdesc) {
+    throw std::logic_error("Message CompType enum hs no COMP_ID or MSG_TYPE value");
+  }
+  int comp_id = compdesc->number();
+  int mtype = msgtdesc->number();
+  if (comp_id < 0 || comp_id > std::numeric_limits<uint16_t>::max()) {
+    throw std::logic_error("Message has invalid COMP_ID");
+  }
+  if (mtype < 0 || mtype > std::numeric_limits<uint16_t>::max()) {
+    throw std::logic_error("Message has invalid MSG_TYPE");
+  }
+  component_id = comp_id;
+  msg_type = mtype;
+}
+/// @endcond
+
+
 /** Send a message to the given client.
  * @param client ID of the client to addresss
  * @param component_id ID of the component to address
@@ -324,11 +475,12 @@ void
 ProtobufStreamServer::send(ClientID client, uint16_t component_id, uint16_t msg_type,
 			   google::protobuf::Message &m)
 {
-  if (sessions_.find(client) == sessions_.end()) {
+  Session::Ptr session = find_session(client);
+  if (! session) {
     throw std::runtime_error("Client does not exist");
   }
 
-  sessions_[client]->send(component_id, msg_type, m);
+  session->send(component_id, msg_type, m);
 }
 
 
@@ -353,27 +505,8 @@ ProtobufStreamServer::send(ClientID client, uint16_t component_id, uint16_t msg_
 void
 ProtobufStreamServer::send(ClientID client, google::protobuf::Message &m)
 {
-  const google::protobuf::Descriptor *desc = m.GetDescriptor();
-  const google::protobuf::EnumDescriptor *enumdesc = desc->FindEnumTypeByName("CompType");
-  if (! enumdesc) {
-    throw std::logic_error("Message does not have CompType enum");
-  }
-  const google::protobuf::EnumValueDescriptor *compdesc =
-    enumdesc->FindValueByName("COMP_ID");
-  const google::protobuf::EnumValueDescriptor *msgtdesc =
-    enumdesc->FindValueByName("MSG_TYPE");
-  if (! compdesc || ! msgtdesc) {
-    throw std::logic_error("Message CompType enum hs no COMP_ID or MSG_TYPE value");
-  }
-  int comp_id = compdesc->number();
-  int msg_type = msgtdesc->number();
-  if (comp_id < 0 || comp_id > std::numeric_limits<uint16_t>::max()) {
-    throw std::logic_error("Message has invalid COMP_ID");
-  }
-  if (msg_type < 0 || msg_type > std::numeric_limits<uint16_t>::max()) {
-    throw std::logic_error("Message has invalid MSG_TYPE");
-  }
-
+  uint16_t comp_id, msg_type;
+  get_comp_type(m, comp_id, msg_type);
   send(client, comp_id, msg_type, m);
 }
 
@@ -397,9 +530,8 @@ void
 ProtobufStreamServer::send_to_all(uint16_t component_id, uint16_t msg_type,
 				  google::protobuf::Message &m)
 {
-  std::map<ClientID, boost::shared_ptr<Session>>::iterator s;
-  for (s = sessions_.begin(); s != sessions_.end(); ++s) {
-    send(s->first, component_id, msg_type, m);
+  for (Session::Ptr &session : all_sessions()) {
+    session->send(component_id, msg_type, m);
   }
 }
 
@@ -412,10 +544,7 @@ void
 ProtobufStreamServer::send_to_all(uint16_t component_id, uint16_t msg_type,
 				  std::shared_ptr<google::protobuf::Message> m)
 {
-  std::map<ClientID, boost::shared_ptr<Session>>::iterator s;
-  for (s = sessions_.begin(); s != sessions_.end(); ++s) {
-    send(s->first, component_id, msg_type, m);
-  }
+  send_to_all(component_id, msg_type, *m);
 }
 
 /** Send a message to all clients.
@@ -424,10 +553,7 @@ ProtobufStreamServer::send_to_all(uint16_t component_id, uint16_t msg_type,
 void
 ProtobufStreamServer::send_to_all(std::shared_ptr<google::protobuf::Message> m)
 {
-  std::map<ClientID, boost::shared_ptr<Session>>::iterator s;
-  for (s = sessions_.begin(); s != sessions_.end(); ++s) {
-    send(s->first, m);
-  }
+  send_to_all(*m);
 }
 
 /** Send a message to all clients.
@@ -436,10 +562,9 @@ ProtobufStreamServer::send_to_all(std::shared_ptr<google::protobuf::Message> m)
 void
 ProtobufStreamServer::send_to_all(google::protobuf::Message &m)
 {
-  std::map<ClientID, boost::shared_ptr<Session>>::iterator s;
-  for (s = sessions_.begin(); s != sessions_.end(); ++s) {
-    send(s->first, m);
-  }
+  uint16_t comp_id, msg_type;
+  get_comp_type(m, comp_id, msg_type);
+  send_to_all(comp_id, msg_type, m);
 }
 
 
@@ -449,10 +574,77 @@ ProtobufStreamServer::send_to_all(google::protobuf::Message &m)
 void
 ProtobufStreamServer::disconnect(ClientID client)
 {
-  if (sessions_.find(client) != sessions_.end()) {
-    boost::shared_ptr<Session> session = sessions_[client];
-    session->disconnect();
+  Session::Ptr session = find_session(client);
+  if (session)  session->disconnect();
+}
+
+/** Check if a client subscribed to a message type.
+ * @param client client ID to check
+ * @param component_id ID of the component
+ * @param msg_type numeric message type
+ * @return true if the client exists and messages of the given type are
+ * sent to it, false otherwise
+ */
+bool
+ProtobufStreamServer::subscribed(ClientID client, uint16_t component_id, uint16_t msg_type)
+{
+  Session::Ptr session = find_session(client);
+  return session && session->subscribed(component_id, msg_type);
+}
+
+
+/** Check if any client subscribed to a message type.
+ * This can be used to avoid creating messages nobody receives.
+ * @param component_id ID of the component
+ * @param msg_type numeric message type
+ * @return true if at least one client receives messages of the given type
+ */
+bool
+ProtobufStreamServer::subscribed_any(uint16_t component_id, uint16_t msg_type)
+{
+  for (Session::Ptr &session : all_sessions()) {
+    if (session->subscribed(component_id, msg_type))  return true;
+  }
+  return false;
+}
+
+
+/** Set compression to offer to clients.
+ * Compression is only used for clients which announce support for the same
+ * codec after connecting. By default zlib is offered if available. It
+ * applies to clients connecting afterwards.
+ * @param codec codec to offer, one of PB_COMPRESSION_*, PB_COMPRESSION_NONE
+ * disables compression. If the codec is not supported, compression is disabled.
+ * @param threshold minimum size in bytes of messages to compress
+ */
+void
+ProtobufStreamServer::set_compression(int codec, size_t threshold)
+{
+  compression_codec_     = compression_supported(codec) ? codec : PB_COMPRESSION_NONE;
+  compression_threshold_ = threshold;
+}
+
+/** Additionally listen on a Unix domain socket.
+ * Clients on the same host can connect through this socket instead of
+ * the TCP loopback device, avoiding the TCP stack. A stale socket file
+ * at the given path is removed. The socket file is deleted when the
+ * server is destroyed.
+ * @param socket_path file system path of the socket to create
+ */
+void
+ProtobufStreamServer::listen_local(const std::string &socket_path)
+{
+  if (! local_socket_path_.empty()) {
+    throw std::logic_error("Already listening on local socket " + local_socket_path_);
   }
+  unlink(socket_path.c_str());
+  local::stream_protocol::endpoint endpoint(socket_path);
+  local_acceptor_.open(endpoint.protocol());
+  local_acceptor_.bind(endpoint);
+  local_acceptor_.listen();
+  local_socket_path_ = socket_path;
+
+  io_service_.post(boost::bind(&ProtobufStreamServer::start_local_accept, this));
 }
 
 /** Start accepting connections. */
@@ -462,29 +654,72 @@ ProtobufStreamServer::start_accept()
   Session::Ptr new_session(new Session(next_cid_++, this, io_service_));
   acceptor_.async_accept(new_session->socket(),
 			 boost::bind(&ProtobufStreamServer::handle_accept, this,
-				     new_session, boost::asio::placeholders::error));
+				     new_session, boost::asio::placeholders::error, false));
+}
+
+/** Start accepting connections on the local socket. */
+void
+ProtobufStreamServer::start_local_accept()
+{
+  Session::Ptr new_session(new Session(next_cid_++, this, io_service_));
+  local_acceptor_.async_accept(new_session->socket(),
+			       boost::bind(&ProtobufStreamServer::handle_accept, this,
+					   new_session, boost::asio::placeholders::error, true));
 }
 
 void
 ProtobufStreamServer::disconnected(boost::shared_ptr<Session> session,
 				   const boost::system::error_code &error)
 {
-  sessions_.erase(session->id());
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    sessions_.erase(session->id());
+  }
   sig_disconnected_(session->id(), error);
 }
 
 void
 ProtobufStreamServer::handle_accept(Session::Ptr new_session,
-				    const boost::system::error_code& error)
+				    const boost::system::error_code& error,
+				    bool local)
 {
   if (!error) {
     new_session->start_session();
-    sessions_[new_session->id()] = new_session;
+    {
+      std::lock_guard<std::mutex> lock(sessions_mutex_);
+      sessions_[new_session->id()] = new_session;
+    }
     sig_connected_(new_session->id(), new_session->remote_endpoint());
     new_session->start_read();
   }
 
-  start_accept();
+  if (local) {
+    start_local_accept();
+  } else {
+    start_accept();
+  }
+}
+
+
+/* Get session of a client, sessions are used from other threads than
+ * the asio thread, which adds and removes them. */
+ProtobufStreamServer::Session::Ptr
+ProtobufStreamServer::find_session(ClientID client)
+{
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  std::map<ClientID, Session::Ptr>::iterator s = sessions_.find(client);
+  return (s != sessions_.end()) ? s->second : Session::Ptr();
+}
+
+/* Get all current sessions, cf. find_session(). */
+std::vector<ProtobufStreamServer::Session::Ptr>
+ProtobufStreamServer::all_sessions()
+{
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  std::vector<Session::Ptr> sessions;
+  sessions.reserve(sessions_.size());
+  for (const auto &s : sessions_)  sessions.push_back(s.second);
+  return sessions;
 }
 
 
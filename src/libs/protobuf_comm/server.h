@@ -49,16 +49,19 @@
 #ifndef _GLIBCXX_USE_SCHED_YIELD
 #  define _GLIBCXX_USE_SCHED_YIELD
 #endif
+#include <memory>
 #include <thread>
 #include <mutex>
 #include <queue>
 #include <atomic>
+#include <set>
 
 namespace protobuf_comm {
 #if 0 /* just to make Emacs auto-indent happy */
 }
 #endif
 
+class BufferCompressor;
 class ProtobufStreamServer
 {
  public:
@@ -86,6 +89,13 @@ class ProtobufStreamServer
 
   void disconnect(ClientID client);
 
+  bool subscribed(ClientID client, uint16_t component_id, uint16_t msg_type);
+  bool subscribed_any(uint16_t component_id, uint16_t msg_type);
+
+  void set_compression(int codec, size_t threshold = 256);
+
+  void listen_local(const std::string &socket_path);
+
   /** Get the server's message register.
    * @return message register
    */
@@ -130,7 +140,7 @@ class ProtobufStreamServer
 
     /** Get underlying socket.
      * @return socket */
-    boost::asio::ip::tcp::socket & socket() { return socket_; }
+    boost::asio::generic::stream_protocol::socket & socket() { return socket_; }
 
     /** Get client ID.
      * @return client ID */
@@ -145,17 +155,20 @@ class ProtobufStreamServer
     void send(uint16_t component_id, uint16_t msg_type,
 	      google::protobuf::Message &m);
     void disconnect();
+    bool subscribed(uint16_t component_id, uint16_t msg_type);
 
    private:
     void handle_read_message(const boost::system::error_code& error);
     void handle_read_header(const boost::system::error_code& error);
     void handle_write(const boost::system::error_code& error,
 		      size_t /*bytes_transferred*/, QueueEntry *entry);
+    void handle_control(uint16_t msg_type, const char *data, size_t data_size);
+    void enqueue(QueueEntry *entry);
 
    private:
     ClientID id_;
     ProtobufStreamServer *parent_;
-    boost::asio::ip::tcp::socket socket_;
+    boost::asio::generic::stream_protocol::socket socket_;
     boost::asio::ip::tcp::endpoint remote_endpoint_;
 
     frame_header_t in_frame_header_;
@@ -165,19 +178,32 @@ class ProtobufStreamServer
     std::queue<QueueEntry *> outbound_queue_;
     std::mutex               outbound_mutex_;
     bool                     outbound_active_;
+
+    std::shared_ptr<BufferCompressor> compressor_;
+
+    std::mutex                                subscriptions_mutex_;
+    bool                                      subscribed_all_;
+    std::set<std::pair<uint16_t, uint16_t>>   subscriptions_;
   };
 
  private: // methods
   void run_asio();
   void start_accept();
-  void handle_accept(Session::Ptr new_session, const boost::system::error_code& error);
+  void start_local_accept();
+  void handle_accept(Session::Ptr new_session, const boost::system::error_code& error,
+		     bool local);
 
   void disconnected(boost::shared_ptr<Session> session,
 		    const boost::system::error_code &error);
 
+  Session::Ptr find_session(ClientID client);
+  std::vector<Session::Ptr> all_sessions();
+
  private: // members
   boost::asio::io_service io_service_;
   boost::asio::ip::tcp::acceptor acceptor_;
+  boost::asio::local::stream_protocol::acceptor local_acceptor_;
+  std::string local_socket_path_;
   boost::signals2::signal<void (ClientID, uint16_t, uint16_t,
 				std::shared_ptr<google::protobuf::Message>)> sig_rcvd_;
   boost::signals2::signal<void (ClientID, uint16_t, uint16_t, std::string)> sig_recv_failed_;
@@ -188,11 +214,15 @@ class ProtobufStreamServer
   std::thread asio_thread_;
 
   std::map<ClientID, boost::shared_ptr<Session>> sessions_;
+  std::mutex                                     sessions_mutex_;
 
   std::atomic<ClientID> next_cid_;
 
   MessageRegister *message_register_;
   bool             own_message_register_;
+
+  int    compression_codec_;
+  size_t compression_threshold_;
 };
 
 } // end namespace protobuf_comm
@@ -0,0 +1,342 @@
+/***************************************************************************
+ *  beacon_processor.cpp - LLSF RefBox native robot beacon processing
+ *
+ *  Created: Mon Oct 19 00:36:33 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "beacon_processor.h"
+
+#include <core/threading/mutex_locker.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/descriptor.h>
+
+namespace llsfrb {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+/** @class BeaconProcessor "beacon_processor.h"
+ * Process robot beacon signals natively.
+ * Every robot sends a BeaconSignal multiple times per second. Instead
+ * of asserting each of them as protobuf-msg fact and translating it to a
+ * robot-beacon fact in CLIPS, the processor keeps a table of the robots
+ * with their host, name, team color, last seen time, and pose. A
+ * robot-beacon fact is only asserted if a robot is seen for the first
+ * time or its name, team color, host, or pose availability changed,
+ * and at most once per update period if only the time and pose changed.
+ * Robots are identified by team name and number taken from the beacons
+ * without further checks. Therefore, robots not seen for longer than the
+ * remove timeout are dropped from the table, and beacons of new robots
+ * are ignored while the table is full.
+ * @author agent
+ */
+
+/// @cond INTERNALS
+static const size_t BEACON_MAX_ROBOTS = 1024;
+/// @endcond
+
+/** Get integer value of a field, independent of its exact type.
+ * @param m message to get value from
+ * @param field field to get
+ * @return field value
+ */
+static long long
+field_integer(const google::protobuf::Message &m,
+	      const google::protobuf::FieldDescriptor *field)
+{
+  const google::protobuf::Reflection *refl = m.GetReflection();
+  switch (field->cpp_type()) {
+  case google::protobuf::FieldDescriptor::CPPTYPE_INT32:  return refl->GetInt32(m, field);
+  case google::protobuf::FieldDescriptor::CPPTYPE_INT64:  return refl->GetInt64(m, field);
+  case google::protobuf::FieldDescriptor::CPPTYPE_UINT32: return refl->GetUInt32(m, field);
+  case google::protobuf::FieldDescriptor::CPPTYPE_UINT64: return refl->GetUInt64(m, field);
+  default: return 0;
+  }
+}
+
+/** Get floating point value of a field, independent of its exact type.
+ * @param m message to get value from
+ * @param field field to get
+ * @return field value
+ */
+static double
+field_double(const google::protobuf::Message &m,
+	     const google::protobuf::FieldDescriptor *field)
+{
+  const google::protobuf::Reflection *refl = m.GetReflection();
+  switch (field->cpp_type()) {
+  case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:  return refl->GetFloat(m, field);
+  case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE: return refl->GetDouble(m, field);
+  default: return (double)field_integer(m, field);
+  }
+}
+
+/** Get time from a Time message.
+ * @param m Time message
+ * @param sec seconds field
+ * @param nsec nanoseconds field
+ * @return time value
+ */
+static struct timeval
+field_time(const google::protobuf::Message &m,
+	   const google::protobuf::FieldDescriptor *sec,
+	   const google::protobuf::FieldDescriptor *nsec)
+{
+  struct timeval tv;
+  tv.tv_sec  = field_integer(m, sec);
+  tv.tv_usec = field_integer(m, nsec) / 1000;
+  return tv;
+}
+
+
+/** Constructor.
+ * @param env CLIPS environment to assert robot-beacon facts to
+ * @param update_period minimum time in seconds between two updates of
+ * a robot if only its time and pose changed
+ * @param remove_timeout time in seconds after which a robot which has not
+ * been seen is removed from the table
+ */
+BeaconProcessor::BeaconProcessor(CLIPS::Environment *env, double update_period,
+				 double remove_timeout)
+  : clips_(env), update_period_(update_period), remove_timeout_(remove_timeout),
+    beacon_desc_(NULL)
+{
+}
+
+
+/** Destructor. */
+BeaconProcessor::~BeaconProcessor()
+{
+}
+
+
+/** Resolve and check fields of the beacon signal message type.
+ * @param desc descriptor of the received beacon message
+ * @return true if all required fields were found, false otherwise
+ */
+bool
+BeaconProcessor::resolve_fields(const google::protobuf::Descriptor *desc)
+{
+  beacon_desc_ = NULL;
+
+  BeaconFields f;
+  f.time       = desc->FindFieldByName("time");
+  f.seq        = desc->FindFieldByName("seq");
+  f.number     = desc->FindFieldByName("number");
+  f.team_name  = desc->FindFieldByName("team_name");
+  f.peer_name  = desc->FindFieldByName("peer_name");
+  f.team_color = desc->FindFieldByName("team_color");
+  f.pose       = desc->FindFieldByName("pose");
+  if (! (f.time && f.seq && f.number && f.team_name && f.peer_name &&
+	 f.team_color && f.pose) ||
+      f.time->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE ||
+      f.pose->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE ||
+      f.team_color->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_ENUM)
+  {
+    return false;
+  }
+
+  const google::protobuf::Descriptor *time_desc = f.time->message_type();
+  f.time_sec  = time_desc->FindFieldByName("sec");
+  f.time_nsec = time_desc->FindFieldByName("nsec");
+
+  const google::protobuf::Descriptor *pose_desc = f.pose->message_type();
+  f.pose_x         = pose_desc->FindFieldByName("x");
+  f.pose_y         = pose_desc->FindFieldByName("y");
+  f.pose_ori       = pose_desc->FindFieldByName("ori");
+  f.pose_timestamp = pose_desc->FindFieldByName("timestamp");
+  if (! (f.time_sec && f.time_nsec && f.pose_x && f.pose_y && f.pose_ori &&
+	 f.pose_timestamp) ||
+      f.pose_timestamp->message_type() != time_desc)
+  {
+    return false;
+  }
+
+  fields_      = f;
+  beacon_desc_ = desc;
+  return true;
+}
+
+
+/** Handle a received beacon signal.
+ * Meant to be registered as message handler with the protobuf
+ * communicator. It is called from the receiving thread.
+ * @param endpoint host and port of the sender
+ * @param rcvd_at time when the message was received
+ * @param msg the BeaconSignal message
+ * @return true if the message has been processed or ignored because the
+ * robot table is full, false if it did not have the expected fields and
+ * should be handled in CLIPS
+ */
+bool
+BeaconProcessor::handle_beacon(const std::pair<std::string, unsigned short> &endpoint,
+			       const struct timeval &rcvd_at,
+			       std::shared_ptr<google::protobuf::Message> &msg)
+{
+  fawkes::MutexLocker lock(&mutex_);
+
+  const google::protobuf::Message &m = *msg;
+  if (m.GetDescriptor() != beacon_desc_ && ! resolve_fields(m.GetDescriptor())) {
+    return false;
+  }
+
+  const google::protobuf::Reflection *refl = m.GetReflection();
+  std::pair<std::string, unsigned int> key(refl->GetString(m, fields_.team_name),
+					   field_integer(m, fields_.number));
+
+  std::string peer_name  = refl->GetString(m, fields_.peer_name);
+  // unset yields the default value, like pb-field-value in CLIPS
+  std::string team_color = refl->GetEnum(m, fields_.team_color)->name();
+  bool has_pose = refl->HasField(m, fields_.pose);
+
+  std::map<std::pair<std::string, unsigned int>, Robot>::iterator r = robots_.find(key);
+  if (r == robots_.end()) {
+    if (robots_.size() >= BEACON_MAX_ROBOTS)  return true;
+    Robot robot;
+    robot.changed     = true;
+    robot.last_pushed = 0.;
+    r = robots_.insert(std::make_pair(key, robot)).first;
+  } else {
+    Robot &robot = r->second;
+    if (robot.peer_name != peer_name || robot.team_color != team_color ||
+	robot.host != endpoint.first || robot.port != endpoint.second ||
+	robot.has_pose != has_pose)
+    {
+      robot.changed = true;
+    }
+  }
+
+  Robot &robot     = r->second;
+  robot.peer_name  = peer_name;
+  robot.team_color = team_color;
+  robot.host       = endpoint.first;
+  robot.port       = endpoint.second;
+  robot.seq        = field_integer(m, fields_.seq);
+  robot.time       = field_time(refl->GetMessage(m, fields_.time),
+				fields_.time_sec, fields_.time_nsec);
+  robot.rcvd_at    = rcvd_at;
+  robot.has_pose   = has_pose;
+  if (has_pose) {
+    const google::protobuf::Message &pose = refl->GetMessage(m, fields_.pose);
+    robot.pose[0]   = field_double(pose, fields_.pose_x);
+    robot.pose[1]   = field_double(pose, fields_.pose_y);
+    robot.pose[2]   = field_double(pose, fields_.pose_ori);
+    robot.pose_time = field_time(pose.GetReflection()->GetMessage(pose, fields_.pose_timestamp),
+				 fields_.time_sec, fields_.time_nsec);
+  } else {
+    robot.pose[0] = robot.pose[1] = robot.pose[2] = 0.;
+    robot.pose_time.tv_sec = robot.pose_time.tv_usec = 0;
+  }
+  robot.updated = true;
+
+  return true;
+}
+
+
+/** Assert robot-beacon facts for robots which need an update.
+ * A fact is asserted for robots which were seen for the first time or
+ * changed, and for updated robots if the update period has elapsed.
+ * Robots not seen for longer than the remove timeout are removed.
+ * Must be called with the CLIPS environment locked.
+ * @param now_tv current time, same clock as the reception times
+ * @return number of asserted facts
+ */
+unsigned int
+BeaconProcessor::assert_updates(const struct timeval &now_tv)
+{
+  fawkes::MutexLocker lock(&mutex_);
+
+  if (robots_.empty())  return 0;
+
+  if (! beacon_template_) {
+    beacon_template_ = clips_->get_template("robot-beacon");
+    if (! beacon_template_)  return 0;
+  }
+
+  double now = now_tv.tv_sec + now_tv.tv_usec / 1000000.;
+
+  unsigned int num_asserted = 0;
+  std::map<std::pair<std::string, unsigned int>, Robot>::iterator r = robots_.begin();
+  while (r != robots_.end()) {
+    Robot &robot = r->second;
+    double seen = robot.rcvd_at.tv_sec + robot.rcvd_at.tv_usec / 1000000.;
+    if (! robot.changed && (now - seen) > remove_timeout_) {
+      robots_.erase(r++);
+      continue;
+    }
+    if (! (robot.changed ||
+	   (robot.updated && (now - robot.last_pushed) >= update_period_)))
+    {
+      ++r;
+      continue;
+    }
+
+    CLIPS::Fact::pointer fact = CLIPS::Fact::create(*clips_, beacon_template_);
+    CLIPS::Values rcvd_at(2, CLIPS::Value(CLIPS::TYPE_INTEGER));
+    rcvd_at[0] = robot.rcvd_at.tv_sec;
+    rcvd_at[1] = robot.rcvd_at.tv_usec;
+    fact->set_slot("rcvd-at", rcvd_at);
+    fact->set_slot("seq", robot.seq);
+    CLIPS::Values time(2, CLIPS::Value(CLIPS::TYPE_INTEGER));
+    time[0] = robot.time.tv_sec;
+    time[1] = robot.time.tv_usec;
+    fact->set_slot("time", time);
+    fact->set_slot("number", (long long int)r->first.second);
+    fact->set_slot("team-name", r->first.first);
+    fact->set_slot("team-color", CLIPS::Value(robot.team_color, CLIPS::TYPE_SYMBOL));
+    fact->set_slot("peer-name", robot.peer_name);
+    fact->set_slot("host", robot.host);
+    fact->set_slot("port", (long long int)robot.port);
+    fact->set_slot("has-pose", CLIPS::Value(robot.has_pose ? "TRUE" : "FALSE",
+					    CLIPS::TYPE_SYMBOL));
+    CLIPS::Values pose(3, CLIPS::Value(CLIPS::TYPE_FLOAT));
+    pose[0] = robot.pose[0];
+    pose[1] = robot.pose[1];
+    pose[2] = robot.pose[2];
+    fact->set_slot("pose", pose);
+    CLIPS::Values pose_time(2, CLIPS::Value(CLIPS::TYPE_INTEGER));
+    pose_time[0] = robot.pose_time.tv_sec;
+    pose_time[1] = robot.pose_time.tv_usec;
+    fact->set_slot("pose-time", pose_time);
+
+    if (clips_->assert_fact(fact))  ++num_asserted;
+
+    robot.changed     = false;
+    robot.updated     = false;
+    robot.last_pushed = now;
+    ++r;
+  }
+
+  return num_asserted;
+}
+
+} // end of namespace llsfrb
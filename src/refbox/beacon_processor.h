@@ -0,0 +1,123 @@
+/***************************************************************************
+ *  beacon_processor.h - LLSF RefBox native robot beacon processing
+ *
+ *  Created: Mon Oct 19 00:36:33 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LLSF_REFBOX_BEACON_PROCESSOR_H_
+#define __LLSF_REFBOX_BEACON_PROCESSOR_H_
+
+#include <core/threading/mutex.h>
+#include <clipsmm.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/time.h>
+
+namespace google {
+  namespace protobuf {
+    class Message;
+    class Descriptor;
+    class FieldDescriptor;
+  }
+}
+
+namespace llsfrb {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+class BeaconProcessor
+{
+ public:
+  BeaconProcessor(CLIPS::Environment *env, double update_period, double remove_timeout);
+  ~BeaconProcessor();
+
+  bool handle_beacon(const std::pair<std::string, unsigned short> &endpoint,
+		     const struct timeval &rcvd_at,
+		     std::shared_ptr<google::protobuf::Message> &msg);
+
+  unsigned int assert_updates(const struct timeval &now_tv);
+
+ private:
+  bool resolve_fields(const google::protobuf::Descriptor *desc);
+
+ private:
+  /// @cond INTERNALS
+  typedef struct {
+    std::string    peer_name;
+    std::string    team_color;
+    std::string    host;
+    unsigned short port;
+    long long      seq;
+    struct timeval time;
+    struct timeval rcvd_at;
+    bool           has_pose;
+    double         pose[3];
+    struct timeval pose_time;
+    bool           changed;
+    bool           updated;
+    double         last_pushed;
+  } Robot;
+
+  typedef struct {
+    const google::protobuf::FieldDescriptor *time;
+    const google::protobuf::FieldDescriptor *seq;
+    const google::protobuf::FieldDescriptor *number;
+    const google::protobuf::FieldDescriptor *team_name;
+    const google::protobuf::FieldDescriptor *peer_name;
+    const google::protobuf::FieldDescriptor *team_color;
+    const google::protobuf::FieldDescriptor *pose;
+    const google::protobuf::FieldDescriptor *pose_x;
+    const google::protobuf::FieldDescriptor *pose_y;
+    const google::protobuf::FieldDescriptor *pose_ori;
+    const google::protobuf::FieldDescriptor *pose_timestamp;
+    const google::protobuf::FieldDescriptor *time_sec;
+    const google::protobuf::FieldDescriptor *time_nsec;
+  } BeaconFields;
+  /// @endcond
+
+  CLIPS::Environment       *clips_;
+  CLIPS::Template::pointer  beacon_template_;
+  double                    update_period_;
+  double                    remove_timeout_;
+
+  fawkes::Mutex                                              mutex_;
+  std::map<std::pair<std::string, unsigned int>, Robot>      robots_;
+  const google::protobuf::Descriptor                        *beacon_desc_;
+  BeaconFields                                               fields_;
+};
+
+} // end of namespace llsfrb
+
+#endif
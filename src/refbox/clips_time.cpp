@@ -0,0 +1,132 @@
+
+/***************************************************************************
+ *  clips_time.cpp - LLSF RefBox CLIPS time functions
+ *
+ *  Created: Mon Oct 19 01:38:10 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "clips_time.h"
+
+namespace llsfrb {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+/** Get seconds or microseconds part of a CLIPS time value.
+ * Missing entries are treated as zero, floats are truncated like the
+ * former CLIPS implementation did when doing integer arithmetic.
+ * @param t time value as (sec usec) multifield
+ * @param i index of part to get
+ * @return requested part of time value
+ */
+static inline long long
+clips_time_part(const CLIPS::Values &t, size_t i)
+{
+  if (t.size() <= i)  return 0;
+  if (t[i].type() == CLIPS::TYPE_FLOAT)  return (long long)t[i].as_float();
+  return t[i].as_integer();
+}
+
+/** Get value of a CLIPS number, integer or float.
+ * @param v value to convert
+ * @return value as double
+ */
+double
+clips_number(const CLIPS::Value &v)
+{
+  return (v.type() == CLIPS::TYPE_FLOAT) ? v.as_float() : (double)v.as_integer();
+}
+
+/** Get difference of two CLIPS time values.
+ * @param t1 time value as (sec usec) multifield
+ * @param t2 time value as (sec usec) multifield
+ * @return ?t1 - ?t2 as (sec usec) multifield
+ */
+CLIPS::Values
+clips_time_diff(CLIPS::Values t1, CLIPS::Values t2)
+{
+  long long sec  = clips_time_part(t1, 0) - clips_time_part(t2, 0);
+  long long usec = clips_time_part(t1, 1) - clips_time_part(t2, 1);
+  if (usec < 0) {
+    sec  -= 1;
+    usec += 1000000;
+  }
+  CLIPS::Values rv;
+  rv.push_back(sec);
+  rv.push_back(usec);
+  return rv;
+}
+
+
+/** Get difference of two CLIPS time values in seconds.
+ * @param t1 time value as (sec usec) multifield
+ * @param t2 time value as (sec usec) multifield
+ * @return ?t1 - ?t2 in seconds as float
+ */
+CLIPS::Value
+clips_time_diff_sec(CLIPS::Values t1, CLIPS::Values t2)
+{
+  return (double)(clips_time_part(t1, 0) - clips_time_part(t2, 0)) +
+    (double)(clips_time_part(t1, 1) - clips_time_part(t2, 1)) / 1000000.;
+}
+
+
+/** Check if a timeout has passed.
+ * @param now current time as (sec usec) multifield
+ * @param time start time as (sec usec) multifield
+ * @param timeout timeout in seconds
+ * @return TRUE if more than ?timeout seconds passed since ?time, FALSE otherwise
+ */
+CLIPS::Value
+clips_timeout(CLIPS::Values now, CLIPS::Values time, CLIPS::Value timeout)
+{
+  double diff = (double)(clips_time_part(now, 0) - clips_time_part(time, 0)) +
+    (double)(clips_time_part(now, 1) - clips_time_part(time, 1)) / 1000000.;
+  return CLIPS::Value(diff > clips_number(timeout) ? "TRUE" : "FALSE", CLIPS::TYPE_SYMBOL);
+}
+
+
+/** Register time functions with a CLIPS environment.
+ * The functions time-diff, time-diff-sec, and timeout are evaluated on
+ * the LHS of periodic rules and therefore are provided natively instead
+ * of as deffunctions. Nothing else may define functions of these names.
+ * @param clips CLIPS environment to add functions to
+ */
+void
+setup_clips_time(CLIPS::Environment *clips)
+{
+  clips->add_function("time-diff", sigc::slot<CLIPS::Values, CLIPS::Values, CLIPS::Values>(sigc::ptr_fun(&clips_time_diff)));
+  clips->add_function("time-diff-sec", sigc::slot<CLIPS::Value, CLIPS::Values, CLIPS::Values>(sigc::ptr_fun(&clips_time_diff_sec)));
+  clips->add_function("timeout", sigc::slot<CLIPS::Value, CLIPS::Values, CLIPS::Values, CLIPS::Value>(sigc::ptr_fun(&clips_timeout)));
+}
+
+} // end namespace llsfrb
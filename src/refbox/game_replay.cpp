@@ -0,0 +1,635 @@
+/***************************************************************************
+ *  game_replay.cpp - LLSF RefBox replay of recorded games
+ *
+ *  Created: Mon Oct 19 01:03:41 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "game_replay.h"
+
+#include <core/exception.h>
+#include <logging/logger.h>
+#include <protobuf_clips/communicator.h>
+#include <mps_placing_clips/mps_placing_clips.h>
+#include <protobuf_comm/message_register.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/descriptor.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef HAVE_MONGODB
+#  include <mongo/client/dbclient.h>
+#endif
+
+using namespace protobuf_clips;
+
+namespace llsfrb {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+/// @cond INTERNALS
+// segments are named traffic-<start time>-<index>.journal, cf. TrafficJournalWriter
+static const char   SEGMENT_PREFIX[]         = "traffic-";
+static const char   SEGMENT_SUFFIX[]         = ".journal";
+static const size_t SEGMENT_INDEX_SUFFIX_LEN = 14;	// "-NNNNN.journal"
+/// @endcond
+
+/** Get the run a journal segment belongs to.
+ * @param name file name of the segment
+ * @return name without index and suffix, empty if not a segment name
+ */
+static std::string
+segment_run(const std::string &name)
+{
+  size_t prefix_len = strlen(SEGMENT_PREFIX);
+  size_t suffix_len = strlen(SEGMENT_SUFFIX);
+  if (name.size() <= prefix_len + SEGMENT_INDEX_SUFFIX_LEN ||
+      name.compare(0, prefix_len, SEGMENT_PREFIX) != 0 ||
+      name.compare(name.size() - suffix_len, suffix_len, SEGMENT_SUFFIX) != 0)
+  {
+    return "";
+  }
+  return name.substr(0, name.size() - SEGMENT_INDEX_SUFFIX_LEN);
+}
+
+/** Get value of a recorded message field as string.
+ * @param m message to get value from
+ * @param field_name name of the field
+ * @return field value, the default value if not set
+ */
+static std::string
+field_string(const google::protobuf::Message &m, const char *field_name)
+{
+  const google::protobuf::FieldDescriptor *field =
+    m.GetDescriptor()->FindFieldByName(field_name);
+  if (! field)  return "";
+
+  const google::protobuf::Reflection *refl = m.GetReflection();
+  switch (field->cpp_type()) {
+  case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+    return refl->GetEnum(m, field)->name();
+  case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+    return refl->GetString(m, field);
+  case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
+    return std::to_string(refl->GetInt32(m, field));
+  case google::protobuf::FieldDescriptor::CPPTYPE_UINT32:
+    return std::to_string(refl->GetUInt32(m, field));
+  case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
+    return std::to_string(refl->GetInt64(m, field));
+  case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
+    return std::to_string(refl->GetUInt64(m, field));
+  default:
+    return "";
+  }
+}
+
+/** Get game time of a recorded GameState message.
+ * @param m GameState message
+ * @return game time in seconds
+ */
+static double
+game_time(const google::protobuf::Message &m)
+{
+  const google::protobuf::FieldDescriptor *field =
+    m.GetDescriptor()->FindFieldByName("game_time");
+  if (! field || field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+    return 0.;
+  }
+  const google::protobuf::Message &t = m.GetReflection()->GetMessage(m, field);
+  return atof(field_string(t, "sec").c_str()) + atof(field_string(t, "nsec").c_str()) / 1e9;
+}
+
+
+/** @class GameReplay "game_replay.h"
+ * Replay a recorded game.
+ * The messages received by the recording refbox are loaded from a
+ * traffic journal or the MongoDB protobuf log and injected into the
+ * communicator. The replay runs on its own clock. A journal records the
+ * start of each refbox tick, the replay clock is set to the time of the
+ * recorded tick and the messages received before it are injected, i.e.,
+ * each message is processed on the tick it was originally processed on.
+ * The field reported by the machine placing generator during a tick is
+ * recorded as well and passed to the generator on that tick instead of
+ * generating it again. Recordings without ticks, i.e., the MongoDB log,
+ * are replayed on a clock which starts at the time of the first recorded
+ * message and advances by one tick interval per refbox tick, messages
+ * are injected at the time they were received.
+ * The replay speed only determines how long the refbox waits between
+ * ticks. Therefore, given the same random seed, a replay yields the same
+ * game no matter how fast it runs. The last game state sent by the
+ * recording refbox is the recorded outcome, which can be compared to the
+ * outcome of the replay once all messages have been replayed.
+ * @author agent
+ */
+
+/** Constructor.
+ * @param logger logger for informational output
+ * @param message_register message register to decode recorded messages
+ * @param tick_interval_ms interval between two refbox ticks in milliseconds
+ * @param speed replay speed factor, e.g., 1 to replay with the original
+ * timing or 10 for ten times as fast, 0 to replay as fast as possible
+ */
+GameReplay::GameReplay(Logger *logger, protobuf_comm::MessageRegister &message_register,
+		       unsigned int tick_interval_ms, float speed)
+  : logger_(logger), message_register_(message_register),
+    tick_interval_ms_(tick_interval_ms), speed_(speed),
+    random_seed_(0), next_record_(0), next_tick_(0), has_fields_(false),
+    num_failed_(0), have_outcome_(false)
+{
+  timerclear(&now_);
+  timerclear(&end_);
+}
+
+
+/** Destructor. */
+GameReplay::~GameReplay()
+{
+}
+
+
+/** Load recorded messages from a traffic journal.
+ * If the path names a segment file, that segment and all following
+ * segments written by the same refbox run are loaded. If it names a
+ * directory, all segments of the most recent run in that directory are
+ * loaded.
+ * @param path path to a journal segment or a journal directory
+ * @return number of loaded messages
+ * @exception Exception thrown if the journal cannot be read
+ */
+unsigned int
+GameReplay::load_journal(const std::string &path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    throw fawkes::Exception("Cannot access journal %s: %s", path.c_str(), strerror(errno));
+  }
+
+  std::string directory = path;
+  std::string first_segment;
+  if (! S_ISDIR(st.st_mode)) {
+    std::string::size_type slash = path.rfind('/');
+    directory     = (slash == std::string::npos) ? "." : path.substr(0, slash);
+    first_segment = (slash == std::string::npos) ? path : path.substr(slash + 1);
+  }
+
+  std::vector<std::string> names;
+  DIR *dir = opendir(directory.c_str());
+  if (! dir) {
+    throw fawkes::Exception("Cannot open journal directory %s: %s",
+			    directory.c_str(), strerror(errno));
+  }
+  struct dirent *de;
+  while ((de = readdir(dir)) != NULL) {
+    if (! segment_run(de->d_name).empty())  names.push_back(de->d_name);
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+
+  std::vector<std::string> segments;
+  if (first_segment.empty()) {
+    if (names.empty()) {
+      throw fawkes::Exception("No journal segments found in %s", directory.c_str());
+    }
+    std::string run = segment_run(names.back());
+    for (const std::string &name : names) {
+      if (segment_run(name) == run)  segments.push_back(directory + "/" + name);
+    }
+  } else if (segment_run(first_segment).empty()) {
+    // not named like a segment, replay just this file
+    segments.push_back(path);
+  } else {
+    std::string run = segment_run(first_segment);
+    for (const std::string &name : names) {
+      if (segment_run(name) == run && name >= first_segment) {
+	segments.push_back(directory + "/" + name);
+      }
+    }
+  }
+
+  TrafficJournalReader reader(segments);
+  JournalRecord record;
+  unsigned int num_loaded = 0;
+  while (reader.next(record)) {
+    add_record(record);
+    ++num_loaded;
+  }
+  if (reader.truncated() > 0) {
+    logger_->log_warn("Replay", "%u journal segments end in an incomplete record",
+		      reader.truncated());
+  }
+  random_seed_ = reader.random_seed();
+
+  logger_->log_info("Replay", "Loaded %u records from %zu journal segments",
+		    num_loaded, segments.size());
+  finish_loading();
+  return num_loaded;
+}
+
+
+#ifdef HAVE_MONGODB
+/** Load recorded messages from the MongoDB protobuf log.
+ * All messages logged within the given time range are loaded. The random
+ * seed is taken from the game report of a game started within the range.
+ * @param hostport MongoDB server to connect to, as host:port
+ * @param collection protobuf log collection
+ * @param start_sec start of the time range, seconds since the epoch
+ * @param end_sec end of the time range, seconds since the epoch
+ * @return number of loaded messages
+ * @exception Exception thrown if the messages cannot be queried
+ */
+unsigned int
+GameReplay::load_mongodb(const std::string &hostport, const std::string &collection,
+			 long long start_sec, long long end_sec)
+{
+  mongo::DBClientConnection conn;
+  std::string errmsg;
+  if (! conn.connect(hostport, errmsg)) {
+    throw fawkes::Exception("Could not connect to MongoDB at %s: %s",
+			    hostport.c_str(), errmsg.c_str());
+  }
+
+  unsigned int num_loaded = 0;
+  try {
+    mongo::Query q(BSON("_time" << BSON("$gte" << mongo::Date_t(start_sec * 1000)
+					<< "$lte" << mongo::Date_t(end_sec * 1000))));
+    q.sort(BSON("_time" << 1));
+
+#if __cplusplus >= 201103L
+    std::unique_ptr<mongo::DBClientCursor> c = conn.query(collection, q);
+#else
+    std::auto_ptr<mongo::DBClientCursor> c = conn.query(collection, q);
+#endif
+
+    while (c->more()) {
+      mongo::BSONObj doc(c->next());
+      if (! doc.hasField("_protobuf") || ! doc.hasField("_meta"))  continue;
+
+      JournalRecord record;
+      int64_t ms = doc.getField("_time").Date().asInt64();
+      record.time.tv_sec  = ms / 1000;
+      record.time.tv_usec = (ms % 1000) * 1000;
+
+      int data_size = 0;
+      const char *data = doc.getField("_protobuf").binData(data_size);
+      record.data.assign(data, data_size);
+      record.type_name = doc.getStringField("_type");
+
+      // meta data as written by the refbox, cf. LLSFRefBox::handle_server_client_msg()
+      mongo::BSONObj meta(doc.getObjectField("_meta"));
+      std::string direction = meta.getStringField("direction");
+      std::string via       = meta.getStringField("via");
+      record.direction = (direction == "outbound") ? JOURNAL_OUTBOUND : JOURNAL_INBOUND;
+      if (via == "peer") {
+	record.via = JOURNAL_VIA_PEER;
+	if (meta.hasField("endpoint-host")) {
+	  record.endpoint = std::string(meta.getStringField("endpoint-host")) + ":" +
+	    std::to_string(meta.getIntField("endpoint-port"));
+	}
+      } else if (via == "client") {
+	record.via = JOURNAL_VIA_CLIENT;
+	record.endpoint = std::string(meta.getStringField("host")) + ":" +
+	  std::to_string(meta.getIntField("port"));
+      } else {
+	record.via = JOURNAL_VIA_SERVER;
+	if (meta.hasField("client_id")) {
+	  record.endpoint = std::to_string(meta.getIntField("client_id"));
+	}
+      }
+      record.peer_id = meta.hasField("peer_id") ? meta.getIntField("peer_id") : 0;
+      record.component_id = meta.hasField("component_id") ? meta.getIntField("component_id") : 0;
+      record.msg_type = meta.hasField("msg_type") ? meta.getIntField("msg_type") : 0;
+
+      add_record(record);
+      ++num_loaded;
+    }
+
+    // game report as written by mongodb.clp
+    mongo::BSONObj report =
+      conn.findOne("llsfrb.game_report",
+		   mongo::Query(BSON("start-timestamp.0" << BSON("$gte" << start_sec
+								 << "$lte" << end_sec))));
+    if (! report.isEmpty() && report.hasField("random-seed")) {
+      random_seed_ = report.getField("random-seed").numberLong();
+    }
+  } catch (mongo::DBException &e) {
+    throw fawkes::Exception("Failed to load messages from %s: %s",
+			    collection.c_str(), e.what());
+  }
+
+  logger_->log_info("Replay", "Loaded %u messages from %s", num_loaded, collection.c_str());
+  finish_loading();
+  return num_loaded;
+}
+#endif
+
+
+void
+GameReplay::add_record(const JournalRecord &record)
+{
+  if (! timerisset(&end_) || timercmp(&record.time, &now_, <))  now_ = record.time;
+  if (! timerisset(&end_) || timercmp(&record.time, &end_, >))  end_ = record.time;
+
+  if (record.via == JOURNAL_VIA_EVENT) {
+    if (record.type_name == JOURNAL_EVENT_TICK) {
+      ReplayTick tick;
+      tick.time       = record.time;
+      tick.end_record = records_.size();
+      ticks_.push_back(tick);
+    } else if (record.type_name == JOURNAL_EVENT_FIELD && ! ticks_.empty()) {
+      // reported after the rules ran, i.e., during the last tick
+      ticks_.back().field = record.data;
+      has_fields_ = true;
+    }
+  } else if (record.direction == JOURNAL_INBOUND) {
+    records_.push_back(record);
+  } else if (record.type_name == "llsf_msgs.GameState") {
+    // the last game state sent is the outcome of the recorded game
+    if (! have_outcome_ || ! timercmp(&record.time, &outcome_.time, <)) {
+      outcome_ = record;
+      have_outcome_ = true;
+    }
+  }
+}
+
+
+void
+GameReplay::finish_loading()
+{
+  next_record_ = 0;
+  next_tick_   = 0;
+
+  if (! ticks_.empty()) {
+    // the journal order is the order in which the messages were processed
+    now_ = ticks_.front().time;
+    end_ = ticks_.back().time;
+    logger_->log_info("Replay", "Replaying %zu received messages in %zu ticks over %ld sec",
+		      records_.size(), ticks_.size(), (long int)(end_.tv_sec - now_.tv_sec));
+    if (! has_fields_) {
+      logger_->log_warn("Replay", "Recording contains no generated field, "
+			"the field is generated again");
+    }
+    return;
+  }
+
+  // messages received on different channels may have been recorded
+  // slightly out of order, inject them in the order of reception
+  std::stable_sort(records_.begin(), records_.end(),
+		   [](const JournalRecord &a, const JournalRecord &b) {
+		     return timercmp(&a.time, &b.time, <);
+		   });
+
+  if (records_.empty()) {
+    logger_->log_warn("Replay", "Recording contains no received messages");
+  } else {
+    logger_->log_warn("Replay", "Recording contains no ticks, messages are injected "
+		      "at the time they were received and may be processed on other ticks");
+    logger_->log_info("Replay", "Replaying %zu received messages over %ld sec",
+		      records_.size(), (long int)(end_.tv_sec - now_.tv_sec));
+  }
+}
+
+
+/** Get wall time to wait between two ticks.
+ * @return time in milliseconds, 0 to replay as fast as possible
+ */
+unsigned int
+GameReplay::tick_wait_ms() const
+{
+  if (speed_ <= 0.)  return 0;
+
+  float interval_ms = tick_interval_ms_;
+  if (next_tick_ > 0 && next_tick_ < ticks_.size()) {
+    // keep the original timing, the ticks may have been late
+    struct timeval diff;
+    timersub(&ticks_[next_tick_].time, &now_, &diff);
+    interval_ms = std::max(0.f, diff.tv_sec * 1000.f + diff.tv_usec / 1000.f);
+  }
+  return (unsigned int)roundf(interval_ms / speed_);
+}
+
+
+/** Check if the replay has finished.
+ * @return true if all recorded ticks have been replayed, for recordings
+ * without ticks if all messages have been replayed and the replay time
+ * has reached the time of the last recorded message
+ */
+bool
+GameReplay::finished() const
+{
+  if (! ticks_.empty())  return next_tick_ >= ticks_.size();
+  return next_record_ >= records_.size() && ! timercmp(&now_, &end_, <);
+}
+
+
+/** Advance the replay by one tick.
+ * Sets the replay clock to the time of the next recorded tick, injects
+ * all messages received before it, and passes the field reported during
+ * the tick to the generator. For recordings without ticks, advances the
+ * replay clock by one tick interval and injects all messages which had
+ * been received until then. Must be called once per refbox tick before
+ * processing received messages.
+ * @param pb_comm communicator to inject messages to
+ * @param mps_generator machine placing generator to pass recorded fields to
+ * @return number of injected messages
+ */
+unsigned int
+GameReplay::advance(ClipsProtobufCommunicator *pb_comm,
+		    mps_placing_clips::MPSPlacingGenerator *mps_generator)
+{
+  unsigned int num_injected = 0;
+
+  if (! ticks_.empty()) {
+    if (next_tick_ >= ticks_.size())  return 0;
+
+    const ReplayTick &tick = ticks_[next_tick_++];
+    now_ = tick.time;
+    for (; next_record_ < tick.end_record; ++next_record_) {
+      if (inject(pb_comm, records_[next_record_]))  ++num_injected;
+    }
+    if (! tick.field.empty())  mps_generator->set_replayed_field(tick.field);
+    return num_injected;
+  }
+
+  struct timeval tick;
+  tick.tv_sec  = tick_interval_ms_ / 1000;
+  tick.tv_usec = (tick_interval_ms_ % 1000) * 1000;
+  timeradd(&now_, &tick, &now_);
+
+  while (next_record_ < records_.size() &&
+	 ! timercmp(&records_[next_record_].time, &now_, >))
+  {
+    if (inject(pb_comm, records_[next_record_]))  ++num_injected;
+    ++next_record_;
+  }
+  return num_injected;
+}
+
+
+bool
+GameReplay::inject(ClipsProtobufCommunicator *pb_comm, const JournalRecord &record)
+{
+  std::shared_ptr<google::protobuf::Message> m;
+  try {
+    std::string type_name = record.type_name;
+    m = message_register_.new_message_for(type_name);
+  } catch (std::runtime_error &e) {
+    ++num_failed_;
+    return false;
+  }
+  if (! m->ParseFromString(record.data)) {
+    ++num_failed_;
+    return false;
+  }
+
+  // for clients connected to our server only the client ID was recorded
+  std::pair<std::string, unsigned short> endpoint("", 0);
+  if (record.via != JOURNAL_VIA_SERVER) {
+    std::string::size_type colon = record.endpoint.rfind(':');
+    if (colon != std::string::npos) {
+      endpoint.first  = record.endpoint.substr(0, colon);
+      endpoint.second = atoi(record.endpoint.substr(colon + 1).c_str());
+    }
+  }
+
+  // Only peer IDs are stable across refbox runs, they are assigned in the
+  // order the peers are created during initialization. Client IDs depend
+  // on the order clients connected, replies to them go nowhere anyway.
+  ClipsProtobufCommunicator::ClientType ct;
+  long int client_id = 0;
+  switch (record.via) {
+  case JOURNAL_VIA_CLIENT:
+    ct = ClipsProtobufCommunicator::CT_CLIENT;
+    break;
+  case JOURNAL_VIA_PEER:
+    ct = ClipsProtobufCommunicator::CT_PEER;
+    client_id = record.peer_id;
+    break;
+  default:
+    ct = ClipsProtobufCommunicator::CT_SERVER;
+    break;
+  }
+
+  pb_comm->inject_message(endpoint, record.component_id, record.msg_type, m,
+			  ct, client_id, record.time);
+  return true;
+}
+
+
+/** Compare the outcome of the replay to the recorded game.
+ * Compares game state, phase, team names, and points of the current
+ * gamestate fact to the last game state sent by the recording refbox and
+ * logs all differences. Must be called with the CLIPS environment locked.
+ * @param clips CLIPS environment of the replaying refbox
+ * @return true if the replay yielded the recorded outcome, false otherwise
+ */
+bool
+GameReplay::compare_outcome(CLIPS::Environment *clips)
+{
+  if (num_failed_ > 0) {
+    logger_->log_warn("Replay", "%u recorded messages could not be decoded and were skipped",
+		      num_failed_);
+  }
+
+  if (! have_outcome_) {
+    logger_->log_error("Replay", "Recording contains no game state, cannot compare outcome");
+    return false;
+  }
+
+  std::shared_ptr<google::protobuf::Message> recorded;
+  try {
+    std::string type_name = outcome_.type_name;
+    recorded = message_register_.new_message_for(type_name);
+  } catch (std::runtime_error &e) {
+    logger_->log_error("Replay", "Cannot decode recorded game state: %s", e.what());
+    return false;
+  }
+  if (! recorded->ParseFromString(outcome_.data)) {
+    logger_->log_error("Replay", "Cannot decode recorded game state: invalid data");
+    return false;
+  }
+
+  CLIPS::Fact::pointer gamestate;
+  for (CLIPS::Fact::pointer fact = clips->get_facts(); fact; fact = fact->next()) {
+    if (fact->get_template()->name() == "gamestate") {
+      gamestate = fact;
+      break;
+    }
+  }
+  if (! gamestate) {
+    logger_->log_error("Replay", "No gamestate fact, cannot compare outcome");
+    return false;
+  }
+
+  CLIPS::Values teams  = gamestate->slot_value("teams");
+  CLIPS::Values points = gamestate->slot_value("points");
+
+  std::vector<std::pair<const char *, std::string>> replayed;
+  replayed.push_back(std::make_pair("state", gamestate->slot_value("state")[0].as_string()));
+  replayed.push_back(std::make_pair("phase", gamestate->slot_value("phase")[0].as_string()));
+  replayed.push_back(std::make_pair("team_cyan", teams[0].as_string()));
+  replayed.push_back(std::make_pair("team_magenta", teams[1].as_string()));
+  replayed.push_back(std::make_pair("points_cyan", std::to_string(points[0].as_integer())));
+  replayed.push_back(std::make_pair("points_magenta", std::to_string(points[1].as_integer())));
+
+  unsigned int num_diffs = 0;
+  for (const auto &r : replayed) {
+    std::string rec = field_string(*recorded, r.first);
+    if (rec != r.second) {
+      logger_->log_warn("Replay", "%s differs: recorded %s, replayed %s",
+			r.first, rec.c_str(), r.second.c_str());
+      ++num_diffs;
+    }
+  }
+
+  logger_->log_info("Replay", "Game time: recorded %.1f sec, replayed %.1f sec",
+		    game_time(*recorded), gamestate->slot_value("game-time")[0].as_float());
+
+  if (num_diffs > 0) {
+    logger_->log_error("Replay", "Replay differs from the recorded outcome in %u fields",
+		       num_diffs);
+    return false;
+  }
+
+  logger_->log_info("Replay", "Replay matches the recorded outcome: %s %s, "
+		    "%s %s points, %s %s points",
+		    replayed[1].second.c_str(), replayed[0].second.c_str(),
+		    replayed[2].second.c_str(), replayed[4].second.c_str(),
+		    replayed[3].second.c_str(), replayed[5].second.c_str());
+  return true;
+}
+
+} // end of namespace llsfrb
@@ -0,0 +1,144 @@
+/***************************************************************************
+ *  game_replay.h - LLSF RefBox replay of recorded games
+ *
+ *  Created: Mon Oct 19 01:03:41 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LLSF_REFBOX_GAME_REPLAY_H_
+#define __LLSF_REFBOX_GAME_REPLAY_H_
+
+#include <logging/traffic_journal.h>
+#include <clipsmm.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+namespace protobuf_comm {
+  class MessageRegister;
+}
+namespace protobuf_clips {
+  class ClipsProtobufCommunicator;
+}
+namespace mps_placing_clips {
+  class MPSPlacingGenerator;
+}
+
+namespace llsfrb {
+#if 0 /* just to make Emacs auto-indent happy */
+}
+#endif
+
+class Logger;
+
+/** Journal event recorded at the start of each refbox tick. */
+static const char JOURNAL_EVENT_TICK[]  = "tick";
+/** Journal event recorded when the generated field has been reported. */
+static const char JOURNAL_EVENT_FIELD[] = "field";
+
+class GameReplay
+{
+ public:
+  GameReplay(Logger *logger, protobuf_comm::MessageRegister &message_register,
+	     unsigned int tick_interval_ms, float speed);
+  ~GameReplay();
+
+  unsigned int load_journal(const std::string &path);
+#ifdef HAVE_MONGODB
+  unsigned int load_mongodb(const std::string &hostport, const std::string &collection,
+			    long long start_sec, long long end_sec);
+#endif
+
+  /** Get random seed of the recorded game.
+   * @return random seed, 0 if the recording does not contain it */
+  uint32_t random_seed() const
+  { return random_seed_; }
+
+  /** Check if the recording contains the generated fields.
+   * @return true if the fields are replayed, false if they must be
+   * generated again */
+  bool has_fields() const
+  { return has_fields_; }
+
+  /** Get current replay time.
+   * This is the clock of the refbox during the replay. Each tick it is
+   * set to the time of the recorded tick, independent of the replay
+   * speed. For recordings without ticks, it starts at the time of the
+   * first recorded message and advances by one tick interval per tick.
+   * @return current replay time */
+  const struct timeval & now() const
+  { return now_; }
+
+  unsigned int tick_wait_ms() const;
+  bool finished() const;
+
+  unsigned int advance(protobuf_clips::ClipsProtobufCommunicator *pb_comm,
+		       mps_placing_clips::MPSPlacingGenerator *mps_generator);
+  bool compare_outcome(CLIPS::Environment *clips);
+
+ private:
+  void add_record(const JournalRecord &record);
+  void finish_loading();
+  bool inject(protobuf_clips::ClipsProtobufCommunicator *pb_comm,
+	      const JournalRecord &record);
+
+ private:
+  /** A recorded refbox tick. */
+  typedef struct {
+    struct timeval time;	///< time of the tick
+    size_t         end_record;	///< number of records received before the tick
+    std::string    field;	///< field reported during the tick, empty if none
+  } ReplayTick;
+
+  Logger                         *logger_;
+  protobuf_comm::MessageRegister &message_register_;
+  unsigned int                    tick_interval_ms_;
+  float                           speed_;
+
+  uint32_t                        random_seed_;
+  std::vector<JournalRecord>      records_;
+  size_t                          next_record_;
+  std::vector<ReplayTick>         ticks_;
+  size_t                          next_tick_;
+  bool                            has_fields_;
+  unsigned int                    num_failed_;
+  bool                            have_outcome_;
+  JournalRecord                   outcome_;
+
+  struct timeval                  now_;
+  struct timeval                  end_;
+};
+
+} // end of namespace llsfrb
+
+#endif
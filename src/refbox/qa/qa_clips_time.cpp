@@ -0,0 +1,241 @@
+
+/***************************************************************************
+ *  qa_clips_time.cpp - CLIPS time function agenda benchmark
+ *
+ *  Created: Mon Oct 19 01:38:10 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../clips_time.h"
+
+#include <clipsmm.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+using namespace llsfrb;
+
+/// @cond QA
+
+/* Compares the native time-diff, time-diff-sec, and timeout against the
+ * deffunctions they replaced. Both variants first evaluate the same
+ * expressions and must agree, then run an agenda of timer facts which
+ * are checked on every tick like the periodic rules of the game, e.g.
+ *   qa_refbox_clips_time -n 10000 -f 200
+ * Results are printed as one JSON object per line.
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static const char *DEFFUNCTIONS[] = {
+  "(deffunction time-diff (?t1 ?t2)"
+  "  (bind ?sec  (- (nth$ 1 ?t1) (nth$ 1 ?t2)))"
+  "  (bind ?usec (- (nth$ 2 ?t1) (nth$ 2 ?t2)))"
+  "  (if (< ?usec 0)"
+  "      then (bind ?sec (- ?sec 1)) (bind ?usec (+ 1000000 ?usec)))"
+  "  (return (create$ ?sec ?usec))"
+  ")",
+  "(deffunction time-diff-sec (?t1 ?t2)"
+  "  (bind ?td (time-diff ?t1 ?t2))"
+  "  (return (+ (float (nth$ 1 ?td)) (/ (float (nth$ 2 ?td)) 1000000.)))"
+  ")",
+  "(deffunction timeout (?now ?time ?timeout)"
+  "  (return (> (time-diff-sec ?now ?time) ?timeout))"
+  ")",
+  NULL
+};
+
+static const char *AGENDA[] = {
+  "(deftemplate timer (slot id) (multislot time) (slot timeout) (slot fired (default 0)))",
+  "(deftemplate tick (multislot now))",
+  "(defrule bench-timeout"
+  "  (tick (now $?now))"
+  "  ?t <- (timer (time $?time) (timeout ?to&:(timeout ?now ?time ?to)) (fired ?f))"
+  "  =>"
+  "  (modify ?t (time ?now) (fired (+ ?f 1)))"
+  ")",
+  "(defrule bench-time-diff-sec"
+  "  (tick (now $?now))"
+  "  (timer (id ?id) (time $?time&:(< (time-diff-sec ?now ?time) 0.0)))"
+  "  =>"
+  "  (printout t \"timer \" ?id \" is in the future\" crlf)"
+  ")",
+  NULL
+};
+
+static const char *EXPRESSIONS[] = {
+  "(time-diff (create$ 10 500000) (create$ 3 200000))",
+  "(time-diff (create$ 10 200000) (create$ 3 500000))",
+  "(time-diff (create$ 3 0) (create$ 10 999999))",
+  "(time-diff-sec (create$ 10 500000) (create$ 3 200000))",
+  "(time-diff-sec (create$ 10 200000) (create$ 3 500000))",
+  "(time-diff-sec (create$ 3 0) (create$ 10 999999))",
+  "(timeout (create$ 10 200000) (create$ 3 500000) 6.6)",
+  "(timeout (create$ 10 200000) (create$ 3 500000) 6.8)",
+  "(timeout (create$ 10 200000) (create$ 3 500000) 7)",
+  "(timeout (create$ 10 200000) (create$ 3 500000) 6)",
+  NULL
+};
+
+static bool
+values_equal(const CLIPS::Values &a, const CLIPS::Values &b)
+{
+  if (a.size() != b.size())  return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].type() != b[i].type())  return false;
+    switch (a[i].type()) {
+    case CLIPS::TYPE_FLOAT:
+      // same value computed in a different order, may differ in the last bits
+      if (std::fabs(a[i].as_float() - b[i].as_float()) > 1e-9)  return false;
+      break;
+    case CLIPS::TYPE_INTEGER:
+      if (a[i].as_integer() != b[i].as_integer())  return false;
+      break;
+    default:
+      if (a[i].as_string() != b[i].as_string())  return false;
+      break;
+    }
+  }
+  return true;
+}
+
+static CLIPS::Environment *
+create_env(bool native)
+{
+  CLIPS::Environment *env = new CLIPS::Environment();
+  if (native) {
+    setup_clips_time(env);
+  } else {
+    for (const char **d = DEFFUNCTIONS; *d; ++d) {
+      if (! env->build(*d))  throw std::runtime_error(std::string("Failed to build ") + *d);
+    }
+  }
+  for (const char **d = AGENDA; *d; ++d) {
+    if (! env->build(*d))  throw std::runtime_error(std::string("Failed to build ") + *d);
+  }
+  return env;
+}
+
+/* Run the agenda for the given number of ticks, 40 ms of game time apart.
+ * Returns the number of rule firings, the runtime is stored in usec. */
+static long int
+run_agenda(CLIPS::Environment *env, unsigned int num_facts, unsigned int num_ticks, double &usec)
+{
+  env->reset();
+  for (unsigned int i = 0; i < num_facts; ++i) {
+    char fact[128];
+    snprintf(fact, sizeof(fact), "(timer (id %u) (time 1000 %u) (timeout %u.%u))",
+	     i, (i * 7919) % 1000000, 1 + i % 30, i % 10);
+    env->assert_fact(fact);
+  }
+
+  long int fired = 0;
+  long long sec = 1000, usec_now = 0;
+  CLIPS::Fact::pointer tick;
+  Clock::time_point start = Clock::now();
+  for (unsigned int t = 0; t < num_ticks; ++t) {
+    usec_now += 40000;
+    if (usec_now >= 1000000) {
+      sec += 1;
+      usec_now -= 1000000;
+    }
+    if (tick)  tick->retract();
+    char fact[64];
+    snprintf(fact, sizeof(fact), "(tick (now %lld %lld))", sec, usec_now);
+    tick = env->assert_fact(fact);
+    env->refresh_agenda();
+    fired += env->run();
+  }
+  usec = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+  return fired;
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned int num_ticks = 10000;
+  unsigned int num_facts = 200;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:f:")) != -1) {
+    switch (c) {
+    case 'n': num_ticks = atoi(optarg); break;
+    case 'f': num_facts = atoi(optarg); break;
+    default:
+      printf("Usage: %s [-n NUM_TICKS] [-f NUM_FACTS]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  CLIPS::init();
+
+  CLIPS::Environment *env_clips  = create_env(false);
+  CLIPS::Environment *env_native = create_env(true);
+
+  bool differs = false;
+  for (const char **e = EXPRESSIONS; *e; ++e) {
+    CLIPS::Values v_clips  = env_clips->evaluate(*e);
+    CLIPS::Values v_native = env_native->evaluate(*e);
+    if (! values_equal(v_clips, v_native)) {
+      fprintf(stderr, "Result differs for %s\n", *e);
+      differs = true;
+    }
+  }
+
+  double usec_clips, usec_native;
+  long int fired_clips  = run_agenda(env_clips,  num_facts, num_ticks, usec_clips);
+  long int fired_native = run_agenda(env_native, num_facts, num_ticks, usec_native);
+  if (fired_clips != fired_native) {
+    fprintf(stderr, "Agenda differs: %li rules fired with deffunctions, %li natively\n",
+	    fired_clips, fired_native);
+    differs = true;
+  }
+
+  printf("{\"variant\": \"deffunction\", \"ticks\": %u, \"facts\": %u, \"fired\": %li, "
+	 "\"usec_per_tick\": %.3f}\n",
+	 num_ticks, num_facts, fired_clips, usec_clips / num_ticks);
+  printf("{\"variant\": \"native\", \"ticks\": %u, \"facts\": %u, \"fired\": %li, "
+	 "\"usec_per_tick\": %.3f}\n",
+	 num_ticks, num_facts, fired_native, usec_native / num_ticks);
+
+  delete env_clips;
+  delete env_native;
+
+  return differs ? 2 : 0;
+}
+
+/// @endcond
@@ -36,6 +36,9 @@
 
 #include "refbox.h"
 #include "clips_logger.h"
+#include "clips_time.h"
+#include "beacon_processor.h"
+#include "game_replay.h"
 
 #include <core/threading/mutex.h>
 #include <core/version.h>
@@ -68,6 +71,8 @@
 #endif
 
 #include <string>
+#include <algorithm>
+#include <ctime>
 
 using namespace protobuf_comm;
 using namespace protobuf_clips;
@@ -102,6 +107,14 @@ LLSFRefBox::LLSFRefBox(int argc, char **argv)
   : clips_mutex_(fawkes::Mutex::RECURSIVE), timer_(io_service_)
 {
   pb_comm_ = NULL;
+  beacon_processor_ = NULL;
+  journal_ = NULL;
+  log_traffic_ = false;
+  replay_ = NULL;
+  replay_matches_ = false;
+#ifdef HAVE_MONGODB
+  mongodb_protobuf_ = NULL;
+#endif
   
   config_ = new YamlConfiguration(CONFDIR);
   config_->load("config.yaml");
@@ -115,6 +128,11 @@ LLSFRefBox::LLSFRefBox(int argc, char **argv)
     throw;
   }
 
+  cfg_clips_time_facts_ = false;
+  try {
+    cfg_clips_time_facts_ = config_->get_bool("/llsfrb/clips/time-facts");
+  } catch (fawkes::Exception &e) {} // ignored, use default
+
   log_level_ = Logger::LL_INFO;
   try {
     std::string ll = config_->get_string("/llsfrb/log/level");
@@ -154,9 +172,23 @@ LLSFRefBox::LLSFRefBox(int argc, char **argv)
   logger_->log_info("RefBox", "Using %s machine assignment",
 		    (cfg_machine_assignment_ == ASSIGNMENT_2013) ? "2013" : "2014");
 
+  bool cfg_replay_enabled = false;
+  try {
+    cfg_replay_enabled = config_->get_bool("/llsfrb/replay/enable");
+  } catch (fawkes::Exception &e) {} // ignore, use default
+
+  random_seed_ = time(NULL);
+  bool cfg_random_seed_set = false;
+  try {
+    random_seed_ = config_->get_uint("/llsfrb/game/random-seed");
+    cfg_random_seed_set = true;
+  } catch (fawkes::Exception &e) {} // ignore, use default
+
   try {
     mps_ = NULL;
-    if (config_->get_bool("/llsfrb/mps/enable")) {
+    // machine feedback is not part of the recorded traffic, a replay
+    // always runs without the MPS hardware
+    if (! cfg_replay_enabled && config_->get_bool("/llsfrb/mps/enable")) {
       mps_ = new MPSRefboxInterface("MPSInterface");
 
       std::string prefix = "/llsfrb/mps/stations/";
@@ -253,11 +285,22 @@ LLSFRefBox::LLSFRefBox(int argc, char **argv)
   
   clips_ = new CLIPS::Environment();
   setup_protobuf_comm();
+  if (cfg_replay_enabled)  setup_replay();
   setup_clips();
 
+  logger_->log_info("RefBox", "Using random seed %u", random_seed_);
   mps_placing_generator_ = std::shared_ptr<mps_placing_clips::MPSPlacingGenerator>(
         new mps_placing_clips::MPSPlacingGenerator(clips_, clips_mutex_)
         );
+  // the seeded search is slower, only use it if the game is to be reproduced
+  if (cfg_random_seed_set || replay_) {
+    mps_placing_generator_->set_random_seed(random_seed_);
+  }
+  if (replay_) {
+    // without the recorded field, at least have it ready on the next check
+    mps_placing_generator_->set_replay(replay_->has_fields());
+    mps_placing_generator_->set_blocking(! replay_->has_fields());
+  }
 
   mlogger->add_logger(new NetworkLogger(pb_comm_->server(), log_level_));
 
@@ -266,6 +309,8 @@ LLSFRefBox::LLSFRefBox(int argc, char **argv)
   try {
     cfg_mongodb_enabled_ = config_->get_bool("/llsfrb/mongodb/enable");
   } catch (fawkes:: Exception &e) {} // ignore, use default
+  // a replay must not overwrite the game report of the recorded game
+  if (replay_)  cfg_mongodb_enabled_ = false;
 
   if (cfg_mongodb_enabled_) {
     cfg_mongodb_hostport_     = config_->get_string("/llsfrb/mongodb/hostport");
@@ -276,7 +321,17 @@ LLSFRefBox::LLSFRefBox(int argc, char **argv)
 
     clips_logger_->add_logger(new MongoDBLogLogger(cfg_mongodb_hostport_, mdb_clips_log));
 
-    mongodb_protobuf_ = new MongoDBLogProtobuf(cfg_mongodb_hostport_, mdb_protobuf);
+    unsigned int protobuf_queue_size = 8192;
+    unsigned int protobuf_batch_size = 256;
+    try {
+      protobuf_queue_size = config_->get_uint("/llsfrb/mongodb/protobuf-queue-size");
+    } catch (fawkes::Exception &e) {} // ignore, use default
+    try {
+      protobuf_batch_size = config_->get_uint("/llsfrb/mongodb/protobuf-batch-size");
+    } catch (fawkes::Exception &e) {} // ignore, use default
+
+    mongodb_protobuf_ = new MongoDBLogProtobuf(cfg_mongodb_hostport_, mdb_protobuf,
+					       protobuf_queue_size, protobuf_batch_size);
 
     
     mongo::DBClientConnection *conn =
@@ -289,7 +344,37 @@ LLSFRefBox::LLSFRefBox(int argc, char **argv)
     }
 
     setup_clips_mongodb();
+    log_traffic_ = true;
+  }
+#endif
+
+  bool cfg_journal_enabled = false;
+  try {
+    cfg_journal_enabled = config_->get_bool("/llsfrb/journal/enable");
+  } catch (fawkes::Exception &e) {} // ignore, use default
+  if (replay_)  cfg_journal_enabled = false;
+
+  if (cfg_journal_enabled) {
+    std::string  journal_path = "journal";
+    unsigned int journal_segment_size = 64;
+    unsigned int journal_sync_interval = 1000;
+    try {
+      journal_path = config_->get_string("/llsfrb/journal/path");
+    } catch (fawkes::Exception &e) {} // ignore, use default
+    try {
+      journal_segment_size = config_->get_uint("/llsfrb/journal/segment-size");
+    } catch (fawkes::Exception &e) {} // ignore, use default
+    try {
+      journal_sync_interval = config_->get_uint("/llsfrb/journal/sync-interval");
+    } catch (fawkes::Exception &e) {} // ignore, use default
+
+    journal_ = new TrafficJournalWriter(logger_, journal_path, random_seed_,
+					journal_segment_size * 1024 * 1024,
+					journal_sync_interval);
+    log_traffic_ = true;
+  }
 
+  if (log_traffic_) {
     pb_comm_->server()->signal_received()
       .connect(boost::bind(&LLSFRefBox::handle_server_client_msg, this, _1, _2, _3, _4));
     pb_comm_->server()->signal_receive_failed()
@@ -300,24 +385,20 @@ LLSFRefBox::LLSFRefBox(int argc, char **argv)
     pb_comm_->signal_client_sent()
       .connect(boost::bind(&LLSFRefBox::handle_client_sent_msg, this, _1, _2, _3));
     pb_comm_->signal_peer_sent()
-      .connect(boost::bind(&LLSFRefBox::handle_peer_sent_msg, this, _2));
-
+      .connect(boost::bind(&LLSFRefBox::handle_peer_sent_msg, this, _1, _2));
   }
-#endif
 
   start_clips();
 
-#ifdef HAVE_MONGODB
   // we can do this only after CLIPS was started as it initiates the private peers
-  if (cfg_mongodb_enabled_) {
+  if (log_traffic_) {
     const std::map<long int, protobuf_comm::ProtobufBroadcastPeer *> &peers =
       pb_comm_->peers();
     for (auto p : peers) {
       p.second->signal_received()
-	.connect(boost::bind(&LLSFRefBox::handle_peer_msg, this, _1, _2, _3, _4));
+	.connect(boost::bind(&LLSFRefBox::handle_peer_msg, this, p.first, _1, _2, _3, _4));
     }
   }
-#endif
 
 
 #ifdef HAVE_AVAHI
@@ -358,6 +439,13 @@ LLSFRefBox::~LLSFRefBox()
   mps_placing_generator_.reset();
 
   delete pb_comm_;
+  delete beacon_processor_;
+  delete replay_;
+  // these write out all still queued messages, must come after pb_comm_
+  delete journal_;
+#ifdef HAVE_MONGODB
+  delete mongodb_protobuf_;
+#endif
   delete config_;
   delete clips_;
   delete logger_;
@@ -404,8 +492,44 @@ LLSFRefBox::setup_protobuf_comm()
     } else {
       pb_comm_ = new ClipsProtobufCommunicator(clips_, clips_mutex_, proto_dirs);
     }
+    // received messages are asserted once per timer tick
+    unsigned int receive_queue_size = 8192;
+    try {
+      receive_queue_size = config_->get_uint("/llsfrb/comm/receive-queue-size");
+    } catch (fawkes::Exception &e) {} // ignore, use default
+    pb_comm_->set_batch_assert(true, receive_queue_size);
+
+    unsigned int send_workers = 2;
+    try {
+      send_workers = config_->get_uint("/llsfrb/comm/send-workers");
+    } catch (fawkes::Exception &e) {} // ignore, use default
+    pb_comm_->set_send_workers(send_workers);
+
+    // robot beacons are aggregated natively and only passed on to CLIPS
+    // on changes or once per update period
+    float beacon_update_period = 0.5;
+    try {
+      beacon_update_period = config_->get_float("/llsfrb/comm/beacon-update-period");
+    } catch (fawkes::Exception &e) {} // ignore, use default
+    float beacon_remove_timeout = 1080.;
+    try {
+      beacon_remove_timeout = config_->get_float("/llsfrb/comm/beacon-remove-timeout");
+    } catch (fawkes::Exception &e) {} // ignore, use default
+    beacon_processor_ = new BeaconProcessor(clips_, beacon_update_period,
+					    beacon_remove_timeout);
+    pb_comm_->set_message_handler("llsf_msgs.BeaconSignal",
+				  boost::bind(&BeaconProcessor::handle_beacon, beacon_processor_,
+					      _1, _2, _3));
 
     pb_comm_->enable_server(config_->get_uint("/llsfrb/comm/server-port"));
+    try {
+      std::string server_socket = config_->get_string("/llsfrb/comm/server-socket");
+      pb_comm_->server()->listen_local(server_socket);
+      logger_->log_info("RefBox", "Accepting local clients on %s", server_socket.c_str());
+    } catch (fawkes::Exception &e) {} // ignore, no local socket
+    catch (std::exception &e) {
+      logger_->log_warn("RefBox", "Failed to listen on local socket: %s", e.what());
+    }
 
     MessageRegister &mr_server = pb_comm_->message_register();
     if (! mr_server.load_failures().empty()) {
@@ -424,6 +548,66 @@ LLSFRefBox::setup_protobuf_comm()
   }
 }
 
+/** Setup replay of a recorded game.
+ * Loads the recorded traffic from the journal or MongoDB and switches
+ * the communicator to replay mode, i.e. messages are only received
+ * from the recording and not sent to the robots.
+ */
+void
+LLSFRefBox::setup_replay()
+{
+  float speed = 1.0;
+  try {
+    speed = config_->get_float("/llsfrb/replay/speed");
+  } catch (fawkes::Exception &e) {} // ignore, use default
+
+  std::string source = "journal";
+  try {
+    source = config_->get_string("/llsfrb/replay/source");
+  } catch (fawkes::Exception &e) {} // ignore, use default
+
+  replay_ = new GameReplay(logger_, pb_comm_->message_register(), cfg_timer_interval_, speed);
+
+  try {
+    if (source == "journal") {
+      std::string journal_path = "journal";
+      try {
+	journal_path = config_->get_string("/llsfrb/replay/journal");
+      } catch (fawkes::Exception &e) {} // ignore, use default
+      replay_->load_journal(journal_path);
+#ifdef HAVE_MONGODB
+    } else if (source == "mongodb") {
+      std::string hostport   = config_->get_string("/llsfrb/mongodb/hostport");
+      std::string collection = config_->get_string("/llsfrb/mongodb/collections/protobuf");
+      unsigned int start_sec = config_->get_uint("/llsfrb/replay/mongodb-start");
+      unsigned int end_sec   = config_->get_uint("/llsfrb/replay/mongodb-end");
+      replay_->load_mongodb(hostport, collection, start_sec, end_sec);
+#endif
+    } else {
+      throw fawkes::Exception("Unsupported replay source '%s'", source.c_str());
+    }
+  } catch (fawkes::Exception &e) {
+    delete replay_;
+    replay_ = NULL;
+    throw;
+  }
+
+  try {
+    random_seed_ = config_->get_uint("/llsfrb/replay/seed");
+  } catch (fawkes::Exception &e) {
+    if (replay_->random_seed() != 0) {
+      random_seed_ = replay_->random_seed();
+    } else {
+      logger_->log_warn("RefBox", "Recording does not contain the random seed, "
+			"replayed game will not match the recording");
+    }
+  }
+
+  pb_comm_->set_replay(true);
+  logger_->log_info("RefBox", "Replaying recorded game at %s speed",
+		    speed > 0. ? boost::str(boost::format("%.1fx") % speed).c_str() : "max");
+}
+
 void
 LLSFRefBox::setup_clips()
 {
@@ -451,18 +635,25 @@ LLSFRefBox::setup_clips()
 			     "  ?*VERSION-MAJOR* = %u\n"
 			     "  ?*VERSION-MINOR* = %u\n"
 			     "  ?*VERSION-MICRO* = %u\n"
+			     "  ?*RANDOM-SEED* = %u\n"
 			     ")")
 	       % FAWKES_VERSION_MAJOR
 	       % FAWKES_VERSION_MINOR
-	       % FAWKES_VERSION_MICRO);
+	       % FAWKES_VERSION_MICRO
+	       % random_seed_);
 
   clips_->build(defglobal_ver);
 
   clips_->add_function("get-clips-dirs", sigc::slot<CLIPS::Values>(sigc::mem_fun(*this, &LLSFRefBox::clips_get_clips_dirs)));
   clips_->add_function("now", sigc::slot<CLIPS::Values>(sigc::mem_fun(*this, &LLSFRefBox::clips_now)));
+  setup_clips_time(clips_);
+  clips_->add_function("wakeup-every", sigc::slot<void, std::string, CLIPS::Value>(sigc::mem_fun(*this, &LLSFRefBox::clips_wakeup_every)));
+  clips_->add_function("wakeup-in", sigc::slot<void, std::string, CLIPS::Value>(sigc::mem_fun(*this, &LLSFRefBox::clips_wakeup_in)));
+  clips_->add_function("wakeup-cancel", sigc::slot<void, std::string>(sigc::mem_fun(*this, &LLSFRefBox::clips_wakeup_cancel)));
   clips_->add_function("load-config", sigc::slot<void, std::string>(sigc::mem_fun(*this, &LLSFRefBox::clips_load_config)));
   clips_->add_function("config-path-exists", sigc::slot<CLIPS::Value, std::string>(sigc::mem_fun(*this, &LLSFRefBox::clips_config_path_exists)));
   clips_->add_function("config-get-bool", sigc::slot<CLIPS::Value, std::string>(sigc::mem_fun(*this, &LLSFRefBox::clips_config_get_bool)));
+  clips_->add_function("journal-flush", sigc::slot<CLIPS::Values>(sigc::mem_fun(*this, &LLSFRefBox::clips_journal_flush)));
 
   if (mps_ && ! simulation) {
 		clips_->add_function("mps-move-conveyor",
@@ -556,10 +747,20 @@ LLSFRefBox::start_clips()
     logger_->log_warn("RefBox", "Failed to initialize CLIPS environment, batch file failed.");
     throw fawkes::Exception("Failed to initialize CLIPS environment, batch file failed.");
   }  
+  // replaces the time-based seed of init.clp, game parameterization and
+  // machine randomization can thus be reproduced from the same seed
+  clips_->evaluate(boost::str(boost::format("(seed %u)") % random_seed_));
 
   clips_->assert_fact("(init)");
   clips_->refresh_agenda();
   clips_->run();
+
+  if (! config_->exists("/llsfrb/clips/time-facts")) {
+    // rule sets without wakeups still match (time $?now) facts
+    cfg_clips_time_facts_ = ! clips_->get_template("wakeup");
+  }
+  logger_->log_info("RefBox", "%s (time) facts",
+		    cfg_clips_time_facts_ ? "Asserting" : "Not asserting");
 }
 
 void
@@ -591,13 +792,110 @@ LLSFRefBox::clips_now()
 {
   CLIPS::Values rv;
   struct timeval tv;
-  gettimeofday(&tv, 0);
+  get_time(tv);
   rv.push_back(tv.tv_sec);
   rv.push_back(tv.tv_usec);
   return rv;
 }
 
 
+/** Get current time.
+ * This is the wall time, or the replay time while replaying a game.
+ * @param tv upon return contains the current time
+ */
+void
+LLSFRefBox::get_time(struct timeval &tv)
+{
+  if (replay_) {
+    tv = replay_->now();
+  } else {
+    gettimeofday(&tv, 0);
+  }
+}
+
+/** Get current time for wakeups.
+ * @return current time in seconds, same clock as (now)
+ */
+double
+LLSFRefBox::wakeup_time_now()
+{
+  struct timeval tv;
+  get_time(tv);
+  return tv.tv_sec + tv.tv_usec / 1000000.;
+}
+
+void
+LLSFRefBox::clips_wakeup_every(std::string name, CLIPS::Value period)
+{
+  double p = std::max(0., clips_number(period));
+  std::map<std::string, ClipsWakeup>::iterator w = clips_wakeups_.find(name);
+  if (w == clips_wakeups_.end()) {
+    // first wakeup on the next tick, like a signal with zero time
+    ClipsWakeup wakeup = { wakeup_time_now(), p, true };
+    clips_wakeups_[name] = wakeup;
+  } else {
+    // keep the next due time, only change the period from then on
+    w->second.period   = p;
+    w->second.periodic = true;
+  }
+}
+
+void
+LLSFRefBox::clips_wakeup_in(std::string name, CLIPS::Value sec)
+{
+  double due = wakeup_time_now() + std::max(0., clips_number(sec));
+  std::map<std::string, ClipsWakeup>::iterator w = clips_wakeups_.find(name);
+  if (w == clips_wakeups_.end()) {
+    ClipsWakeup wakeup = { due, 0., false };
+    clips_wakeups_[name] = wakeup;
+  } else {
+    w->second.due = due;
+  }
+}
+
+void
+LLSFRefBox::clips_wakeup_cancel(std::string name)
+{
+  clips_wakeups_.erase(name);
+}
+
+
+/** Assert wakeup facts for all scheduled wakeups which are due.
+ * Only the rules matching a (wakeup (name ...)) fact are re-evaluated,
+ * instead of every rule matching a (time) fact on each tick.
+ * Must be called with the CLIPS mutex locked.
+ */
+void
+LLSFRefBox::clips_assert_wakeups()
+{
+  if (clips_wakeups_.empty())  return;
+
+  struct timeval tv;
+  get_time(tv);
+  double now = tv.tv_sec + tv.tv_usec / 1000000.;
+
+  std::map<std::string, ClipsWakeup>::iterator w = clips_wakeups_.begin();
+  while (w != clips_wakeups_.end()) {
+    if (w->second.due > now) {
+      ++w;
+      continue;
+    }
+
+    clips_->assert_fact_f("(wakeup (name %s) (time %ld %ld))", w->first.c_str(),
+			  (long int)tv.tv_sec, (long int)tv.tv_usec);
+
+    if (! w->second.periodic) {
+      clips_wakeups_.erase(w++);
+    } else {
+      w->second.due += w->second.period;
+      // fell behind, e.g. long rule execution, do not fire in a burst
+      if (w->second.due <= now)  w->second.due = now + w->second.period;
+      ++w;
+    }
+  }
+}
+
+
 CLIPS::Values
 LLSFRefBox::clips_get_clips_dirs()
 {
@@ -659,6 +957,26 @@ LLSFRefBox::clips_config_get_bool(std::string path)
   }
 }
 
+/** Wait until all journaled messages have been written.
+ * @return multifield of the number of messages dropped because the
+ * journal buffer was full and the number of messages which could not be
+ * written, both zero if the journal is disabled
+ */
+CLIPS::Values
+LLSFRefBox::clips_journal_flush()
+{
+  CLIPS::Values rv;
+  if (journal_) {
+    journal_->flush();
+    rv.push_back(CLIPS::Value((long long int)journal_->dropped()));
+    rv.push_back(CLIPS::Value((long long int)journal_->failed()));
+  } else {
+    rv.push_back(CLIPS::Value((long long int)0));
+    rv.push_back(CLIPS::Value((long long int)0));
+  }
+  return rv;
+}
+
 bool
 LLSFRefBox::mutex_future_ready(const std::string &name)
 {
@@ -960,7 +1278,47 @@ LLSFRefBox::clips_mps_reset_lights(std::string machine)
   }
 }
 
-#ifdef HAVE_MONGODB
+/** Append message to traffic journal.
+ * @param direction direction of the message
+ * @param via communication channel
+ * @param endpoint remote endpoint
+ * @param peer_id ID of the peer for peer messages, 0 otherwise
+ * @param component_id component ID of the message
+ * @param msg_type message type of the message
+ * @param m the message
+ */
+void
+LLSFRefBox::journal_write(JournalDirection direction, JournalVia via,
+			  const std::string &endpoint, uint16_t peer_id,
+			  uint16_t component_id, uint16_t msg_type,
+			  google::protobuf::Message &m)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  journal_->append(now, direction, via, endpoint, peer_id, component_id, msg_type, m);
+}
+
+/** Get component ID and message type of a message.
+ * @param m message to query
+ * @param component_id upon return contains the component ID, 0 if unknown
+ * @param msg_type upon return contains the message type, 0 if unknown
+ */
+void
+LLSFRefBox::get_comp_type(google::protobuf::Message &m,
+			  uint16_t &component_id, uint16_t &msg_type)
+{
+  component_id = msg_type = 0;
+  const google::protobuf::Descriptor *desc = m.GetDescriptor();
+  const google::protobuf::EnumDescriptor *enumdesc = desc->FindEnumTypeByName("CompType");
+  if (! enumdesc) return;
+  const google::protobuf::EnumValueDescriptor *compdesc =
+    enumdesc->FindValueByName("COMP_ID");
+  const google::protobuf::EnumValueDescriptor *msgtdesc =
+    enumdesc->FindValueByName("MSG_TYPE");
+  if (! compdesc || ! msgtdesc)  return;
+  component_id = compdesc->number();
+  msg_type = msgtdesc->number();
+}
 
 /** Handle message that came from a client.
  * @param client client ID
@@ -973,36 +1331,57 @@ LLSFRefBox::handle_server_client_msg(ProtobufStreamServer::ClientID client,
 				     uint16_t component_id, uint16_t msg_type,
 				     std::shared_ptr<google::protobuf::Message> msg)
 {
-  mongo::BSONObjBuilder meta;
-  meta.append("direction", "inbound");
-  meta.append("via", "server");
-  meta.append("component_id", component_id);
-  meta.append("msg_type", msg_type);
-  meta.append("client_id", client);
-  mongo::BSONObj meta_obj(meta.obj());
-  mongodb_protobuf_->write(*msg, meta_obj);
+  if (journal_) {
+    journal_write(JOURNAL_INBOUND, JOURNAL_VIA_SERVER, std::to_string(client), 0,
+		  component_id, msg_type, *msg);
+  }
+
+#ifdef HAVE_MONGODB
+  if (mongodb_protobuf_) {
+    mongo::BSONObjBuilder meta;
+    meta.append("direction", "inbound");
+    meta.append("via", "server");
+    meta.append("component_id", component_id);
+    meta.append("msg_type", msg_type);
+    meta.append("client_id", client);
+    mongo::BSONObj meta_obj(meta.obj());
+    mongodb_protobuf_->write(*msg, meta_obj);
+  }
+#endif
 }
 
-/** Handle message that came from a client.
- * @param client client ID
+/** Handle message that came from a peer.
+ * @param peer_id ID of the peer that received the message
+ * @param endpoint endpoint the message was received from
  * @param component_id component the message was addressed to
  * @param msg_type type of the message
  * @param msg the message
  */
 void
-LLSFRefBox::handle_peer_msg(boost::asio::ip::udp::endpoint &endpoint,
+LLSFRefBox::handle_peer_msg(long int peer_id, boost::asio::ip::udp::endpoint &endpoint,
 			    uint16_t component_id, uint16_t msg_type,
 			    std::shared_ptr<google::protobuf::Message> msg)
 {
-  mongo::BSONObjBuilder meta;
-  meta.append("direction", "inbound");
-  meta.append("via", "peer");
-  meta.append("endpoint-host", endpoint.address().to_string());
-  meta.append("endpoint-port", endpoint.port());
-  meta.append("component_id", component_id);
-  meta.append("msg_type", msg_type);
-  mongo::BSONObj meta_obj(meta.obj());
-  mongodb_protobuf_->write(*msg, meta_obj);
+  if (journal_) {
+    journal_write(JOURNAL_INBOUND, JOURNAL_VIA_PEER,
+		  endpoint.address().to_string() + ":" + std::to_string(endpoint.port()),
+		  peer_id, component_id, msg_type, *msg);
+  }
+
+#ifdef HAVE_MONGODB
+  if (mongodb_protobuf_) {
+    mongo::BSONObjBuilder meta;
+    meta.append("direction", "inbound");
+    meta.append("via", "peer");
+    meta.append("endpoint-host", endpoint.address().to_string());
+    meta.append("endpoint-port", endpoint.port());
+    meta.append("peer_id", (int)peer_id);
+    meta.append("component_id", component_id);
+    meta.append("msg_type", msg_type);
+    mongo::BSONObj meta_obj(meta.obj());
+    mongodb_protobuf_->write(*msg, meta_obj);
+  }
+#endif
 }
 
 /** Handle server reception failure
@@ -1018,24 +1397,6 @@ LLSFRefBox::handle_server_client_fail(ProtobufStreamServer::ClientID client,
 {
 }
 
-
-void
-LLSFRefBox::add_comp_type(google::protobuf::Message &m, mongo::BSONObjBuilder *b)
-{
-  const google::protobuf::Descriptor *desc = m.GetDescriptor();
-  const google::protobuf::EnumDescriptor *enumdesc = desc->FindEnumTypeByName("CompType");
-  if (! enumdesc) return;
-  const google::protobuf::EnumValueDescriptor *compdesc =
-    enumdesc->FindValueByName("COMP_ID");
-  const google::protobuf::EnumValueDescriptor *msgtdesc =
-    enumdesc->FindValueByName("MSG_TYPE");
-  if (! compdesc || ! msgtdesc)  return;
-  int comp_id = compdesc->number();
-  int msg_type = msgtdesc->number();
-  b->append("component_id", comp_id);
-  b->append("msg_type", msg_type);
-}
-
 /** Handle message that was sent to a server client.
  * @param client client ID
  * @param msg the message
@@ -1044,13 +1405,24 @@ void
 LLSFRefBox::handle_server_sent_msg(ProtobufStreamServer::ClientID client,
 				   std::shared_ptr<google::protobuf::Message> msg)
 {
-  mongo::BSONObjBuilder meta;
-  meta.append("direction", "outbound");
-  meta.append("via", "server");
-  meta.append("client_id", client);
-  add_comp_type(*msg, &meta);
-  mongo::BSONObj meta_obj(meta.obj());
-  mongodb_protobuf_->write(*msg, meta_obj);
+  if (journal_) {
+    uint16_t component_id, msg_type;
+    get_comp_type(*msg, component_id, msg_type);
+    journal_write(JOURNAL_OUTBOUND, JOURNAL_VIA_SERVER, std::to_string(client), 0,
+		  component_id, msg_type, *msg);
+  }
+
+#ifdef HAVE_MONGODB
+  if (mongodb_protobuf_) {
+    mongo::BSONObjBuilder meta;
+    meta.append("direction", "outbound");
+    meta.append("via", "server");
+    meta.append("client_id", client);
+    add_comp_type(*msg, &meta);
+    mongo::BSONObj meta_obj(meta.obj());
+    mongodb_protobuf_->write(*msg, meta_obj);
+  }
+#endif
 }
 
 /** Handle message that was sent with a client.
@@ -1062,14 +1434,65 @@ void
 LLSFRefBox::handle_client_sent_msg(std::string host, unsigned short int port,
 				   std::shared_ptr<google::protobuf::Message> msg)
 {
-  mongo::BSONObjBuilder meta;
-  meta.append("direction", "outbound");
-  meta.append("via", "client");
-  meta.append("host", host);
-  meta.append("port", port);
-  add_comp_type(*msg, &meta);
-  mongo::BSONObj meta_obj(meta.obj());
-  mongodb_protobuf_->write(*msg, meta_obj);
+  if (journal_) {
+    uint16_t component_id, msg_type;
+    get_comp_type(*msg, component_id, msg_type);
+    journal_write(JOURNAL_OUTBOUND, JOURNAL_VIA_CLIENT, host + ":" + std::to_string(port), 0,
+		  component_id, msg_type, *msg);
+  }
+
+#ifdef HAVE_MONGODB
+  if (mongodb_protobuf_) {
+    mongo::BSONObjBuilder meta;
+    meta.append("direction", "outbound");
+    meta.append("via", "client");
+    meta.append("host", host);
+    meta.append("port", port);
+    add_comp_type(*msg, &meta);
+    mongo::BSONObj meta_obj(meta.obj());
+    mongodb_protobuf_->write(*msg, meta_obj);
+  }
+#endif
+}
+
+/** Handle message that was broadcast by a peer.
+ * @param peer_id ID of the peer the message was sent with
+ * @param msg the message
+ */
+void
+LLSFRefBox::handle_peer_sent_msg(long int peer_id,
+				 std::shared_ptr<google::protobuf::Message> msg)
+{
+  if (journal_) {
+    uint16_t component_id, msg_type;
+    get_comp_type(*msg, component_id, msg_type);
+    journal_write(JOURNAL_OUTBOUND, JOURNAL_VIA_PEER, "", peer_id,
+		  component_id, msg_type, *msg);
+  }
+
+#ifdef HAVE_MONGODB
+  if (mongodb_protobuf_) {
+    mongo::BSONObjBuilder meta;
+    meta.append("direction", "outbound");
+    meta.append("via", "peer");
+    meta.append("peer_id", (int)peer_id);
+    add_comp_type(*msg, &meta);
+    mongo::BSONObj meta_obj(meta.obj());
+    mongodb_protobuf_->write(*msg, meta_obj);
+  }
+#endif
+}
+
+#ifdef HAVE_MONGODB
+
+void
+LLSFRefBox::add_comp_type(google::protobuf::Message &m, mongo::BSONObjBuilder *b)
+{
+  uint16_t component_id, msg_type;
+  get_comp_type(m, component_id, msg_type);
+  if (component_id == 0 && msg_type == 0)  return;
+  b->append("component_id", (int)component_id);
+  b->append("msg_type", (int)msg_type);
 }
 
 /** Setup MongoDB related CLIPS functions. */
@@ -1102,26 +1525,11 @@ LLSFRefBox::setup_clips_mongodb()
   clips_->add_function("bson-get", sigc::slot<CLIPS::Value, void *, std::string>(sigc::mem_fun(*this, &LLSFRefBox::clips_bson_get)));
   clips_->add_function("bson-get-array", sigc::slot<CLIPS::Values, void *, std::string>(sigc::mem_fun(*this, &LLSFRefBox::clips_bson_get_array)));
   clips_->add_function("bson-get-time", sigc::slot<CLIPS::Values, void *, std::string>(sigc::mem_fun(*this, &LLSFRefBox::clips_bson_get_time)));
+  clips_->add_function("mongodb-protobuf-flush", sigc::slot<CLIPS::Value>(sigc::mem_fun(*this, &LLSFRefBox::clips_mongodb_protobuf_flush)));
 
   clips_->build("(deffacts have-feature-mongodb (have-feature MongoDB))");
 }
 
-/** Handle message that was sent to a server client.
- * @param client client ID
- * @param msg the message
- */
-void
-LLSFRefBox::handle_peer_sent_msg(std::shared_ptr<google::protobuf::Message> msg)
-{
-  mongo::BSONObjBuilder meta;
-  meta.append("direction", "outbound");
-  meta.append("via", "peer");
-  add_comp_type(*msg, &meta);
-  mongo::BSONObj meta_obj(meta.obj());
-  mongodb_protobuf_->write(*msg, meta_obj);
-}
-
-
 CLIPS::Value
 LLSFRefBox::clips_bson_create()
 {
@@ -1523,6 +1931,20 @@ LLSFRefBox::clips_mongodb_cursor_next(void *cursor)
 }
 
 
+/** Wait until all logged protobuf messages have been written.
+ * @return number of messages dropped so far because the write queue
+ * was full, zero if protobuf logging is disabled
+ */
+CLIPS::Value
+LLSFRefBox::clips_mongodb_protobuf_flush()
+{
+  if (! mongodb_protobuf_)  return CLIPS::Value((long long int)0);
+
+  mongodb_protobuf_->flush();
+  return CLIPS::Value((long long int)mongodb_protobuf_->dropped());
+}
+
+
 CLIPS::Values
 LLSFRefBox::clips_bson_field_names(void *bson)
 {
@@ -1754,13 +2176,39 @@ LLSFRefBox::handle_timer(const boost::system::error_code& error)
 	}
       }
 
-      clips_->assert_fact("(time (now))");
+      struct timeval now;
+      if (replay_)  replay_->advance(pb_comm_, mps_placing_generator_.get());
+      get_time(now);
+
+      // messages journaled after this are processed on the next tick
+      if (journal_)  journal_->append_event(now, JOURNAL_EVENT_TICK);
+
+      if (pb_comm_)  pb_comm_->assert_queued_messages();
+      if (beacon_processor_)  beacon_processor_->assert_updates(now);
+      if (cfg_clips_time_facts_)  clips_->assert_fact("(time (now))");
+      clips_assert_wakeups();
       clips_->refresh_agenda();
       clips_->run();
+      if (pb_comm_)  pb_comm_->publish_due(now);
+
+      std::string field;
+      if (journal_ && mps_placing_generator_->take_reported_field(field)) {
+	journal_->append_event(now, JOURNAL_EVENT_FIELD, field);
+      }
+
+      if (replay_ && replay_->finished()) {
+	replay_matches_ = replay_->compare_outcome(clips_);
+	io_service_.stop();
+	return;
+      }
     }
 
-    timer_.expires_at(timer_.expires_at()
-		      + boost::posix_time::milliseconds(cfg_timer_interval_));
+    if (replay_) {
+      timer_.expires_from_now(boost::posix_time::milliseconds(replay_->tick_wait_ms()));
+    } else {
+      timer_.expires_at(timer_.expires_at()
+			+ boost::posix_time::milliseconds(cfg_timer_interval_));
+    }
     timer_.async_wait(boost::bind(&LLSFRefBox::handle_timer, this,
 				  boost::asio::placeholders::error));
   }
@@ -1781,7 +2229,9 @@ LLSFRefBox::handle_signal(const boost::system::error_code& error, int signum)
 
 
 /** Run the application.
- * @return return code, 0 if no error, error code otherwise
+ * When replaying a game, returns once the recording has been replayed.
+ * @return return code, 0 if no error, error code otherwise, 1 if a
+ * replayed game did not reach the recorded outcome
  */
 int
 LLSFRefBox::run()
@@ -1801,7 +2251,7 @@ LLSFRefBox::run()
 
   start_timer();
   io_service_.run();
-  return 0;
+  return (replay_ && ! replay_matches_) ? 1 : 0;
 }
 
 } // end of namespace llsfrb
@@ -41,6 +41,7 @@
 #include <boost/asio.hpp>
 #include <google/protobuf/message.h>
 #include <logging/logger.h>
+#include <logging/traffic_journal.h>
 #include <core/threading/mutex.h>
 #include <core/threading/mutex_locker.h>
 #include <utils/llsf/machines.h>
@@ -85,6 +86,8 @@ namespace llsfrb {
 
 class Configuration;
 class MultiLogger;
+class BeaconProcessor;
+class GameReplay;
 
 class LLSFRefBox
 {
@@ -106,12 +109,21 @@ class LLSFRefBox
   void          setup_clips();
   void          handle_clips_periodic();
   void          setup_clips_mongodb();
+  void          setup_replay();
+
+  void          get_time(struct timeval &tv);
+  double        wakeup_time_now();
 
   CLIPS::Values clips_now();
+  void          clips_wakeup_every(std::string name, CLIPS::Value period);
+  void          clips_wakeup_in(std::string name, CLIPS::Value sec);
+  void          clips_wakeup_cancel(std::string name);
+  void          clips_assert_wakeups();
   CLIPS::Values clips_get_clips_dirs();
   void          clips_load_config(std::string cfg_prefix);
   CLIPS::Value  clips_config_path_exists(std::string path);
   CLIPS::Value  clips_config_get_bool(std::string path);
+  CLIPS::Values clips_journal_flush();
 
 	bool mutex_future_ready(const std::string &name);
 
@@ -139,6 +151,7 @@ class LLSFRefBox
   CLIPS::Value  clips_mongodb_cursor_more(void *cursor);
   CLIPS::Value  clips_mongodb_cursor_next(void *cursor);
   void          clips_mongodb_cursor_destroy(void *cursor);
+  CLIPS::Value  clips_mongodb_protobuf_flush();
   CLIPS::Values clips_bson_field_names(void *bson);
   CLIPS::Value  clips_bson_get(void *bson, std::string field_name);
   CLIPS::Values clips_bson_get_array(void *bson, std::string field_name);
@@ -169,18 +182,24 @@ class LLSFRefBox
   void handle_server_client_fail(protobuf_comm::ProtobufStreamServer::ClientID client,
 				 uint16_t component_id, uint16_t msg_type,
 				 std::string msg);
-  void handle_peer_msg(boost::asio::ip::udp::endpoint &endpoint,
+  void handle_peer_msg(long int peer_id, boost::asio::ip::udp::endpoint &endpoint,
 		       uint16_t component_id, uint16_t msg_type,
 		       std::shared_ptr<google::protobuf::Message> msg);
 
   void handle_server_sent_msg(protobuf_comm::ProtobufStreamServer::ClientID client,
 			      std::shared_ptr<google::protobuf::Message> msg);
 
-  void handle_peer_sent_msg(std::shared_ptr<google::protobuf::Message> msg);
+  void handle_peer_sent_msg(long int peer_id, std::shared_ptr<google::protobuf::Message> msg);
 
   void handle_client_sent_msg(std::string host, unsigned short port,
 			      std::shared_ptr<google::protobuf::Message> msg);
 
+  void journal_write(JournalDirection direction, JournalVia via, const std::string &endpoint,
+		     uint16_t peer_id, uint16_t component_id, uint16_t msg_type,
+		     google::protobuf::Message &m);
+  static void get_comp_type(google::protobuf::Message &m,
+			    uint16_t &component_id, uint16_t &msg_type);
+
 #ifdef HAVE_MONGODB
   void add_comp_type(google::protobuf::Message &m, mongo::BSONObjBuilder *b);
 #endif
@@ -191,6 +210,7 @@ class LLSFRefBox
   MultiLogger   *clips_logger_;
   Logger::LogLevel log_level_;
   protobuf_clips::ClipsProtobufCommunicator *pb_comm_;
+  BeaconProcessor *beacon_processor_;
   std::shared_ptr<mps_placing_clips::MPSPlacingGenerator> mps_placing_generator_;
 
   CLIPS::Environment                       *clips_;
@@ -200,11 +220,21 @@ class LLSFRefBox
 
 	std::map<std::string, std::future<bool>> mutex_futures_;
 
+  /// @cond INTERNALS
+  typedef struct {
+    double due;
+    double period;
+    bool   periodic;
+  } ClipsWakeup;
+  /// @endcond
+  std::map<std::string, ClipsWakeup>        clips_wakeups_;
+
 	boost::asio::io_service      io_service_;
   boost::asio::deadline_timer  timer_;
   boost::posix_time::ptime     timer_last_;
 
   unsigned int cfg_timer_interval_;
+  bool         cfg_clips_time_facts_;
   std::string  cfg_clips_dir_;
   llsf_utils::MachineAssignment cfg_machine_assignment_;
 
@@ -213,6 +243,13 @@ class LLSFRefBox
   fawkes::NetworkNameResolver  *nnresolver_;
 #endif
 
+  bool                  log_traffic_;
+  TrafficJournalWriter *journal_;
+
+  uint32_t              random_seed_;
+  GameReplay           *replay_;
+  bool                  replay_matches_;
+
 #ifdef HAVE_MONGODB
   bool                cfg_mongodb_enabled_;
   std::string         cfg_mongodb_hostport_;
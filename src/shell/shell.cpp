@@ -44,6 +44,7 @@
 #include "colors.h"
 
 #include <protobuf_comm/client.h>
+#include <protobuf_comm/compression.h>
 #include <config/yaml.h>
 
 #include <msgs/GameState.pb.h>
@@ -71,7 +72,8 @@
 
 // defined in miliseconds
 #define TIMER_INTERVAL 500
-#define RECONNECT_TIMER_INTERVAL 1000
+#define RECONNECT_MIN_INTERVAL 1000
+#define RECONNECT_MAX_INTERVAL 8000
 #define BLINK_TIMER_INTERVAL 250
 #define ATTMSG_TIMER_INTERVAL 1000
 #define MIN_NUM_ROBOTS 6
@@ -83,13 +85,49 @@ namespace llsfrb_shell {
 }
 #endif
 
+/** Merge a delta-encoded info message into the last full update.
+ * @param last last full info message, may be empty
+ * @param update newly received info message
+ * @param entries accessor for the repeated entry field of the info message
+ * @param key function returning an identifying key of an entry
+ * @return full info message after applying the update, or an empty
+ * pointer if an update has been missed and the next keyframe must be awaited
+ */
+template <class InfoMsg, class Entry, class KeyFunc>
+static std::shared_ptr<InfoMsg>
+merge_delta(std::shared_ptr<InfoMsg> &last, std::shared_ptr<InfoMsg> &update,
+	    google::protobuf::RepeatedPtrField<Entry> * (InfoMsg::*entries)(), KeyFunc key)
+{
+  if (! update->delta())  return update;
+  if (! last || ! last->has_seq() || update->seq() != last->seq() + 1) {
+    return std::shared_ptr<InfoMsg>();
+  }
+
+  std::shared_ptr<InfoMsg> merged(new InfoMsg(*last));
+  google::protobuf::RepeatedPtrField<Entry> *merged_entries = ((*merged).*entries)();
+  for (const Entry &e : *((*update).*entries)()) {
+    int i;
+    for (i = 0; i < merged_entries->size(); ++i) {
+      if (key(merged_entries->Get(i)) == key(e))  break;
+    }
+    if (i < merged_entries->size()) {
+      merged_entries->Mutable(i)->CopyFrom(e);
+    } else {
+      merged_entries->Add()->CopyFrom(e);
+    }
+  }
+  merged->set_seq(update->seq());
+  merged->set_delta(false);
+  return merged;
+}
+
 
 LLSFRefBoxShell::LLSFRefBoxShell()
   : quit_(false), error_(NULL), panel_(nullptr), navbar_(nullptr),
     rb_log_(nullptr), p_orders_(nullptr), p_attmsg_(nullptr), p_state_(nullptr),
     p_phase_(nullptr), p_time_(nullptr), p_points_(nullptr), p_team_cyan_(nullptr),
     p_team_magenta_(nullptr), m_state_(nullptr),  m_phase_(nullptr),
-    timer_(io_service_), reconnect_timer_(io_service_), try_reconnect_(true),
+    timer_(io_service_),
     blink_timer_(io_service_), attmsg_timer_(io_service_), attmsg_toggle_(true),
     attmsg_team_specific_(false), beep_warning_shown_(false)
 {
@@ -104,10 +142,8 @@ LLSFRefBoxShell::~LLSFRefBoxShell()
 {
   quit_ = true;
   io_service_.stop();
-  try_reconnect_ = false;
       
   timer_.cancel();
-  reconnect_timer_.cancel();
   blink_timer_.cancel();
   attmsg_timer_.cancel();
   stdin_->cancel();
@@ -176,7 +212,6 @@ void
 LLSFRefBoxShell::handle_signal(const boost::system::error_code& error, int signum)
 {
   timer_.cancel();
-  reconnect_timer_.cancel();
   blink_timer_.cancel();
   attmsg_timer_.cancel();
   io_service_.stop();
@@ -448,14 +483,16 @@ LLSFRefBoxShell::handle_attmsg_timer(const boost::system::error_code& error)
 }
 
 
-/** Handle reconnect timer event.
- * @param error error code
+/** Connect to the refbox.
+ * Uses the local socket if one is configured, TCP otherwise.
  */
 void
-LLSFRefBoxShell::handle_reconnect_timer(const boost::system::error_code& error)
+LLSFRefBoxShell::connect_refbox()
 {
-  if (! error && try_reconnect_ && ! quit_) {
+  if (cfg_refbox_socket_.empty()) {
     client->async_connect(cfg_refbox_host_.c_str(), cfg_refbox_port_);
+  } else {
+    client->async_connect_local(cfg_refbox_socket_.c_str());
   }
 }
 
@@ -619,13 +656,6 @@ LLSFRefBoxShell::client_disconnected(const boost::system::error_code &error)
     for (size_t i = 0; i < robots_.size(); ++i) {
       robots_[i]->reset();
     }
-
-    if (try_reconnect_) {
-      reconnect_timer_.expires_from_now(boost::posix_time::milliseconds(RECONNECT_TIMER_INTERVAL));
-      reconnect_timer_.async_wait(boost::bind(&LLSFRefBoxShell::handle_reconnect_timer, this,
-					      boost::asio::placeholders::error));
-    }
-
   }
   io_service_.dispatch(boost::bind(&LLSFRefBoxShell::refresh, this));
 }
@@ -761,7 +791,11 @@ LLSFRefBoxShell::client_msg(uint16_t comp_id, uint16_t msg_type,
   }
 
   std::shared_ptr<llsf_msgs::RobotInfo> r;
-  if ((r = std::dynamic_pointer_cast<llsf_msgs::RobotInfo>(msg))) {
+  if ((r = std::dynamic_pointer_cast<llsf_msgs::RobotInfo>(msg)) &&
+      (r = merge_delta(last_robotinfo_, r, &llsf_msgs::RobotInfo::mutable_robots,
+		       [](const llsf_msgs::Robot &robot)
+		       { return std::make_pair(robot.team_color(), robot.number()); })))
+  {
     last_robotinfo_ = r;
     size_t idx = 0;
     for (int i = 0; i < r->robots_size(); ++i, ++idx) {
@@ -788,7 +822,10 @@ LLSFRefBoxShell::client_msg(uint16_t comp_id, uint16_t msg_type,
   }
 
   std::shared_ptr<llsf_msgs::MachineInfo> minfo;
-  if ((minfo = std::dynamic_pointer_cast<llsf_msgs::MachineInfo>(msg))) {
+  if ((minfo = std::dynamic_pointer_cast<llsf_msgs::MachineInfo>(msg)) &&
+      (minfo = merge_delta(last_minfo_, minfo, &llsf_msgs::MachineInfo::mutable_machines,
+			   [](const llsf_msgs::Machine &m) { return m.name(); })))
+  {
     last_minfo_ = minfo;
     for (int i = 0; i < minfo->machines_size(); ++i) {
       std::map<std::string, LLSFRefBoxShellMachine *>::iterator mpanel;
@@ -830,7 +867,10 @@ LLSFRefBoxShell::client_msg(uint16_t comp_id, uint16_t msg_type,
   }
 
   std::shared_ptr<llsf_msgs::OrderInfo> ordins;
-  if ((ordins = std::dynamic_pointer_cast<llsf_msgs::OrderInfo>(msg))) {
+  if ((ordins = std::dynamic_pointer_cast<llsf_msgs::OrderInfo>(msg)) &&
+      (ordins = merge_delta(last_orderinfo_, ordins, &llsf_msgs::OrderInfo::mutable_orders,
+			    [](const llsf_msgs::Order &o) { return o.id(); })))
+  {
     last_orderinfo_ = ordins;
     const size_t size = std::min((size_t)ordins->orders_size(), (size_t)orders_.size());
     size_t oidx = 0;
@@ -962,6 +1002,13 @@ LLSFRefBoxShell::run()
 {
   cfg_refbox_host_ = config_->get_string("/llsfrb/shell/refbox-host");
   cfg_refbox_port_ = config_->get_uint("/llsfrb/shell/refbox-port");
+  try {
+    cfg_refbox_socket_ = config_->get_string("/llsfrb/shell/refbox-socket");
+  } catch (std::exception &e) {} // ignored, connect via TCP
+  try {
+    std::string compression = config_->get_string("/llsfrb/shell/compression");
+    client->set_compression(compression_name_to_id(compression.c_str()));
+  } catch (std::exception &e) {} // ignored, no compression
 
   panel_ = new NCursesPanel(LINES - 1, COLS);
   navbar_ = new NCursesPanel(1, COLS, LINES - 1, 0);
@@ -1200,7 +1247,8 @@ LLSFRefBoxShell::run()
   client->signal_received().connect(
     boost::bind(&LLSFRefBoxShell::dispatch_client_msg, this, _1, _2, _3));
 
-  client->async_connect(cfg_refbox_host_.c_str(), cfg_refbox_port_);
+  client->set_reconnect(true, RECONNECT_MIN_INTERVAL, RECONNECT_MAX_INTERVAL);
+  connect_refbox();
 
 #if BOOST_ASIO_VERSION >= 100601
   // Construct a signal set registered for process termination.
@@ -97,7 +97,7 @@ class LLSFRefBoxShell
   void handle_timer(const boost::system::error_code& error);
   void handle_blink_timer(const boost::system::error_code& error);
   void handle_attmsg_timer(const boost::system::error_code& error);
-  void handle_reconnect_timer(const boost::system::error_code& error);
+  void connect_refbox();
   void handle_signal(const boost::system::error_code& error, int signum);
 
   void dispatch_client_connected();
@@ -171,8 +171,6 @@ class LLSFRefBoxShell
 
   boost::asio::io_service      io_service_;
   boost::asio::deadline_timer  timer_;
-  boost::asio::deadline_timer  reconnect_timer_;
-  bool                         try_reconnect_;
   boost::asio::deadline_timer  blink_timer_;
   boost::asio::deadline_timer  attmsg_timer_;
   bool                         attmsg_toggle_;
@@ -188,6 +186,7 @@ class LLSFRefBoxShell
   protobuf_comm::ProtobufStreamClient *client;
 
   std::string  cfg_refbox_host_;
+  std::string  cfg_refbox_socket_;
   unsigned int cfg_refbox_port_;
 
   bool beep_warning_shown_;
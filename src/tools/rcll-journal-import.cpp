@@ -0,0 +1,225 @@
+/***************************************************************************
+ *  rcll-journal-import.cpp - import a traffic journal into MongoDB
+ *
+ *  Created: Mon Oct 19 00:50:41 2026
+ *  Copyright  2026  agent
+ ****************************************************************************/
+
+/*  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * - Neither the name of the authors nor the names of its contributors
+ *   may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config/yaml.h>
+#include <logging/traffic_journal.h>
+#include <mongodb_log/mongodb_log_protobuf.h>
+#include <protobuf_comm/message_register.h>
+#include <utils/system/argparser.h>
+
+#include <mongo/client/dbclient.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace llsfrb;
+using namespace fawkes;
+
+void
+usage(const char *progname)
+{
+  printf("Usage: %s [-H host:port] [-c collection] [-b batch-size] <segment> [...]\n"
+	 " -H host:port     MongoDB server, default from config\n"
+	 " -c collection    collection to write to, default from config\n"
+	 " -b batch-size    number of documents per insert (default 1000)\n"
+	 "Segments are imported in the given order, e.g. journal/traffic-*.journal\n",
+         progname);
+}
+
+static std::vector<std::string>
+get_proto_dirs(Configuration *config)
+{
+  std::vector<std::string> proto_dirs;
+  try {
+    proto_dirs = config->get_strings("/llsfrb/comm/protobuf-dirs");
+  } catch (Exception &e) {} // ignore, use default
+
+  for (size_t i = 0; i < proto_dirs.size(); ++i) {
+    std::string::size_type pos;
+    if ((pos = proto_dirs[i].find("@BASEDIR@")) != std::string::npos) {
+      proto_dirs[i].replace(pos, 9, BASEDIR);
+    }
+    if ((pos = proto_dirs[i].find("@RESDIR@")) != std::string::npos) {
+      proto_dirs[i].replace(pos, 8, RESDIR);
+    }
+    if ((pos = proto_dirs[i].find("@CONFDIR@")) != std::string::npos) {
+      proto_dirs[i].replace(pos, 9, CONFDIR);
+    }
+    if ((pos = proto_dirs[i].find("@SHAREDIR@")) != std::string::npos) {
+      proto_dirs[i].replace(pos, 10, SHAREDIR);
+    }
+    if (proto_dirs[i][proto_dirs[i].size()-1] != '/') {
+      proto_dirs[i] += "/";
+    }
+  }
+  return proto_dirs;
+}
+
+/* Meta data as written by the refbox when logging directly to MongoDB. */
+static mongo::BSONObj
+meta_for(const JournalRecord &r)
+{
+  mongo::BSONObjBuilder meta;
+  meta.append("direction", journal_direction_name(r.direction));
+  meta.append("via", journal_via_name(r.via));
+
+  std::string host;
+  int port = 0;
+  std::string::size_type colon = r.endpoint.rfind(':');
+  if (colon != std::string::npos) {
+    host = r.endpoint.substr(0, colon);
+    port = atoi(r.endpoint.substr(colon + 1).c_str());
+  }
+
+  if (r.via == JOURNAL_VIA_SERVER) {
+    meta.append("client_id", atoi(r.endpoint.c_str()));
+  } else if (r.via == JOURNAL_VIA_CLIENT) {
+    meta.append("host", host);
+    meta.append("port", port);
+  } else if (r.via == JOURNAL_VIA_PEER) {
+    if (! host.empty()) {
+      meta.append("endpoint-host", host);
+      meta.append("endpoint-port", port);
+    }
+    if (r.peer_id != 0)  meta.append("peer_id", (int)r.peer_id);
+  }
+
+  if (r.component_id != 0 || r.msg_type != 0) {
+    meta.append("component_id", (int)r.component_id);
+    meta.append("msg_type", (int)r.msg_type);
+  }
+  return meta.obj();
+}
+
+
+int
+main(int argc, char **argv)
+{
+  ArgumentParser argp(argc, argv, "hH:c:b:");
+
+  if (argp.has_arg("h") || argp.num_items() < 1) {
+    usage(argv[0]);
+    exit(1);
+  }
+
+  Configuration *config = new YamlConfiguration(CONFDIR);
+  config->load("config.yaml");
+
+  std::string hostport = "localhost";
+  std::string collection = "llsfrb.protobuf";
+  try {
+    hostport = config->get_string("/llsfrb/mongodb/hostport");
+  } catch (Exception &e) {} // ignore, use default
+  try {
+    collection = config->get_string("/llsfrb/mongodb/collections/protobuf");
+  } catch (Exception &e) {} // ignore, use default
+  if (argp.has_arg("H"))  hostport = argp.arg("H");
+  if (argp.has_arg("c"))  collection = argp.arg("c");
+
+  size_t batch_size = 1000;
+  if (argp.has_arg("b"))  batch_size = std::max(1, atoi(argp.arg("b")));
+
+  std::vector<std::string> proto_dirs = get_proto_dirs(config);
+  protobuf_comm::MessageRegister mr(proto_dirs);
+  delete config;
+
+  mongo::DBClientConnection mongodb(/* auto reconnect */ true);
+  std::string errmsg;
+  if (! mongodb.connect(hostport, errmsg)) {
+    printf("Could not connect to MongoDB at %s: %s\n", hostport.c_str(), errmsg.c_str());
+    exit(2);
+  }
+
+  std::vector<std::string> segments(argp.items().begin(), argp.items().end());
+  TrafficJournalReader reader(segments);
+
+  unsigned long int imported = 0, skipped = 0;
+  std::vector<mongo::BSONObj> batch;
+  batch.reserve(batch_size);
+
+  try {
+    JournalRecord r;
+    while (reader.next(r)) {
+      // events only matter for replaying from the journal
+      if (r.via == JOURNAL_VIA_EVENT)  continue;
+
+      std::shared_ptr<google::protobuf::Message> m;
+      try {
+	m = mr.new_message_for(r.type_name);
+      } catch (std::runtime_error &e) {
+	++skipped;
+	continue;
+      }
+      if (! m->ParseFromString(r.data)) {
+	++skipped;
+	continue;
+      }
+
+      mongo::BSONObjBuilder b;
+      b.appendDate("_time", (mongo::Date_t)(r.time.tv_sec * 1000 + r.time.tv_usec / 1000));
+      MongoDBLogProtobuf::to_bson(*m, &b);
+      b.append("_meta", meta_for(r));
+      batch.push_back(b.obj());
+
+      if (batch.size() >= batch_size) {
+	mongodb.insert(collection, batch);
+	imported += batch.size();
+	batch.clear();
+      }
+    }
+    if (! batch.empty()) {
+      mongodb.insert(collection, batch);
+      imported += batch.size();
+    }
+  } catch (Exception &e) {
+    printf("Failed to read journal: %s\n", e.what_no_backtrace());
+    exit(3);
+  } catch (mongo::DBException &e) {
+    printf("Failed to write to MongoDB: %s\n", e.what());
+    exit(4);
+  }
+
+  printf("Imported %lu messages into %s", imported, collection.c_str());
+  if (skipped > 0)  printf(", skipped %lu which could not be decoded", skipped);
+  if (reader.truncated() > 0)  printf(", %u segments ended in a partial record", reader.truncated());
+  printf("\n");
+
+  // Delete all global objects allocated by libprotobuf
+  google::protobuf::ShutdownProtobufLibrary();
+  return 0;
+}
@@ -261,6 +261,14 @@ main(int argc, char **argv)
   message_register.add_message_type<VersionInfo>();
   message_register.add_message_type<GameState>();
 
+  // only the registered types are evaluated, have the refbox skip all others
+  std::vector<std::pair<uint16_t, uint16_t>> subscriptions;
+  subscriptions.push_back(std::make_pair((uint16_t)VersionInfo::COMP_ID,
+                                         (uint16_t)VersionInfo::MSG_TYPE));
+  subscriptions.push_back(std::make_pair((uint16_t)GameState::COMP_ID,
+                                         (uint16_t)GameState::MSG_TYPE));
+  client_->subscribe(subscriptions);
+
   client_->signal_received().connect(handle_message);
   /*
   client_->signal_connected().connect(boost::bind(handle_connected,